@@ -0,0 +1,232 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ciphers.h"
+
+struct BenchmarkOptions {
+	/* Every case runs at least this long, in seconds, per input size */
+	double min_time = 0.2;
+
+	/* Input sizes go from min_size to max_size, growing 16 times at every step */
+	std::size_t min_size = 64;
+	std::size_t max_size = std::size_t(16) << 20;
+
+	/* Only cases whose name contains this run */
+	std::string filter;
+};
+
+/* Throughput suite over every cipher in ciphers.h, in the spirit of Google Benchmark. Each case is
+timed over a range of input sizes and reports ns/byte, MB/s and heap allocations per call, either as
+a table or as JSON that can be kept around for regression tracking. */
+class Benchmark {
+public:
+	using Options = BenchmarkOptions;
+
+	/* One call over size bytes of input, writing to output when the case produces bytes */
+	using Body = std::function<void(const uint8_t* input, uint8_t* output, std::size_t size)>;
+
+	struct Case {
+		std::string name;
+		Body body;
+	};
+
+	struct Result {
+		std::string name;
+		std::size_t bytes;
+		uint64_t iterations;
+		double seconds;
+		uint64_t allocations;
+
+		double ns_per_byte() const { return seconds * 1e9 / (static_cast<double>(bytes) * iterations); }
+		double megabytes_per_second() const { return static_cast<double>(bytes) * iterations / seconds / 1e6; }
+		double allocations_per_call() const { return static_cast<double>(allocations) / iterations; }
+	};
+
+	/* Bumped by the global operator new of the executable, see main.cpp. Stays at zero when the
+	executable does not count, in which case allocations are reported as zero. */
+	static std::atomic<uint64_t>& allocation_counter() {
+		static std::atomic<uint64_t> counter(0);
+		return counter;
+	}
+
+	/* Every cipher with encode and decode and the key lengths worth telling apart */
+	static std::vector<Case> cases() {
+		std::vector<Case> suite;
+
+		const TranslationTable caesar_encode = Caesar::shift_table(3);
+		const TranslationTable caesar_decode = Caesar::shift_table(3, true);
+		suite.push_back({ "caesar/encode", [caesar_encode](const uint8_t* input, uint8_t* output, std::size_t size) { caesar_encode.apply(input, output, size); } });
+		suite.push_back({ "caesar/decode", [caesar_decode](const uint8_t* input, uint8_t* output, std::size_t size) { caesar_decode.apply(input, output, size); } });
+		suite.push_back({ "caesar/string", string_case([](std::string data) { return Caesar::caesar_shift(std::move(data), 3); }) });
+		suite.push_back({ "caesar/parallel", [](const uint8_t* input, uint8_t* output, std::size_t size) { Parallel::caesar_shift(input, output, size, 3); } });
+		suite.push_back({ "rot13/string", string_case([](std::string data) { return Caesar::rot13(std::move(data)); }) });
+		suite.push_back({ "atbash/encode", [](const uint8_t* input, uint8_t* output, std::size_t size) { Atbash::atbash_apply(input, output, size); } });
+		suite.push_back({ "atbash/string", string_case([](std::string data) { return Atbash::atbash_apply(std::move(data)); }) });
+
+		for (std::size_t key_size : { 1, 16, 256 }) {
+			const std::string key = random_text(key_size, true);
+			const std::string suffix = "/key:" + std::to_string(key_size);
+			std::shared_ptr<const Vigenere::KeySchedule> schedule = std::make_shared<Vigenere::KeySchedule>(Vigenere::key_schedule(reinterpret_cast<const uint8_t*>(key.data()), key.size()));
+
+			suite.push_back({ "vigenere/encode" + suffix, [schedule](const uint8_t* input, uint8_t* output, std::size_t size) { Vigenere::vigenere_apply(input, output, size, *schedule, 0, false); } });
+			suite.push_back({ "vigenere/decode" + suffix, [schedule](const uint8_t* input, uint8_t* output, std::size_t size) { Vigenere::vigenere_apply(input, output, size, *schedule, 0, true); } });
+			suite.push_back({ "vigenere/string" + suffix, string_case([key](std::string data) { return Vigenere::vigenere_lookup(std::move(data), key); }) });
+			suite.push_back({ "vigenere/parallel" + suffix, [key](const uint8_t* input, uint8_t* output, std::size_t size) {
+				Parallel::vigenere_lookup(input, output, size, reinterpret_cast<const uint8_t*>(key.data()), key.size());
+			} });
+
+			/* XOR is its own inverse, encode and decode are the same call */
+			std::shared_ptr<const CompiledXor> xor_key = std::make_shared<CompiledXor>(key);
+			suite.push_back({ "xor/apply" + suffix, [xor_key](const uint8_t* input, uint8_t* output, std::size_t size) { xor_key->apply(input, output, size); } });
+			suite.push_back({ "xor/string" + suffix, string_case([key](std::string data) { return Xor::apply_xor(std::move(data), key); }) });
+			suite.push_back({ "xor/parallel" + suffix, [key](const uint8_t* input, uint8_t* output, std::size_t size) {
+				Parallel::apply_xor(input, output, size, reinterpret_cast<const uint8_t*>(key.data()), key.size());
+			} });
+		}
+
+		std::shared_ptr<const Polybius::Square> square = std::make_shared<Polybius::Square>(Polybius::keyed_matrix("Unique", 'Z'));
+		suite.push_back({ "polybius/encode", [square](const uint8_t* input, uint8_t* output, std::size_t size) { Polybius::encode_packed(*square, input, size, output); } });
+		suite.push_back({ "polybius/decode", [square](const uint8_t* input, uint8_t* output, std::size_t size) { Polybius::decode_packed(*square, input, size, output); } });
+		suite.push_back({ "polybius/string", [](const uint8_t* input, uint8_t*, std::size_t size) {
+			Polybius::encode_data(std::string(reinterpret_cast<const char*>(input), size), "Unique", 'Z');
+		} });
+
+		/* The same layered scheme as separate calls, one pass each, and as one fused pass */
+		const std::string layer_key = random_text(16, true);
+		std::shared_ptr<const Pipeline> layers = std::make_shared<Pipeline>(Pipeline().caesar(3).atbash().vigenere(layer_key).repeating_xor(layer_key).rot13());
+		std::shared_ptr<const CompiledVigenere> layer_vigenere = std::make_shared<CompiledVigenere>(layer_key);
+		std::shared_ptr<const CompiledXor> layer_xor = std::make_shared<CompiledXor>(layer_key);
+		suite.push_back({ "pipeline/separate", [layer_vigenere, layer_xor](const uint8_t* input, uint8_t* output, std::size_t size) {
+			Caesar::caesar_shift(input, output, size, 3);
+			Atbash::atbash_apply(output, output, size);
+			layer_vigenere->encode(output, output, size);
+			layer_xor->apply(output, output, size);
+			Caesar::caesar_shift(output, output, size, 13);
+		} });
+		suite.push_back({ "pipeline/fused", [layers](const uint8_t* input, uint8_t* output, std::size_t size) { layers->run(input, output, size); } });
+
+		suite.push_back({ "analysis/caesar", [](const uint8_t* input, uint8_t*, std::size_t size) { FrequencyAnalysis::crack(input, size); } });
+		suite.push_back({ "analysis/vigenere", [](const uint8_t* input, uint8_t*, std::size_t size) { VigenereAnalysis::analyze(input, size); } });
+		suite.push_back({ "analysis/xor", [](const uint8_t* input, uint8_t*, std::size_t size) { XorAnalysis::analyze(input, size); } });
+
+		return suite;
+	}
+
+	/* Runs every case that matches the filter over every size and returns the results in order */
+	static std::vector<Result> run(const Options& options = Options(), std::ostream* progress = nullptr) {
+		std::vector<Case> suite = cases();
+		std::vector<Result> results;
+
+		/* Input is letters and punctuation like most plaintext, decode cases get ciphertext of the
+		matching form so that every byte is a valid coordinate or symbol */
+		std::string text = random_text(options.max_size, false);
+		std::vector<uint8_t> output(options.max_size);
+		std::vector<uint8_t> packed;
+
+		for (const Case& entry : suite) {
+			if (!options.filter.empty() && entry.name.find(options.filter) == std::string::npos) continue;
+
+			const uint8_t* input = reinterpret_cast<const uint8_t*>(text.data());
+			if (entry.name == "polybius/decode") {
+				if (packed.empty()) {
+					packed.resize(options.max_size);
+					Polybius::encode_packed(Polybius::Square(Polybius::keyed_matrix("Unique", 'Z')), reinterpret_cast<const uint8_t*>(random_text(options.max_size, true).data()), options.max_size, packed.data());
+				}
+				input = packed.data();
+			}
+
+			for (std::size_t size = options.min_size; size <= options.max_size; size *= 16) {
+				Result result = measure(entry, input, output.data(), size, options.min_time);
+				if (progress != nullptr) print_row(*progress, result);
+				results.push_back(result);
+				if (size > options.max_size / 16) break;
+			}
+		}
+
+		return results;
+	}
+
+	static void print_row(std::ostream& stream, const Result& result) {
+		char line[160];
+		std::snprintf(line, sizeof(line), "%-28s %12zu %12.3f ns/B %10.1f MB/s %8.2f allocs/call", result.name.c_str(), result.bytes, result.ns_per_byte(), result.megabytes_per_second(), result.allocations_per_call());
+		stream << line << std::endl;
+	}
+
+	/* Same layout as Google Benchmark's JSON reporter, plus the per byte figures */
+	static void write_json(std::ostream& stream, const std::vector<Result>& results) {
+		static const char* level_names[] = { "scalar", "sse2", "ssse3", "avx2", "avx512" };
+
+		stream << "{\n  \"context\": {\n";
+		stream << "    \"simd_level\": \"" << level_names[static_cast<uint32_t>(Simd::level())] << "\",\n";
+		stream << "    \"threads\": " << ThreadPool::shared().size() << "\n  },\n";
+		stream << "  \"benchmarks\": [\n";
+
+		for (std::size_t i = 0; i < results.size(); i++) {
+			const Result& result = results[i];
+			char line[512];
+			std::snprintf(line, sizeof(line),
+				"    {\"name\": \"%s/size:%zu\", \"iterations\": %llu, \"real_time\": %.3f, \"time_unit\": \"ns\", \"bytes\": %zu, "
+				"\"bytes_per_second\": %.1f, \"ns_per_byte\": %.6f, \"allocations_per_iteration\": %.3f}%s\n",
+				result.name.c_str(), result.bytes, static_cast<unsigned long long>(result.iterations), result.seconds * 1e9 / result.iterations, result.bytes,
+				result.megabytes_per_second() * 1e6, result.ns_per_byte(), result.allocations_per_call(), i + 1 == results.size() ? "" : ",");
+			stream << line;
+		}
+
+		stream << "  ]\n}" << std::endl;
+	}
+
+private:
+	/* Calls the body until it has run for min_time, one untimed warm up call first */
+	static Result measure(const Case& entry, const uint8_t* input, uint8_t* output, std::size_t size, double min_time) {
+		using clock = std::chrono::steady_clock;
+		entry.body(input, output, size);
+
+		uint64_t iterations = 1;
+		while (true) {
+			uint64_t allocations_before = allocation_counter().load(std::memory_order_relaxed);
+			clock::time_point start = clock::now();
+			for (uint64_t i = 0; i < iterations; i++) entry.body(input, output, size);
+			double seconds = std::chrono::duration<double>(clock::now() - start).count();
+			uint64_t allocations = allocation_counter().load(std::memory_order_relaxed) - allocations_before;
+
+			if (seconds >= min_time || iterations >= (uint64_t(1) << 40)) return Result{ entry.name, size, iterations, seconds, allocations };
+
+			/* Aim straight for the minimum time once a measurement is long enough to trust */
+			if (seconds > min_time / 100) iterations = static_cast<uint64_t>(iterations * 1.4 * min_time / seconds) + 1;
+			else iterations *= 10;
+		}
+	}
+
+	/* Wraps a cipher taking and returning std::string, so its copies show up in the figures */
+	template <typename string_function>
+	static Body string_case(string_function function) {
+		return [function](const uint8_t* input, uint8_t* output, std::size_t size) {
+			std::string result = function(std::string(reinterpret_cast<const char*>(input), size));
+			if (!result.empty()) output[0] = static_cast<uint8_t>(result[0]);
+		};
+	}
+
+	static std::string random_text(std::size_t size, bool letters_only) {
+		static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+		static const char punctuation[] = " .,'\n";
+
+		std::mt19937 generator(static_cast<uint32_t>(size));
+		std::string text(size, ' ');
+		for (char& character : text) {
+			uint32_t roll = generator();
+			character = (letters_only || roll % 6 != 0) ? letters[(roll >> 8) % 52] : punctuation[(roll >> 8) % 5];
+		}
+
+		return text;
+	}
+};
@@ -2,4 +2,18 @@
 #include "headers/caesar.h"
 #include "headers/atbash.h"
 #include "headers/polybius.h"
-#include "headers/xor.h"
\ No newline at end of file
+#include "headers/xor.h"
+#include "headers/parallel.h"
+#include "headers/cipher_cache.h"
+#include "headers/alphabet.h"
+#include "headers/language_model.h"
+#include "headers/frequency_analysis.h"
+#include "headers/vigenere_analysis.h"
+#include "headers/xor_analysis.h"
+#include "headers/span.h"
+#include "headers/batch.h"
+#include "headers/utf8.h"
+#include "headers/pipeline.h"
+#include "headers/metrics.h"
+#include "headers/polybius_analysis.h"
+#include "headers/arena.h"
\ No newline at end of file
@@ -0,0 +1,660 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "ciphers.h"
+#include "benchmark.h"
+#include "verify.h"
+#include "headers/async_file.h"
+#include "headers/mapped_file.h"
+
+/* Command line front end, every cipher in ciphers.h as a subcommand working on files or pipes:
+
+	Ciphers <cipher> <encode|decode> [options]
+	Ciphers chain <encode|decode> --stages caesar:3,vigenere:key,xor:key,polybius:key [options]
+	Ciphers crack <caesar|vigenere|xor|polybius> [options]
+	Ciphers benchmark [benchmark options]
+	Ciphers verify [verify options]
+
+Regular files are memory mapped and enciphered across the thread pool in one call, in place with
+--in-place or straight from the input mapping into the output mapping. Pipes and terminals are
+streamed through a fixed buffer instead, and a mapped input written to a pipe is read sequentially.
+With --async files are read and written in overlapping aligned buffers instead, see AsyncFile. */
+class CommandLine {
+public:
+	class UsageException : public std::runtime_error {
+	public: explicit UsageException(const std::string& message) : std::runtime_error(message) {}
+	};
+
+	/* Runs over consecutive pieces of the input in order, key positions carry over between calls.
+	Returns the number of bytes written, at most the size of the piece. */
+	using Transform = std::function<std::size_t(const uint8_t* input, uint8_t* output, std::size_t size)>;
+
+	struct Arguments {
+		std::string cipher;
+		std::string action;
+		std::string input = "-";
+		std::string output = "-";
+		bool in_place = false;
+		bool async = false;
+		bool direct = false;
+		std::size_t threads = 0;
+		std::string key;
+		bool key_given = false;
+		uint32_t shift = 3;
+		int8_t sacrifice = '\0';
+		bool ignore_case = false;
+		std::size_t buffer_size = std::size_t(16) << 20;
+		std::string stages;
+		std::string corpus;
+		std::string metrics;
+	};
+
+	static int run(int argc, char** argv) {
+		if (argc > 1 && std::string(argv[1]) == "benchmark") return run_benchmark(argc, argv);
+		if (argc > 1 && std::string(argv[1]) == "verify") return run_verify(argc, argv);
+
+		try {
+			if (argc < 2 || std::string(argv[1]) == "help" || std::string(argv[1]) == "--help") {
+				print_usage(std::cout);
+				return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+			}
+
+			Arguments arguments = parse(argc, argv);
+			std::unique_ptr<ThreadPool> pool(arguments.threads == 0 ? nullptr : new ThreadPool(arguments.threads));
+
+			ParallelOptions parallel;
+			parallel.pool = pool.get();
+
+			int status = EXIT_SUCCESS;
+			if (arguments.cipher == "crack") status = crack(arguments, parallel);
+			else execute(arguments, transform(arguments, parallel));
+
+			if (!arguments.metrics.empty()) write_metrics(arguments.metrics);
+			return status;
+		} catch (const UsageException& error) {
+			std::cerr << error.what() << std::endl << std::endl;
+			print_usage(std::cerr);
+		} catch (const std::exception& error) {
+			std::cerr << "Error: " << error.what() << std::endl;
+		}
+
+		return EXIT_FAILURE;
+	}
+
+	static void print_usage(std::ostream& stream) {
+		stream <<
+			"Usage: Ciphers <cipher> <encode|decode> [options]\n"
+			"       Ciphers chain <encode|decode> --stages stage,stage,... [options]\n"
+			"       Ciphers crack <caesar|vigenere|xor|polybius> [options], polybius needs --corpus file\n"
+			"       Ciphers benchmark [--json file] [--filter text] [--min-size bytes] [--max-size bytes] [--min-time seconds]\n"
+			"       Ciphers verify [--cases n] [--seed n] [--max-size bytes] [--filter text]\n"
+			"\n"
+			"Ciphers:\n"
+			"  caesar     --shift n (default 3)\n"
+			"  rot13\n"
+			"  atbash\n"
+			"  vigenere   --key text [--ignore-case]\n"
+			"  xor        --key text | --key-hex digits\n"
+			"  polybius   --key text [--sacrifice letter], ciphertext is one packed byte per letter\n"
+			"  chain      --stages, ciphers applied one after another in a single pass, each one of\n"
+			"             caesar:n, rot13, atbash, vigenere:key, xor:key, xor-hex:digits, polybius:key,\n"
+			"             decoding runs them backwards\n"
+			"\n"
+			"Options:\n"
+			"  -i, --input file    input file, - for stdin (default)\n"
+			"  -o, --output file   output file, - for stdout (default)\n"
+			"  --in-place          overwrite the input file\n"
+			"  --async             read, encipher and write files in overlapping buffers instead of mapping them\n"
+			"  --direct            --async with the page cache bypassed where the file system allows it\n"
+			"  --threads n         worker threads, all cores by default\n"
+			"  --buffer-size bytes stream buffer for pipes (default 16 MiB)\n"
+			"  --corpus file       sample text in the language of the plaintext, for crack polybius\n"
+			"  --metrics file      write per cipher metrics when done, JSON for .json files and\n"
+			"                      Prometheus text otherwise, needs a CIPHERS_ENABLE_METRICS build\n";
+	}
+
+private:
+	static Arguments parse(int argc, char** argv) {
+		Arguments arguments;
+		arguments.cipher = argv[1];
+
+		int i = 2;
+		if (i < argc && argv[i][0] != '-') arguments.action = argv[i++];
+
+		for (; i < argc; i++) {
+			std::string argument = argv[i];
+			if (argument == "--in-place") {
+				arguments.in_place = true;
+				continue;
+			}
+			if (argument == "--async" || argument == "--direct") {
+				arguments.async = true;
+				arguments.direct = arguments.direct || argument == "--direct";
+				continue;
+			}
+			if (argument == "--ignore-case") {
+				arguments.ignore_case = true;
+				continue;
+			}
+
+			if (i + 1 >= argc) throw UsageException("Missing value for " + argument + ".");
+			std::string value = argv[++i];
+
+			if (argument == "-i" || argument == "--input") arguments.input = value;
+			else if (argument == "-o" || argument == "--output") arguments.output = value;
+			else if (argument == "--threads") arguments.threads = number(argument, value);
+			else if (argument == "--buffer-size") arguments.buffer_size = number(argument, value);
+			else if (argument == "--stages") arguments.stages = value;
+			else if (argument == "--corpus") arguments.corpus = value;
+			else if (argument == "--metrics") {
+				if (!Metrics::enabled()) throw UsageException("--metrics needs a build with CIPHERS_ENABLE_METRICS defined.");
+				arguments.metrics = value;
+			}
+			else if (argument == "--shift") arguments.shift = static_cast<uint32_t>(number(argument, value) % 26);
+			else if (argument == "--key") {
+				arguments.key = value;
+				arguments.key_given = true;
+			} else if (argument == "--key-hex") {
+				arguments.key = from_hex(value);
+				arguments.key_given = true;
+			} else if (argument == "--sacrifice") {
+				if (value.size() != 1) throw UsageException("The sacrifice has to be a single letter.");
+				arguments.sacrifice = static_cast<int8_t>(value[0]);
+			} else throw UsageException("Unknown option: " + argument);
+		}
+
+		if (arguments.in_place && (arguments.input == "-" || arguments.output != "-")) throw UsageException("--in-place needs an input file and no output file.");
+		if (arguments.buffer_size == 0) throw UsageException("The buffer size has to be at least one byte.");
+
+		/* Writing a file onto itself through two mappings would truncate it before it is read. The paths
+		are compared by the file they lead to, so d/./f.txt, links and d/f.txt all count as one. */
+		if (arguments.input != "-" && arguments.output != "-" && (arguments.input == arguments.output || MappedFile::same_file(arguments.input, arguments.output))) {
+			arguments.in_place = true;
+			arguments.output = "-";
+		}
+
+		return arguments;
+	}
+
+	static Transform transform(const Arguments& arguments, const ParallelOptions& parallel) {
+		const std::string& cipher = arguments.cipher;
+		bool decode = arguments.action == "decode";
+		if (arguments.action != "encode" && !decode) throw UsageException("Expected encode or decode after " + cipher + ".");
+
+		if (cipher == "caesar" || cipher == "rot13") {
+			uint32_t shift = cipher == "rot13" ? 13 : arguments.shift;
+			return [shift, decode, parallel](const uint8_t* input, uint8_t* output, std::size_t size) {
+				Parallel::caesar_shift(input, output, size, shift, decode, parallel);
+				return size;
+			};
+		}
+
+		if (cipher == "chain") {
+			std::shared_ptr<const Pipeline> pipeline = std::make_shared<Pipeline>(decode ? chain(arguments).inverse() : chain(arguments));
+			std::shared_ptr<Pipeline::State> state = std::make_shared<Pipeline::State>(pipeline->start());
+			return [pipeline, state](const uint8_t* input, uint8_t* output, std::size_t size) { return pipeline->run(input, output, size, *state); };
+		}
+
+		if (cipher == "atbash") {
+			return [parallel](const uint8_t* input, uint8_t* output, std::size_t size) {
+				Parallel::for_each_chunk(size, parallel, [&](std::size_t begin, std::size_t end) { Atbash::atbash_apply(input + begin, output + begin, end - begin); });
+				return size;
+			};
+		}
+
+		if (!arguments.key_given || arguments.key.empty()) throw UsageException(cipher + " needs a key.");
+		std::shared_ptr<const std::string> key = std::make_shared<std::string>(arguments.key);
+		const uint8_t* key_bytes = reinterpret_cast<const uint8_t*>(key->data());
+
+		if (cipher == "vigenere") {
+			std::shared_ptr<std::size_t> position = std::make_shared<std::size_t>(0);
+			bool preserve_case = !arguments.ignore_case;
+			return [key, key_bytes, position, decode, preserve_case, parallel](const uint8_t* input, uint8_t* output, std::size_t size) {
+				*position = Parallel::vigenere_lookup(input, output, size, key_bytes, key->size(), decode, preserve_case, *position, parallel);
+				return size;
+			};
+		}
+
+		if (cipher == "xor") {
+			std::shared_ptr<std::size_t> offset = std::make_shared<std::size_t>(0);
+			return [key, key_bytes, offset, parallel](const uint8_t* input, uint8_t* output, std::size_t size) {
+				*offset = Parallel::apply_xor(input, output, size, key_bytes, key->size(), *offset, parallel);
+				return size;
+			};
+		}
+
+		if (cipher == "polybius") {
+			std::shared_ptr<const Polybius::Square> square = std::make_shared<Polybius::Square>(Polybius::keyed_matrix(arguments.key, arguments.sacrifice));
+			if (decode) return [square](const uint8_t* input, uint8_t* output, std::size_t size) { return Polybius::decode_packed(*square, input, size, output); };
+			return [square](const uint8_t* input, uint8_t* output, std::size_t size) { return Polybius::encode_packed(*square, input, size, output); };
+		}
+
+		throw UsageException("Unknown cipher: " + cipher);
+	}
+
+	static void write_metrics(const std::string& path) {
+		std::ofstream stream(path, std::ios::binary);
+		if (!stream) throw std::runtime_error("Could not open " + path + " for writing.");
+
+		Metrics::Snapshot snapshot = Metrics::snapshot();
+		bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+		if (json) snapshot.write_json(stream);
+		else snapshot.write_prometheus(stream);
+	}
+
+	/* Builds the pipeline described by --stages, stages are separated by commas and take their key after a colon */
+	static Pipeline chain(const Arguments& arguments) {
+		if (arguments.stages.empty()) throw UsageException("chain needs --stages.");
+		Pipeline pipeline;
+
+		std::size_t begin = 0;
+		while (begin <= arguments.stages.size()) {
+			std::size_t end = arguments.stages.find(',', begin);
+			if (end == std::string::npos) end = arguments.stages.size();
+
+			std::string stage = arguments.stages.substr(begin, end - begin);
+			std::size_t colon = stage.find(':');
+			std::string name = stage.substr(0, colon);
+			std::string value = colon == std::string::npos ? std::string() : stage.substr(colon + 1);
+			bool keyed = name == "caesar" || name == "vigenere" || name == "xor" || name == "xor-hex" || name == "polybius";
+			if (keyed && value.empty()) throw UsageException("Stage " + name + " needs a value after a colon.");
+
+			if (name == "caesar") pipeline.caesar(static_cast<uint32_t>(number("caesar", value) % 26));
+			else if (name == "rot13") pipeline.rot13();
+			else if (name == "atbash") pipeline.atbash();
+			else if (name == "vigenere") pipeline.vigenere(value, false, !arguments.ignore_case);
+			else if (name == "xor") pipeline.repeating_xor(value);
+			else if (name == "xor-hex") pipeline.repeating_xor(from_hex(value));
+			else if (name == "polybius") pipeline.polybius(Polybius::Square(Polybius::keyed_matrix(value, arguments.sacrifice)));
+			else throw UsageException("Unknown stage: " + stage);
+
+			begin = end + 1;
+		}
+
+		return pipeline;
+	}
+
+	/* Picks the cheapest way through: one call over mappings for files, buffered passes otherwise */
+	static void execute(const Arguments& arguments, const Transform& apply) {
+		if (arguments.async) {
+			const std::string& output = arguments.in_place ? arguments.input : arguments.output;
+			if (!MappedFile::mappable(arguments.input) || output == "-") throw UsageException("--async needs an input file and either an output file or --in-place.");
+
+			AsyncFile::Options options;
+			options.buffer_size = arguments.buffer_size;
+			options.direct = arguments.direct;
+			AsyncFile::transform(arguments.input, output, apply, options);
+			return;
+		}
+
+		if (arguments.in_place) {
+			if (!MappedFile::mappable(arguments.input)) throw UsageException("--in-place needs a regular file.");
+
+			MappedFile file(arguments.input, MappedFile::Access::ReadWrite);
+			file.advise_sequential();
+			file.close(file.size() == 0 ? 0 : apply(file.data(), file.data(), file.size()));
+			return;
+		}
+
+		bool mapped_input = arguments.input != "-" && MappedFile::mappable(arguments.input);
+		bool mapped_output = arguments.output != "-" && (!std::ifstream(arguments.output) || MappedFile::mappable(arguments.output));
+
+		if (mapped_input && mapped_output) {
+			MappedFile input(arguments.input, MappedFile::Access::Read);
+			MappedFile output(arguments.output, MappedFile::Access::Create, input.size());
+			input.advise_sequential();
+			output.close(input.size() == 0 ? 0 : apply(input.data(), output.data(), input.size()));
+			return;
+		}
+
+		std::FILE* output = open_stream(arguments.output, false);
+		std::vector<uint8_t> buffer(arguments.buffer_size);
+
+		if (mapped_input) {
+			MappedFile input(arguments.input, MappedFile::Access::Read);
+			input.advise_sequential();
+
+			for (std::size_t offset = 0; offset < input.size(); offset += buffer.size()) {
+				std::size_t size = std::min(buffer.size(), input.size() - offset);
+				write(output, buffer.data(), apply(input.data() + offset, buffer.data(), size));
+			}
+		} else {
+			std::FILE* input = open_stream(arguments.input, true);
+			bool failed = !stream(input, output, buffer, apply);
+			if (input != stdin) std::fclose(input);
+			if (failed) throw std::runtime_error("Could not read " + arguments.input + ".");
+		}
+
+		if (std::fflush(output) != 0) throw std::runtime_error("Could not write " + arguments.output + ".");
+		if (output != stdout) std::fclose(output);
+	}
+
+	/* Reads input to its end a buffer at a time, enciphering each piece in the buffer it was read into
+	before writing it out. Returns false when reading failed. */
+	static bool stream(std::FILE* input, std::FILE* output, std::vector<uint8_t>& buffer, const Transform& apply) {
+		while (true) {
+			std::size_t size = std::fread(buffer.data(), 1, buffer.size(), input);
+			if (size == 0) break;
+			write(output, buffer.data(), apply(buffer.data(), buffer.data(), size));
+		}
+
+		return std::ferror(input) == 0;
+	}
+
+	/* Reads the whole input, prints what was recovered and writes the plaintext when an output is given */
+	static int crack(const Arguments& arguments, const ParallelOptions& parallel) {
+		std::string data = read_all(arguments.input);
+		std::string plaintext;
+
+		if (arguments.action == "caesar") {
+			/* Without letters every shift scores the same and the first one would be reported */
+			if (std::none_of(data.begin(), data.end(), [](char byte) { return std::isalpha(static_cast<uint8_t>(byte)) != 0; })) throw std::runtime_error("Not enough letters to recover a key.");
+
+			std::vector<FrequencyAnalysis::Candidate> candidates = FrequencyAnalysis::crack(data, LanguageModel::english(), parallel);
+			const FrequencyAnalysis::Candidate& best = candidates.front();
+			std::cout << (best.cipher == FrequencyAnalysis::Cipher::Atbash ? "atbash" : "caesar --shift " + std::to_string(best.shift)) << " (confidence " << best.confidence << ")" << std::endl;
+			if (arguments.output != "-") plaintext = FrequencyAnalysis::decode(best, std::move(data));
+		} else if (arguments.action == "vigenere") {
+			VigenereAnalysis::Options options;
+			options.pool = parallel.pool;
+			VigenereAnalysis::Report report = VigenereAnalysis::analyze(data, LanguageModel::english(), options);
+			if (report.keys.empty()) throw std::runtime_error("Not enough letters to recover a key.");
+
+			std::cout << "vigenere --key " << report.keys.front().key << " (period " << report.periods.front().period << ")" << std::endl;
+			if (arguments.output != "-") plaintext = VigenereAnalysis::decode(report, std::move(data));
+		} else if (arguments.action == "xor") {
+			XorAnalysis::Options options;
+			options.parallel = parallel;
+			XorAnalysis::Report report = XorAnalysis::analyze(data, ByteModel::text(), options);
+			if (report.key.empty()) throw std::runtime_error("Not enough data to recover a key.");
+
+			std::cout << "xor --key-hex " << to_hex(report.key) << std::endl;
+			if (arguments.output != "-") plaintext = XorAnalysis::decode(report, std::move(data));
+		} else if (arguments.action == "polybius") {
+			if (arguments.corpus.empty()) throw UsageException("crack polybius needs a --corpus to learn the language from.");
+
+			PolybiusAnalysis::Options options;
+			options.pool = parallel.pool;
+			PolybiusAnalysis::Report report = PolybiusAnalysis::analyze_packed(data, NgramModel::from_text("corpus", read_all(arguments.corpus)), arguments.sacrifice, options);
+
+			std::cout << "polybius";
+			if (report.keyed) std::cout << " --key " << (report.key.empty() ? "\"\"" : report.key);
+			if (arguments.sacrifice != '\0') std::cout << " --sacrifice " << static_cast<char>(arguments.sacrifice);
+			std::cout << " (" << report.cells_observed << " cells seen, score " << report.score << ")" << std::endl;
+			plaintext = std::move(report.plaintext);
+		} else {
+			throw UsageException("Expected caesar, vigenere, xor or polybius after crack.");
+		}
+
+		if (arguments.output != "-") {
+			std::FILE* output = open_stream(arguments.output, false);
+			write(output, reinterpret_cast<const uint8_t*>(plaintext.data()), plaintext.size());
+			if (std::fclose(output) != 0) throw std::runtime_error("Could not write " + arguments.output + ".");
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	/* Ciphers benchmark [--json file] [--filter text] [--min-size bytes] [--max-size bytes] [--min-time seconds]
+	Prints a table while running, and writes the results as JSON when a file is given ("-" is stdout). */
+	static int run_benchmark(int argc, char** argv) {
+		Benchmark::Options options;
+		std::string json_path;
+
+		try {
+			for (int i = 2; i < argc; i++) {
+				std::string argument = argv[i];
+				std::string value = i + 1 < argc ? argv[i + 1] : "";
+
+				if (argument == "--json") json_path = value;
+				else if (argument == "--filter") options.filter = value;
+				else if (argument == "--min-size") options.min_size = number(argument, value);
+				else if (argument == "--max-size") options.max_size = number(argument, value);
+				else if (argument == "--min-time") options.min_time = decimal(argument, value);
+				else throw UsageException("Unknown benchmark option: " + argument);
+
+				i++;
+			}
+		} catch (const UsageException& error) {
+			std::cerr << error.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		if (options.min_size == 0 || options.min_size > options.max_size) {
+			std::cerr << "The minimum size has to be between 1 and the maximum size." << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		std::ostream& progress = json_path == "-" ? std::cerr : std::cout;
+		std::vector<Benchmark::Result> results = Benchmark::run(options, &progress);
+
+		if (json_path == "-") Benchmark::write_json(std::cout, results);
+		else if (!json_path.empty()) {
+			std::ofstream json_file(json_path);
+			Benchmark::write_json(json_file, results);
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	/* Ciphers verify [--cases n] [--seed n] [--max-size bytes] [--filter text]
+	Runs every differential check, see Verify, and fails when any of them does. */
+	static int run_verify(int argc, char** argv) {
+		Verify::Options options;
+
+		try {
+			for (int i = 2; i < argc; i++) {
+				std::string argument = argv[i];
+				std::string value = i + 1 < argc ? argv[i + 1] : "";
+
+				if (argument == "--cases") options.cases = number(argument, value);
+				else if (argument == "--seed") options.seed = number(argument, value);
+				else if (argument == "--max-size") options.max_size = number(argument, value);
+				else if (argument == "--filter") options.filter = value;
+				else throw UsageException("Unknown verify option: " + argument);
+
+				i++;
+			}
+		} catch (const UsageException& error) {
+			std::cerr << error.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		std::vector<Verify::Result> results = Verify::run(options, std::cout);
+		if (std::string("cli").find(options.filter) != std::string::npos) results.push_back(verify_modes(options, std::cout));
+		for (const Verify::Result& result : results) if (result.failures != 0) return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+
+	/* Every cipher encoded and decoded from the command line each way execute can take: between mapped
+	files, streamed the way stdin is, --in-place and --async, the async decode in place. Buffers are
+	small so keys carry over between pieces. Every mode has to write the ciphertext the mapped files
+	get and give back the plaintext, which Polybius folds to its uppercase letters. */
+	static Verify::Result verify_modes(const Verify::Options& options, std::ostream& log) {
+		struct Cipher {
+			std::string name;
+			std::vector<std::string> options;
+			bool letters_only;
+		};
+
+		const std::vector<Cipher> ciphers = {
+			{ "caesar", { "--shift", "7" }, false },
+			{ "rot13", {}, false },
+			{ "atbash", {}, false },
+			{ "vigenere", { "--key", "lemon" }, false },
+			{ "xor", { "--key", "secret" }, false },
+			{ "polybius", { "--key", "keyword" }, true },
+			{ "chain", { "--stages", "polybius:keyword,vigenere:lemon,xor:abc" }, true },
+		};
+		const char* const modes[] = { "mapped", "pipe", "in-place", "async" };
+
+		/* Text across several async buffers, with the odd byte that is no character at all */
+		static const char characters[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789 .,!?\n";
+		std::mt19937_64 generator(options.seed);
+		std::vector<uint8_t> plaintext(3 * AsyncFile::alignment + 123);
+		for (uint8_t& byte : plaintext) byte = generator() % 97 == 0 ? static_cast<uint8_t>(generator()) : static_cast<uint8_t>(characters[generator() % (sizeof(characters) - 1)]);
+
+		Verify::Result result{ "cli", 0, 0, "" };
+		const Verify::TemporaryFile plain("plain"), encoded("encoded"), decoded("decoded");
+		Verify::write_file(plain.path, plaintext);
+
+		for (const Cipher& cipher : ciphers) {
+			std::vector<uint8_t> expected, ciphertext;
+			for (uint8_t byte : plaintext) if (!cipher.letters_only || std::isalpha(byte)) expected.push_back(static_cast<uint8_t>(cipher.letters_only ? std::toupper(byte) : byte));
+
+			for (const std::string mode : modes) {
+				result.cases++;
+
+				try {
+					run_mode(mode, cipher.name, "encode", cipher.options, plain.path, encoded.path);
+					if (mode == "mapped") ciphertext = Verify::read_file(encoded.path);
+					else Verify::compare((cipher.name + " encode " + mode).c_str(), ciphertext, Verify::read_file(encoded.path));
+
+					run_mode(mode, cipher.name, "decode", cipher.options, encoded.path, decoded.path);
+					Verify::compare((cipher.name + " decode " + mode).c_str(), expected, Verify::read_file(decoded.path));
+				} catch (const std::exception& error) {
+					if (result.failures++ == 0) result.first_failure = cipher.name + " " + mode + ": " + error.what();
+				}
+			}
+		}
+
+		log << (result.failures == 0 ? "ok      " : "FAILED  ") << result.name << " (" << result.cases << " cases)";
+		if (result.failures != 0) log << ", " << result.failures << " failed, first " << result.first_failure;
+		log << std::endl;
+		return result;
+	}
+
+	/* Parses and runs one encode or decode of input into output. The in place modes copy input over
+	output first, pipe streams between the two files the way stdin is streamed to stdout. */
+	static void run_mode(const std::string& mode, const std::string& cipher, const std::string& action, const std::vector<std::string>& options, const std::string& input, const std::string& output) {
+		std::vector<std::string> words = { "Ciphers", cipher, action, "--buffer-size", "1000" };
+		words.insert(words.end(), options.begin(), options.end());
+
+		bool in_place = mode == "in-place" || (mode == "async" && action == "decode");
+		if (in_place) Verify::write_file(output, Verify::read_file(input));
+
+		if (in_place) words.insert(words.end(), { "-i", output, "--in-place" });
+		else if (mode != "pipe") words.insert(words.end(), { "-i", input, "-o", output });
+		if (mode == "async") words.push_back("--async");
+
+		std::vector<char*> argv;
+		for (std::string& word : words) argv.push_back(&word[0]);
+		Arguments arguments = parse(static_cast<int>(argv.size()), argv.data());
+		Transform apply = transform(arguments, ParallelOptions());
+
+		if (mode != "pipe") {
+			execute(arguments, apply);
+			return;
+		}
+
+		std::unique_ptr<std::FILE, int(*)(std::FILE*)> from(open_stream(input, true), std::fclose);
+		std::unique_ptr<std::FILE, int(*)(std::FILE*)> to(open_stream(output, false), std::fclose);
+		std::vector<uint8_t> buffer(arguments.buffer_size);
+		if (!stream(from.get(), to.get(), buffer, apply)) throw std::runtime_error("Could not read " + input + ".");
+		if (std::fclose(to.release()) != 0) throw std::runtime_error("Could not write " + output + ".");
+	}
+
+	/* Standard streams are switched to binary, Windows would translate line endings otherwise */
+	static std::FILE* open_stream(const std::string& path, bool reading) {
+		if (path == "-") {
+			std::FILE* stream = reading ? stdin : stdout;
+#if defined(_WIN32)
+			_setmode(_fileno(stream), _O_BINARY);
+#endif
+			return stream;
+		}
+
+		std::FILE* stream = std::fopen(path.c_str(), reading ? "rb" : "wb");
+		if (stream == nullptr) throw std::runtime_error("Could not open " + path + ".");
+		return stream;
+	}
+
+	static void write(std::FILE* stream, const uint8_t* data, std::size_t size) {
+		if (size != 0 && std::fwrite(data, 1, size, stream) != size) throw std::runtime_error("Could not write the output.");
+	}
+
+	static std::string read_all(const std::string& path) {
+		if (path != "-" && MappedFile::mappable(path)) {
+			MappedFile file(path, MappedFile::Access::Read);
+			file.advise_sequential();
+			return std::string(reinterpret_cast<const char*>(file.data()), file.size());
+		}
+
+		std::FILE* input = open_stream(path, true);
+		std::string data;
+		std::vector<char> buffer(std::size_t(1) << 20);
+
+		std::size_t received;
+		while ((received = std::fread(buffer.data(), 1, buffer.size(), input)) != 0) data.append(buffer.data(), received);
+
+		if (input != stdin) std::fclose(input);
+		return data;
+	}
+
+	static std::size_t number(const std::string& option, const std::string& value) {
+		if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos) throw UsageException(option + " expects a number.");
+
+		errno = 0;
+		unsigned long long parsed = std::strtoull(value.c_str(), nullptr, 10);
+		if (errno == ERANGE || parsed > std::numeric_limits<std::size_t>::max()) throw UsageException(option + " is too large.");
+		return static_cast<std::size_t>(parsed);
+	}
+
+	/* Non negative decimal number, like 0.5 */
+	static double decimal(const std::string& option, const std::string& value) {
+		char* end = nullptr;
+		double parsed = value.empty() ? -1 : std::strtod(value.c_str(), &end);
+		if (parsed < 0 || !std::isfinite(parsed) || end == nullptr || *end != '\0') throw UsageException(option + " expects a number.");
+		return parsed;
+	}
+
+	static std::string from_hex(const std::string& digits) {
+		if (digits.size() % 2 != 0) throw UsageException("--key-hex expects an even number of hex digits.");
+
+		std::string bytes(digits.size() / 2, '\0');
+		for (std::size_t i = 0; i < bytes.size(); i++) {
+			int high = hex_value(digits[2 * i]), low = hex_value(digits[2 * i + 1]);
+			if (high < 0 || low < 0) throw UsageException("--key-hex expects hex digits.");
+			bytes[i] = static_cast<char>((high << 4) | low);
+		}
+
+		return bytes;
+	}
+
+	static std::string to_hex(const std::vector<uint8_t>& bytes) {
+		static const char digits[] = "0123456789abcdef";
+		std::string text;
+		for (uint8_t byte : bytes) {
+			text.push_back(digits[byte >> 4]);
+			text.push_back(digits[byte & 0x0F]);
+		}
+		return text;
+	}
+
+	static int hex_value(char digit) {
+		if (digit >= '0' && digit <= '9') return digit - '0';
+		if (digit >= 'a' && digit <= 'f') return digit - 'a' + 10;
+		if (digit >= 'A' && digit <= 'F') return digit - 'A' + 10;
+		return -1;
+	}
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Every cipher looks symbols up the same way: an alphabet maps a symbol onto its index and back,
+and optionally pairs every symbol with an uppercase variant that shares its index. Ciphers only
+ever work on indices and ask the alphabet to put the case back, so case handling lives here.
+
+Two alphabet types share that interface. ByteAlphabet is a literal type built at compile time with
+a 256-entry inverse table, which lets fixed alphabets such as latin compile into branch-free table
+kernels. Alphabet is built at runtime from arbitrary 32 bit code points (Cyrillic, alphanumerics...)
+and looks them up through a direct table or an open addressing hash table for sparse symbols.
+
+	int32_t locate(uint32_t symbol, bool& uppercase) const   index of the symbol or -1
+	int32_t index_of(uint32_t symbol) const                  same, without the case
+	uint32_t symbol_at(std::size_t index, bool uppercase) const
+	std::size_t size() const
+*/
+
+template <std::size_t alphabet_size>
+class ByteAlphabet {
+public:
+	static_assert(alphabet_size > 0 && alphabet_size <= 128, "A byte alphabet holds between 1 and 128 symbols.");
+
+	/* Both strings hold alphabet_size symbols, uppercase may be null for alphabets without case.
+	Symbols that are the same in both cases (digits) count as lowercase. */
+	constexpr ByteAlphabet(const char* lowercase, const char* uppercase = nullptr) : indices{}, uppercase_flags{}, lower_symbols{}, upper_symbols{}, has_case(uppercase != nullptr) {
+		for (std::size_t i = 0; i < 256; i++) indices[i] = -1;
+
+		for (std::size_t i = alphabet_size; i-- > 0;) {
+			lower_symbols[i] = static_cast<uint8_t>(lowercase[i]);
+			upper_symbols[i] = uppercase != nullptr ? static_cast<uint8_t>(uppercase[i]) : lower_symbols[i];
+
+			indices[upper_symbols[i]] = static_cast<int8_t>(i);
+			uppercase_flags[upper_symbols[i]] = 1;
+		}
+
+		for (std::size_t i = alphabet_size; i-- > 0;) {
+			indices[lower_symbols[i]] = static_cast<int8_t>(i);
+			uppercase_flags[lower_symbols[i]] = 0;
+		}
+	}
+
+	static constexpr std::size_t size() { return alphabet_size; }
+
+	constexpr int32_t index_of(uint32_t symbol) const {
+		return symbol < 256 ? indices[symbol] : -1;
+	}
+
+	constexpr int32_t locate(uint32_t symbol, bool& uppercase) const {
+		if (symbol >= 256) return -1;
+		uppercase = uppercase_flags[symbol] != 0;
+		return indices[symbol];
+	}
+
+	constexpr uint32_t symbol_at(std::size_t index, bool uppercase = false) const {
+		return uppercase ? upper_symbols[index] : lower_symbols[index];
+	}
+
+	constexpr bool cased() const { return has_case; }
+
+	/* Raw inverse table for kernels that index it directly, -1 marks bytes outside the alphabet */
+	constexpr const int8_t* index_table() const { return indices; }
+	constexpr const uint8_t* uppercase_table() const { return uppercase_flags; }
+
+private:
+	int8_t indices[256];
+	uint8_t uppercase_flags[256];
+	uint8_t lower_symbols[alphabet_size];
+	uint8_t upper_symbols[alphabet_size];
+	bool has_case;
+};
+
+/* Open addressing hash table from 32 bit symbols to small integer values, with linear probing over
+one flat array. Used wherever a symbol range is too sparse for a direct table. */
+class SymbolMap {
+public:
+	static const uint32_t empty_key = 0xFFFFFFFFu;
+
+	explicit SymbolMap(std::size_t expected = 0) { reserve(expected); }
+
+	void reserve(std::size_t expected) {
+		std::size_t capacity = 16;
+		while (capacity < expected * 2) capacity <<= 1;
+		if (capacity > slots.size()) rehash(capacity);
+	}
+
+	/* Inserts or overwrites the value of a symbol */
+	void set(uint32_t symbol, int32_t value) {
+		/* The all-ones symbol marks empty slots, so it lives outside the table */
+		if (symbol == empty_key) {
+			if (!has_empty_key) count++;
+			has_empty_key = true;
+			empty_key_value = value;
+			return;
+		}
+
+		if ((count + 1) * 2 > slots.size()) rehash(slots.size() * 2);
+
+		std::size_t position = probe(symbol);
+		if (slots[position].symbol == empty_key) count++;
+		slots[position].symbol = symbol;
+		slots[position].value = value;
+	}
+
+	/* Value stored for the symbol, or missing if there is none */
+	int32_t get(uint32_t symbol, int32_t missing = -1) const {
+		if (symbol == empty_key) return has_empty_key ? empty_key_value : missing;
+		if (count == 0) return missing;
+		const Slot& slot = slots[probe(symbol)];
+		return slot.symbol == symbol ? slot.value : missing;
+	}
+
+	std::size_t size() const { return count; }
+
+private:
+	struct Slot {
+		uint32_t symbol = empty_key;
+		int32_t value = 0;
+	};
+
+	static std::size_t hash(uint32_t symbol) {
+		/* Fibonacci hashing spreads consecutive code points over the whole table */
+		return static_cast<std::size_t>((static_cast<uint64_t>(symbol) * 0x9E3779B97F4A7C15ull) >> 32);
+	}
+
+	std::size_t probe(uint32_t symbol) const {
+		std::size_t mask = slots.size() - 1;
+		std::size_t position = hash(symbol) & mask;
+		while (slots[position].symbol != empty_key && slots[position].symbol != symbol) position = (position + 1) & mask;
+		return position;
+	}
+
+	void rehash(std::size_t capacity) {
+		std::vector<Slot> previous;
+		previous.swap(slots);
+		slots.assign(capacity, Slot());
+		count = has_empty_key ? 1 : 0;
+
+		for (const Slot& slot : previous)
+			if (slot.symbol != empty_key) set(slot.symbol, slot.value);
+	}
+
+	std::vector<Slot> slots;
+	std::size_t count = 0;
+	bool has_empty_key = false;
+	int32_t empty_key_value = 0;
+};
+
+/* Alphabet of arbitrary code points built at runtime. Duplicate symbols keep their first index. */
+class Alphabet {
+public:
+	class EmptyAlphabetException : public std::runtime_error {
+	public: EmptyAlphabetException() : std::runtime_error("Alphabet has no symbols.") {}
+	};
+
+	/* Symbols below this go through a direct table, larger ones through the hash table */
+	static const uint32_t dense_limit = 1 << 16;
+
+	explicit Alphabet(const std::vector<uint32_t>& lowercase, const std::vector<uint32_t>& uppercase = std::vector<uint32_t>())
+		: lower_symbols(lowercase), upper_symbols(uppercase.empty() ? lowercase : uppercase) {
+		if (lowercase.empty()) throw EmptyAlphabetException();
+		if (upper_symbols.size() != lower_symbols.size()) throw std::invalid_argument("Uppercase symbols must pair up with the lowercase symbols.");
+
+		uint32_t largest = 0;
+		for (std::size_t i = 0; i < lower_symbols.size(); i++) largest = std::max(largest, std::max(lower_symbols[i], upper_symbols[i]));
+		if (largest < dense_limit) dense.assign(static_cast<std::size_t>(largest) + 1, -1);
+		else sparse.reserve(lower_symbols.size() * 2);
+
+		/* Entries hold (index << 1) | uppercase, lowercase and earlier symbols are stored last so they win */
+		for (std::size_t i = upper_symbols.size(); i-- > 0;) store(upper_symbols[i], static_cast<int32_t>(i << 1) | 1);
+		for (std::size_t i = lower_symbols.size(); i-- > 0;) store(lower_symbols[i], static_cast<int32_t>(i << 1));
+	}
+
+	/* Alphabet over the bytes of a string, without case */
+	static Alphabet from_string(const std::string& symbols) {
+		std::vector<uint32_t> code_points;
+		for (char symbol : symbols) code_points.push_back(static_cast<uint8_t>(symbol));
+		return Alphabet(code_points);
+	}
+
+	/* Runtime copy of a compile time alphabet */
+	template <std::size_t alphabet_size>
+	static Alphabet from(const ByteAlphabet<alphabet_size>& alphabet) {
+		std::vector<uint32_t> lowercase(alphabet_size), uppercase(alphabet_size);
+		for (std::size_t i = 0; i < alphabet_size; i++) {
+			lowercase[i] = alphabet.symbol_at(i, false);
+			uppercase[i] = alphabet.symbol_at(i, true);
+		}
+		return Alphabet(lowercase, uppercase);
+	}
+
+	std::size_t size() const { return lower_symbols.size(); }
+
+	int32_t locate(uint32_t symbol, bool& uppercase) const {
+		int32_t entry = symbol < dense.size() ? dense[symbol] : sparse.get(symbol);
+		if (entry < 0) return -1;
+
+		uppercase = (entry & 1) != 0;
+		return entry >> 1;
+	}
+
+	int32_t index_of(uint32_t symbol) const {
+		bool uppercase;
+		return locate(symbol, uppercase);
+	}
+
+	uint32_t symbol_at(std::size_t index, bool uppercase = false) const {
+		return uppercase ? upper_symbols[index] : lower_symbols[index];
+	}
+
+	bool cased() const { return lower_symbols != upper_symbols; }
+
+private:
+	void store(uint32_t symbol, int32_t entry) {
+		if (symbol < dense.size()) dense[symbol] = entry;
+		else sparse.set(symbol, entry);
+	}
+
+	std::vector<uint32_t> lower_symbols;
+	std::vector<uint32_t> upper_symbols;
+	std::vector<int32_t> dense;
+	SymbolMap sparse;
+};
+
+/* Alphabets used throughout the ciphers. The make_ functions build them in constant expressions,
+the accessors return one shared instance for runtime code. */
+class Alphabets {
+public:
+	using Latin = ByteAlphabet<26>;
+	using LatinAlphanumeric = ByteAlphabet<36>;
+
+	static constexpr Latin make_latin() {
+		return Latin("abcdefghijklmnopqrstuvwxyz", "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+	}
+
+	static constexpr LatinAlphanumeric make_latin_alphanumeric() {
+		return LatinAlphanumeric("abcdefghijklmnopqrstuvwxyz0123456789", "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+	}
+
+	static const Latin& latin() {
+		static constexpr Latin alphabet = make_latin();
+		return alphabet;
+	}
+
+	static const LatinAlphanumeric& latin_alphanumeric() {
+		static constexpr LatinAlphanumeric alphabet = make_latin_alphanumeric();
+		return alphabet;
+	}
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
+
+/* Per thread bump allocator for the scratch space of multi step ciphers. Allocating moves an offset
+through blocks the thread keeps for its whole life and freeing does nothing, a Scope hands back
+everything allocated while it was open in one step. Once a thread's blocks have grown to fit the
+largest call it makes, every call after that takes its scratch without touching the heap. */
+class Arena {
+public:
+	/* Smallest block taken from the heap, requests larger than this get a block of their own */
+	static const std::size_t block_size = 1 << 16;
+
+	/* Marks the arena of the calling thread when opened and rewinds it there when closed. Scopes nest,
+	and nothing allocated inside one may be used after it closes. */
+	class Scope {
+	public:
+		Scope() : arena(Arena::local()), block(arena.current), offset(arena.offset) {}
+		~Scope() { arena.current = block; arena.offset = offset; }
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		Arena& arena;
+		std::size_t block;
+		std::size_t offset;
+	};
+
+	Arena() = default;
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	static Arena& local() {
+		static thread_local Arena arena;
+		return arena;
+	}
+
+	/* Alignment must be a power of two */
+	void* allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) {
+		for (; current < blocks.size(); current++, offset = 0) {
+			Block& block = blocks[current];
+			uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+			std::size_t start = static_cast<std::size_t>(((base + offset + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1)) - base);
+
+			if (start <= block.size && size <= block.size - start) {
+				offset = start + size;
+				return block.data.get() + start;
+			}
+		}
+
+		if (size > std::numeric_limits<std::size_t>::max() - alignment) throw std::bad_alloc();
+		std::size_t capacity = size + alignment > block_size ? size + alignment : static_cast<std::size_t>(block_size);
+		blocks.push_back(Block{ std::unique_ptr<unsigned char[]>(new unsigned char[capacity]), capacity });
+		return allocate(size, alignment);
+	}
+
+	/* Returns the blocks past the one in use to the heap, for threads that once needed far more
+	scratch than they usually do */
+	void release() {
+		if (current + 1 < blocks.size()) blocks.erase(blocks.begin() + current + 1, blocks.end());
+	}
+
+private:
+	struct Block {
+		std::unique_ptr<unsigned char[]> data;
+		std::size_t size;
+	};
+
+	std::vector<Block> blocks;
+	std::size_t current = 0;
+	std::size_t offset = 0;
+};
+
+/* Standard allocator over the arena of the thread that allocates, so scratch containers must stay on
+the thread that filled them and inside the Scope they were filled in */
+template <typename element_type>
+class ArenaAllocator {
+public:
+	using value_type = element_type;
+
+	ArenaAllocator() = default;
+
+	template <typename other_type>
+	ArenaAllocator(const ArenaAllocator<other_type>&) {}
+
+	element_type* allocate(std::size_t count) {
+		if (count > std::numeric_limits<std::size_t>::max() / sizeof(element_type)) throw std::bad_alloc();
+		return static_cast<element_type*>(Arena::local().allocate(count * sizeof(element_type), alignof(element_type)));
+	}
+
+	void deallocate(element_type*, std::size_t) {}
+
+	template <typename other_type>
+	bool operator==(const ArenaAllocator<other_type>&) const { return true; }
+
+	template <typename other_type>
+	bool operator!=(const ArenaAllocator<other_type>&) const { return false; }
+};
+
+template <typename element_type>
+using ScratchVector = std::vector<element_type, ArenaAllocator<element_type>>;
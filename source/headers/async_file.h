@@ -0,0 +1,374 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct AsyncFileOptions {
+	/* Bytes read, enciphered and written at a time, rounded up to a multiple of the alignment */
+	std::size_t buffer_size = std::size_t(4) << 20;
+
+	/* Buffers in flight, at least three so that a read, a cipher call and a write can overlap */
+	std::size_t buffer_count = 4;
+
+	/* Bypasses the page cache where the file system allows it, which keeps large jobs from evicting
+	everything else and lets NVMe drives stream at full speed. Windows only bypasses it for reads. */
+	bool direct = false;
+};
+
+/* File to file encryption with reading, enciphering and writing overlapped. A reader thread fills
+aligned buffers ahead of the cipher and a writer thread drains them behind it, so while the calling
+thread runs the cipher over one buffer the next one is being read and the previous one written.
+The cipher is any resumable transform over consecutive pieces, the shape of CommandLine::Transform,
+which covers XOR, Caesar, Atbash and Vigenere and lets output shrink like packed Polybius does.
+
+Reads and writes are positional (pread and pwrite, or ReadFile and WriteFile at an offset) from one
+thread each, standing in for an io_uring submission queue without needing liburing. The output is
+never truncated up front, only cut to its final size at the end, so the input and output may be the
+same file: no write can land ahead of the data that still has to be read. */
+class AsyncFile {
+public:
+	using Options = AsyncFileOptions;
+	using Transform = std::function<std::size_t(const uint8_t* input, uint8_t* output, std::size_t size)>;
+
+	class IoException : public std::runtime_error {
+	public: explicit IoException(const std::string& message) : std::runtime_error(message) {}
+	};
+
+	/* Buffer addresses, sizes and file offsets are kept to multiples of this for direct I/O */
+	static const std::size_t alignment = 4096;
+
+	/* Enciphers input_path into output_path and returns the number of bytes written */
+	static uint64_t transform(const std::string& input_path, const std::string& output_path, const Transform& apply, const Options& options = Options()) {
+		std::size_t buffer_size = (options.buffer_size + alignment - 1) / alignment * alignment;
+		if (buffer_size == 0) buffer_size = alignment;
+		std::size_t buffer_count = options.buffer_count < 3 ? 3 : options.buffer_count;
+
+		File input(input_path, false, options.direct);
+		File output(output_path, true, options.direct);
+
+		std::vector<AlignedBuffer> buffers;
+		buffers.reserve(buffer_count);
+		Channel free_buffers, read_buffers, enciphered_buffers;
+		for (std::size_t i = 0; i < buffer_count; i++) {
+			buffers.emplace_back(buffer_size);
+			free_buffers.push(Block{ i, 0 });
+		}
+
+		std::exception_ptr failure;
+		std::mutex failure_mutex;
+		auto fail = [&](std::exception_ptr error) {
+			{
+				std::lock_guard<std::mutex> lock(failure_mutex);
+				if (!failure) failure = error;
+			}
+			free_buffers.cancel();
+			read_buffers.cancel();
+			enciphered_buffers.cancel();
+		};
+
+		std::thread reader([&] {
+			try {
+				uint64_t offset = 0;
+				Block block;
+				while (free_buffers.pop(block)) {
+					block.size = input.read_at(buffers[block.index].data, buffer_size, offset);
+					offset += block.size;
+
+					/* A short read only happens at the end of a regular file */
+					bool last = block.size < buffer_size;
+					if (block.size != 0) read_buffers.push(block);
+					if (last) break;
+				}
+				read_buffers.close();
+			} catch (...) {
+				fail(std::current_exception());
+			}
+		});
+
+		uint64_t written = 0;
+		std::thread writer([&] {
+			try {
+				Block block;
+				while (enciphered_buffers.pop(block)) {
+					output.write_at(buffers[block.index].data, block.size, written);
+					written += block.size;
+					free_buffers.push(Block{ block.index, 0 });
+				}
+			} catch (...) {
+				fail(std::current_exception());
+			}
+		});
+
+		try {
+			Block block;
+			while (read_buffers.pop(block)) {
+				uint8_t* data = buffers[block.index].data;
+				block.size = apply(data, data, block.size);
+				enciphered_buffers.push(block);
+			}
+			enciphered_buffers.close();
+		} catch (...) {
+			fail(std::current_exception());
+		}
+
+		reader.join();
+		writer.join();
+		if (failure) std::rethrow_exception(failure);
+
+		output.truncate(written);
+		return written;
+	}
+
+private:
+	struct Block {
+		std::size_t index;
+		std::size_t size;
+	};
+
+	/* Queue of blocks handed from one stage to the next. Closing lets the consumer drain what is left,
+	cancelling stops every stage straight away. */
+	class Channel {
+	public:
+		void push(const Block& block) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (cancelled) return;
+				blocks.push_back(block);
+			}
+			condition.notify_one();
+		}
+
+		bool pop(Block& block) {
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this] { return cancelled || closed || !blocks.empty(); });
+			if (cancelled || blocks.empty()) return false;
+
+			block = blocks.front();
+			blocks.pop_front();
+			return true;
+		}
+
+		void close() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				closed = true;
+			}
+			condition.notify_all();
+		}
+
+		void cancel() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				cancelled = true;
+			}
+			condition.notify_all();
+		}
+
+	private:
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::deque<Block> blocks;
+		bool closed = false;
+		bool cancelled = false;
+	};
+
+	struct AlignedBuffer {
+		uint8_t* data = nullptr;
+
+		explicit AlignedBuffer(std::size_t size) {
+#if defined(_WIN32)
+			data = static_cast<uint8_t*>(_aligned_malloc(size, alignment));
+#else
+			void* memory = nullptr;
+			if (posix_memalign(&memory, alignment, size) == 0) data = static_cast<uint8_t*>(memory);
+#endif
+			if (data == nullptr) throw std::bad_alloc();
+		}
+
+		AlignedBuffer(AlignedBuffer&& other) noexcept : data(other.data) { other.data = nullptr; }
+
+		~AlignedBuffer() {
+#if defined(_WIN32)
+			_aligned_free(data);
+#else
+			std::free(data);
+#endif
+		}
+
+		AlignedBuffer(const AlignedBuffer&) = delete;
+		AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+		AlignedBuffer& operator=(AlignedBuffer&&) = delete;
+	};
+
+	/* Positional reads and writes on one open file */
+	class File {
+	public:
+		File(const std::string& path, bool writable, bool direct) : file_path(path) {
+			open(writable, direct);
+		}
+
+		~File() { close(); }
+
+		File(const File&) = delete;
+		File& operator=(const File&) = delete;
+
+#if defined(_WIN32)
+		/* Reads until size bytes or the end of the file, returns the number of bytes read */
+		std::size_t read_at(uint8_t* buffer, std::size_t size, uint64_t offset) {
+			std::size_t total = 0;
+			while (total < size) {
+				OVERLAPPED position = {};
+				position.Offset = static_cast<DWORD>(offset + total);
+				position.OffsetHigh = static_cast<DWORD>((offset + total) >> 32);
+
+				DWORD received = 0;
+				DWORD request = static_cast<DWORD>(size - total < (std::size_t(1) << 30) ? size - total : std::size_t(1) << 30);
+				if (!ReadFile(handle, buffer + total, request, &received, &position) && GetLastError() != ERROR_HANDLE_EOF) fail("read");
+				if (received == 0) break;
+				total += received;
+			}
+			return total;
+		}
+
+		void write_at(const uint8_t* buffer, std::size_t size, uint64_t offset) {
+			std::size_t total = 0;
+			while (total < size) {
+				OVERLAPPED position = {};
+				position.Offset = static_cast<DWORD>(offset + total);
+				position.OffsetHigh = static_cast<DWORD>((offset + total) >> 32);
+
+				DWORD sent = 0;
+				DWORD request = static_cast<DWORD>(size - total < (std::size_t(1) << 30) ? size - total : std::size_t(1) << 30);
+				if (!WriteFile(handle, buffer + total, request, &sent, &position)) fail("write");
+				total += sent;
+			}
+		}
+
+		void truncate(uint64_t size) {
+			LARGE_INTEGER position;
+			position.QuadPart = static_cast<LONGLONG>(size);
+			if (!SetFilePointerEx(handle, position, nullptr, FILE_BEGIN) || !SetEndOfFile(handle)) fail("truncate");
+		}
+
+	private:
+		std::string file_path;
+		HANDLE handle = INVALID_HANDLE_VALUE;
+
+		void open(bool writable, bool direct) {
+			DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+			if (direct && !writable) flags |= FILE_FLAG_NO_BUFFERING;
+
+			handle = CreateFileA(file_path.c_str(), writable ? GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, writable ? OPEN_ALWAYS : OPEN_EXISTING, flags, nullptr);
+			if (handle == INVALID_HANDLE_VALUE) fail("open");
+		}
+
+		void close() {
+			if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+			handle = INVALID_HANDLE_VALUE;
+		}
+
+		void fail(const char* operation) {
+			throw IoException("Could not " + std::string(operation) + " " + file_path + " (error " + std::to_string(GetLastError()) + ").");
+		}
+#else
+		std::size_t read_at(uint8_t* buffer, std::size_t size, uint64_t offset) {
+			std::size_t total = 0;
+			while (total < size) {
+				ssize_t received = pread(descriptor, buffer + total, size - total, static_cast<off_t>(offset + total));
+				if (received < 0 && errno == EINTR) continue;
+				if (received < 0) fail("read");
+				if (received == 0) break;
+				total += static_cast<std::size_t>(received);
+			}
+			return total;
+		}
+
+		/* Direct writes have to be whole aligned blocks, the odd sized tail of the output and anything
+		after a cipher shrank its output goes through the page cache instead */
+		void write_at(const uint8_t* buffer, std::size_t size, uint64_t offset) {
+			if (direct_io && (size % alignment != 0 || offset % alignment != 0)) drop_direct();
+
+			std::size_t total = 0;
+			while (total < size) {
+				ssize_t sent = pwrite(descriptor, buffer + total, size - total, static_cast<off_t>(offset + total));
+				if (sent < 0 && errno == EINTR) continue;
+				if (sent < 0) fail("write");
+				total += static_cast<std::size_t>(sent);
+			}
+		}
+
+		void truncate(uint64_t size) {
+			struct stat status;
+			if (fstat(descriptor, &status) != 0) fail("stat");
+			if (static_cast<uint64_t>(status.st_size) != size && ftruncate(descriptor, static_cast<off_t>(size)) != 0) fail("truncate");
+		}
+
+	private:
+		std::string file_path;
+		int descriptor = -1;
+		bool direct_io = false;
+
+		void open(bool writable, bool direct) {
+			int flags = writable ? O_WRONLY | O_CREAT : O_RDONLY;
+
+#if defined(O_DIRECT)
+			/* File systems without direct I/O, tmpfs among them, refuse the flag, they get the page cache */
+			if (direct) {
+				descriptor = ::open(file_path.c_str(), flags | O_DIRECT, 0644);
+				direct_io = descriptor >= 0;
+			}
+#endif
+			if (descriptor < 0) descriptor = ::open(file_path.c_str(), flags, 0644);
+			if (descriptor < 0) fail("open");
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+			if (!writable) posix_fadvise(descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		}
+
+		void drop_direct() {
+#if defined(O_DIRECT)
+			int flags = fcntl(descriptor, F_GETFL);
+			if (flags < 0 || fcntl(descriptor, F_SETFL, flags & ~O_DIRECT) != 0) fail("configure");
+#endif
+			direct_io = false;
+		}
+
+		void close() {
+			if (descriptor >= 0) ::close(descriptor);
+			descriptor = -1;
+		}
+
+		void fail(const char* operation) {
+			int error = errno;
+			throw IoException("Could not " + std::string(operation) + " " + file_path + ": " + std::strerror(error));
+		}
+#endif
+	};
+};
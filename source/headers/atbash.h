@@ -1,59 +1,189 @@
 #pragma once
 
+#include <algorithm>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "alphabet.h"
+#include "metrics.h"
+#include "span.h"
+#include "translation_table.h"
+#include "utf8.h"
+
+/* Mirror substitution over an arbitrary base, compiled once: the symbol at index i of the base maps
+onto the symbol at index size - 1 - i and everything else maps onto itself. Symbols below dense_limit
+go through a direct table that starts out as the identity, larger ones such as whole Unicode blocks
+through an open addressing SymbolMap, so every symbol costs one lookup however large the base is.
+Byte input additionally goes through a TranslationTable and its vector kernels. Symbols are integers
+of at most 32 bits, wider ones would collide once narrowed, so they are rejected at compile time. */
+class MirrorSubstitution {
+public:
+	/* Symbols below this go through a direct table, larger ones through the hash table */
+	static const uint32_t dense_limit = 1 << 16;
+
+	/* Duplicate symbols keep their first index, like a search through the base would */
+	template <typename symbol_type>
+	explicit MirrorSubstitution(const std::vector<symbol_type>& base) {
+		static_assert(fits_symbol<symbol_type>(), "Mirror substitution needs integral symbols of at most 32 bits.");
+
+		symbols.reserve(base.size());
+		uint32_t largest = 0;
+		for (symbol_type symbol : base) {
+			symbols.push_back(static_cast<uint32_t>(symbol));
+			largest = std::max(largest, symbols.back());
+		}
+
+		if (largest < dense_limit) {
+			dense.resize(static_cast<std::size_t>(largest) + 1);
+			for (std::size_t i = 0; i < dense.size(); i++) dense[i] = static_cast<uint32_t>(i);
+		} else {
+			sparse.reserve(symbols.size() * 2);
+		}
+
+		for (std::size_t i = symbols.size(); i-- > 0;) {
+			if (symbols[i] < dense.size()) dense[symbols[i]] = symbols[symbols.size() - 1 - i];
+			else sparse.set(symbols[i], static_cast<int32_t>(i));
+		}
+
+		for (uint32_t value = 0; value < 256; value++) byte_table.set(static_cast<uint8_t>(value), static_cast<uint8_t>(map(value)));
+	}
+
+	/* Base given as UTF-8 text, one symbol per code point */
+	static MirrorSubstitution from_utf8(const std::string& base) {
+		return MirrorSubstitution(Utf8::decode(base));
+	}
+
+	uint32_t map(uint32_t symbol) const {
+		if (symbol < dense.size()) return dense[symbol];
+		if (sparse.size() == 0) return symbol;
+
+		int32_t index = sparse.get(symbol);
+		return index < 0 ? symbol : symbols[symbols.size() - 1 - index];
+	}
+
+	/* Input and output may alias */
+	template <typename symbol_type>
+	void apply(const symbol_type* input, symbol_type* output, std::size_t size) const {
+		static_assert(fits_symbol<symbol_type>(), "Mirror substitution needs integral symbols of at most 32 bits.");
+		for (std::size_t i = 0; i < size; i++) output[i] = static_cast<symbol_type>(map(static_cast<uint32_t>(input[i])));
+	}
+
+	void apply(const uint8_t* input, uint8_t* output, std::size_t size) const {
+		byte_table.apply(input, output, size);
+	}
+
+	template <typename symbol_type>
+	std::vector<symbol_type> apply(std::vector<symbol_type> data) const {
+		apply(data.data(), data.data(), data.size());
+		return data;
+	}
+
+	/* Mirrors the code points of UTF-8 text, the result is UTF-8 again */
+	std::string apply_utf8(const std::string& text) const {
+		CIPHERS_METRICS_SCOPE("atbash", "utf8", text.size());
+		return Utf8::transform(text, [this](uint32_t* code_points, std::size_t count) { apply(code_points, code_points, count); });
+	}
+
+	/* Same over a stream, which never has to fit in memory */
+	void apply_utf8(std::istream& input, std::ostream& output) const {
+		Utf8::transform(input, output, [this](uint32_t* code_points, std::size_t count) { apply(code_points, code_points, count); });
+	}
+
+	template <typename symbol_type>
+	static constexpr bool fits_symbol() {
+		return std::is_integral<symbol_type>::value && sizeof(symbol_type) <= sizeof(uint32_t);
+	}
+
+private:
+	std::vector<uint32_t> symbols;
+	std::vector<uint32_t> dense;
+	SymbolMap sparse;
+	TranslationTable byte_table;
+};
+
 class Atbash {
 public:
+	/* Mirrors data over base. Integral symbols of up to 32 bits go through a MirrorSubstitution, which
+	callers applying the same base repeatedly should keep around. Wider or non integral symbols, anything
+	that compares equal, are still mirrored by searching the base. */
 	template<typename vector_type>
 	static std::vector<vector_type> reverse_apply(std::vector<vector_type> data, std::vector<vector_type> base) {
-		std::vector<vector_type> reversed_base = std::vector<vector_type>(base.rbegin(), base.rend());
-		std::cout << reversed_base.at(0) << std::endl;
-		std::cout << base.at(0) << std::endl;
+		CIPHERS_METRICS_SCOPE("atbash", "mirror", data.size());
+		return reverse_apply(std::move(data), base, std::integral_constant<bool, MirrorSubstitution::fits_symbol<vector_type>()>());
+	}
+
+	/* Translation table that mirrors a byte alphabet in both cases and leaves every other byte unchanged */
+	template <std::size_t alphabet_size>
+	static constexpr TranslationTable mirror_table(const ByteAlphabet<alphabet_size>& alphabet) {
+		TranslationTable table;
+		/* Lowercase goes last, so symbols without case (digits) keep their lowercase mapping */
+		for (std::size_t i = 0; i < alphabet_size; i++)
+			table.set(static_cast<uint8_t>(alphabet.symbol_at(i, true)), static_cast<uint8_t>(alphabet.symbol_at(alphabet_size - 1 - i, true)));
+		for (std::size_t i = 0; i < alphabet_size; i++)
+			table.set(static_cast<uint8_t>(alphabet.symbol_at(i, false)), static_cast<uint8_t>(alphabet.symbol_at(alphabet_size - 1 - i, false)));
 
-		std::vector<vector_type> encoded_data;
+		return table;
+	}
 
-		for (std::size_t i = 0; i < data.size(); i++) {
-			vector_type ivalue = data.at(i);
-			auto ivalue_iterator = std::find(base.begin(), base.end(), ivalue);
+	static constexpr TranslationTable atbash_table() {
+		return mirror_table(Alphabets::make_latin());
+	}
 
-			if (ivalue_iterator == base.end()) {
-				encoded_data.push_back(ivalue);
-				continue;
-			}
+	/* Mirrors the symbols of any alphabet, symbols outside it are copied unchanged. Input and output may alias. */
+	template <typename alphabet_type, typename symbol_type>
+	static void alphabet_mirror(const alphabet_type& alphabet, const symbol_type* input, symbol_type* output, std::size_t size) {
+		const std::size_t last_index = alphabet.size() - 1;
 
-			vector_type ivalue_base_index = std::distance(base.begin(), ivalue_iterator);
-			encoded_data.push_back(reversed_base.at(ivalue_base_index));
+		for (std::size_t i = 0; i < size; i++) {
+			bool uppercase = false;
+			int32_t index = alphabet.locate(static_cast<uint32_t>(input[i]), uppercase);
+			output[i] = index < 0 ? input[i] : static_cast<symbol_type>(alphabet.symbol_at(last_index - index, uppercase));
 		}
+	}
 
-		return encoded_data;
+	static std::vector<uint32_t> alphabet_mirror(const Alphabet& alphabet, std::vector<uint32_t> data) {
+		alphabet_mirror(alphabet, data.data(), data.data(), data.size());
+		return data;
 	}
 
 	static std::string atbash_apply(std::string data) {
-		std::string alphabet = "abcdefghijklmnopqrstuvwxyz";
-		std::string reversed = "zyxwvutsrqponmlkjihgfedcba";
-		std::string encoded_data;
-
-		for (std::size_t i = 0; i < data.size(); i++) {
-			int8_t current_character = data.at(i);
-			int8_t case_difference = 0;
-
-			if (current_character >= 'A' && current_character <= 'Z')
-				case_difference = 32;
-			
-			current_character += case_difference;
-
-			auto alphabet_iterator = std::find(alphabet.begin(), alphabet.end(), current_character);
-			
-			if (alphabet_iterator == alphabet.end()) {
-				encoded_data.push_back(current_character);
-				continue;
-			}
-
-			uint8_t character_index = std::distance(alphabet.begin(), alphabet_iterator);
-			encoded_data.push_back(reversed.at(character_index)-case_difference);
+		CIPHERS_METRICS_SCOPE("atbash", "apply", data.size());
+		return latin_table().apply(data);
+	}
+
+	/* Mirrors the latin letters of input into output, every other byte is copied unchanged. Input and output may alias. */
+	static void atbash_apply(const uint8_t* input, uint8_t* output, std::size_t size) {
+		CIPHERS_METRICS_SCOPE("atbash", "apply", size);
+		latin_table().apply(input, output, size);
+	}
+
+	/* Span form of the above, output must be at least as large as input */
+	static void atbash_apply(Span<const uint8_t> input, Span<uint8_t> output) {
+		CIPHERS_METRICS_SCOPE("atbash", "apply", input.size());
+		require_output(output, input.size());
+		latin_table().apply(input.data(), output.data(), input.size());
+	}
+
+private:
+	template<typename vector_type>
+	static std::vector<vector_type> reverse_apply(std::vector<vector_type> data, const std::vector<vector_type>& base, std::true_type) {
+		return MirrorSubstitution(base).apply(std::move(data));
+	}
+
+	/* Duplicate symbols keep their first index here too */
+	template<typename vector_type>
+	static std::vector<vector_type> reverse_apply(std::vector<vector_type> data, const std::vector<vector_type>& base, std::false_type) {
+		for (vector_type& symbol : data) {
+			auto found = std::find(base.begin(), base.end(), symbol);
+			if (found != base.end()) symbol = base[base.size() - 1 - static_cast<std::size_t>(found - base.begin())];
 		}
+		return data;
+	}
 
-		return encoded_data;
+	static const TranslationTable& latin_table() {
+		static constexpr TranslationTable table = atbash_table();
+		return table;
 	}
 };
\ No newline at end of file
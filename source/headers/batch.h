@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "metrics.h"
+#include "parallel.h"
+#include "simd.h"
+#include "span.h"
+#include "thread_pool.h"
+#include "vigenere.h"
+#include "xor.h"
+
+/* Many small messages laid out back to back in one arena, structure of arrays style: record i is
+lengths[i] bytes at offsets[i] and is enciphered with key key_ids[i]. Records have to be in ascending
+order and may not overlap, gaps between them are allowed. */
+struct BatchRecords {
+	Span<const uint8_t> arena;
+	Span<const uint64_t> offsets;
+	Span<const uint32_t> lengths;
+	Span<const uint32_t> key_ids;
+};
+
+/* Keys laid out the same way, key k is lengths[k] bytes at offsets[k] */
+struct BatchKeys {
+	Span<const uint8_t> arena;
+	Span<const uint64_t> offsets;
+	Span<const uint32_t> lengths;
+};
+
+/* Enciphers whole batches of records in one call, into an output arena with the same layout as the
+input, and never allocates. Caesar and XOR do not walk the records one at a time: the shift or key
+byte of every input byte is spread into a lane buffer next to the data, block by block, and a single
+vector pass runs over the block whatever records it spans, so a 60 byte record costs no more setup
+than a 60 byte stretch of a large message. Vigenere keys only move on letters, so its records each
+go through the stack compiled span form of vigenere_lookup. Record groups of about chunk_size bytes
+are spread over the pool. Bytes in the gaps between records are copied to the output unchanged. */
+class Batch {
+public:
+	class MalformedBatchException : public std::runtime_error {
+	public: explicit MalformedBatchException(const char* message) : std::runtime_error(message) {}
+	};
+
+	/* Record i is shifted by shifts[key_ids[i]] */
+	static void caesar_shift(const BatchRecords& records, Span<const uint32_t> shifts, Span<uint8_t> output, bool shift_backwards = false, const ParallelOptions& options = ParallelOptions()) {
+		CIPHERS_METRICS_SCOPE("batch", shift_backwards ? "caesar_decode" : "caesar_encode", records.arena.size());
+		validate(records, shifts.size(), output);
+
+		for_each_group(records, options, [&](std::size_t first, std::size_t last) {
+			apply_lanes(records, first, last, output, [&](uint8_t* lanes, std::size_t record, std::size_t begin, std::size_t end, std::size_t) {
+				uint32_t shift = shifts[records.key_ids[record]] % 26;
+				if (shift_backwards) shift = (26 - shift) % 26;
+				std::memset(lanes + begin, static_cast<int>(shift), end - begin);
+			}, shift_lanes);
+		});
+	}
+
+	/* Record i is XORed against key key_ids[i], starting at the first key byte */
+	static void apply_xor(const BatchRecords& records, const BatchKeys& keys, Span<uint8_t> output, const ParallelOptions& options = ParallelOptions()) {
+		CIPHERS_METRICS_SCOPE("batch", "xor", records.arena.size());
+		validate(records, keys, output);
+
+		for_each_group(records, options, [&](std::size_t first, std::size_t last) {
+			apply_lanes(records, first, last, output, [&](uint8_t* lanes, std::size_t record, std::size_t begin, std::size_t end, std::size_t key_position) {
+				const uint8_t* key = keys.arena.data() + keys.offsets[records.key_ids[record]];
+				const std::size_t key_size = keys.lengths[records.key_ids[record]];
+
+				/* The record may have started in an earlier block, its key stream continues from there up to
+				the end of the key. After that the stream repeats whole keys, which copy themselves in doubling runs. */
+				key_position %= key_size;
+				std::size_t run = std::min(end - begin, key_size - key_position);
+				std::memcpy(lanes + begin, key + key_position, run);
+				begin += run;
+
+				uint8_t* repeated = lanes + begin;
+				const std::size_t remaining = end - begin;
+				std::size_t filled = std::min(remaining, key_size);
+				std::memcpy(repeated, key, filled);
+				while (filled < remaining) {
+					std::size_t copied = std::min(filled, remaining - filled);
+					std::memcpy(repeated + filled, repeated, copied);
+					filled += copied;
+				}
+			}, xor_lanes);
+		});
+	}
+
+	/* Record i is enciphered with key key_ids[i] as vigenere_lookup would, from the start of the key */
+	static void vigenere_lookup(const BatchRecords& records, const BatchKeys& keys, Span<uint8_t> output, bool decode_lookup = false, bool preserve_case = true, const ParallelOptions& options = ParallelOptions()) {
+		CIPHERS_METRICS_SCOPE("batch", decode_lookup ? "vigenere_decode" : "vigenere_encode", records.arena.size());
+		validate(records, keys, output);
+
+		for_each_group(records, options, [&](std::size_t first, std::size_t last) {
+			copy_gaps(records, first, last, output);
+
+			for (std::size_t record = first; record < last; record++) {
+				uint32_t key_id = records.key_ids[record];
+				Span<const uint8_t> key = keys.arena.subspan(keys.offsets[key_id], keys.lengths[key_id]);
+				Vigenere::vigenere_lookup(records.arena.subspan(records.offsets[record], records.lengths[record]), output.subspan(records.offsets[record], records.lengths[record]), key, decode_lookup, preserve_case);
+			}
+		});
+	}
+
+	/* Checks the layout once per batch, so the kernels can trust it. Lengths are compared against what
+	is left of the arena after the offset, an offset plus a length could wrap around and pass. */
+	static void validate(const BatchRecords& records, std::size_t key_count, Span<uint8_t> output) {
+		const std::size_t count = records.offsets.size();
+		if (records.lengths.size() != count || records.key_ids.size() != count) throw MalformedBatchException("Offsets, lengths and key ids of a batch differ in length.");
+		require_output(output, records.arena.size());
+
+		uint64_t previous_end = 0;
+		for (std::size_t i = 0; i < count; i++) {
+			uint64_t begin = records.offsets[i], length = records.lengths[i];
+			if (begin < previous_end || begin > records.arena.size() || length > records.arena.size() - begin) throw MalformedBatchException("Batch records overlap, are out of order or run past the arena.");
+			if (records.key_ids[i] >= key_count) throw MalformedBatchException("Batch record refers to a key that does not exist.");
+			previous_end = begin + length;
+		}
+	}
+
+	static void validate(const BatchRecords& records, const BatchKeys& keys, Span<uint8_t> output) {
+		if (keys.lengths.size() != keys.offsets.size()) throw MalformedBatchException("Offsets and lengths of the batch keys differ in length.");
+
+		for (std::size_t k = 0; k < keys.offsets.size(); k++) {
+			if (keys.lengths[k] == 0) throw MalformedBatchException("Batch key is empty.");
+			if (keys.offsets[k] > keys.arena.size() || keys.lengths[k] > keys.arena.size() - keys.offsets[k]) throw MalformedBatchException("Batch key runs past the key arena.");
+		}
+
+		validate(records, keys.offsets.size(), output);
+	}
+
+private:
+	/* Bytes of data and lanes processed at a time, the lanes live on the stack */
+	static const std::size_t block_size = 4096;
+
+	/* Splits the records into groups of about chunk_size bytes and runs body(first, last) for every
+	group, on the pool when there is more than one */
+	template <typename group_function>
+	static void for_each_group(const BatchRecords& records, const ParallelOptions& options, group_function body) {
+		const std::size_t count = records.offsets.size();
+		if (count == 0) {
+			/* Nothing but gap, which still has to reach the output */
+			body(0, 0);
+			return;
+		}
+
+		const uint64_t total = records.offsets[count - 1] + records.lengths[count - 1] - records.offsets[0];
+		const std::size_t chunk_size = options.chunk_size == 0 ? static_cast<std::size_t>(total) : options.chunk_size;
+		if (total <= chunk_size) {
+			body(0, count);
+			return;
+		}
+
+		/* Group g starts at the first record that begins at or past g chunks into the batch */
+		const std::size_t group_count = static_cast<std::size_t>((total + chunk_size - 1) / chunk_size);
+		ThreadPool& pool = options.pool != nullptr ? *options.pool : ThreadPool::shared();
+		pool.parallel_for(group_count, [&](std::size_t group) {
+			std::size_t first = group_start(records, group, chunk_size);
+			std::size_t last = group + 1 == group_count ? count : group_start(records, group + 1, chunk_size);
+			if (first < last) body(first, last);
+		});
+	}
+
+	static std::size_t group_start(const BatchRecords& records, std::size_t group, std::size_t chunk_size) {
+		const uint64_t target = records.offsets[0] + static_cast<uint64_t>(group) * chunk_size;
+		return static_cast<std::size_t>(std::lower_bound(records.offsets.begin(), records.offsets.end(), target) - records.offsets.begin());
+	}
+
+	/* Copies the bytes of the group's range that no record covers, the range being the same one apply_lanes walks */
+	static void copy_gaps(const BatchRecords& records, std::size_t first, std::size_t last, Span<uint8_t> output) {
+		uint64_t position = first == 0 ? 0 : records.offsets[first];
+		const uint64_t range_end = last == records.offsets.size() ? records.arena.size() : records.offsets[last];
+
+		for (std::size_t record = first; record < last; record++) {
+			if (records.offsets[record] > position) std::memcpy(output.data() + position, records.arena.data() + position, static_cast<std::size_t>(records.offsets[record] - position));
+			position = records.offsets[record] + records.lengths[record];
+		}
+
+		if (range_end > position) std::memcpy(output.data() + position, records.arena.data() + position, static_cast<std::size_t>(range_end - position));
+	}
+
+	/* Walks the byte range of records [first, last) in blocks. fill(lanes, record, begin, end, position)
+	writes the lanes of the part of a record that falls in [begin, end) of the block, position being how
+	far into the record that part starts. Gap lanes stay zero, which every kernel treats as a copy. */
+	template <typename fill_function, typename kernel_function>
+	static void apply_lanes(const BatchRecords& records, std::size_t first, std::size_t last, Span<uint8_t> output, fill_function fill, kernel_function kernel) {
+		const uint64_t range_begin = first == 0 ? 0 : records.offsets[first];
+		const uint64_t range_end = last == records.offsets.size() ? records.arena.size() : records.offsets[last];
+
+		uint8_t lanes[block_size];
+		std::size_t record = first;
+
+		for (uint64_t block_begin = range_begin; block_begin < range_end; block_begin += block_size) {
+			const uint64_t remaining = range_end - block_begin;
+			const std::size_t size = remaining < block_size ? static_cast<std::size_t>(remaining) : block_size;
+			const uint64_t block_end = block_begin + size;
+			std::memset(lanes, 0, size);
+
+			/* Records that end before this block are done, the last one may continue into the next */
+			while (record < last && records.offsets[record] + records.lengths[record] <= block_begin) record++;
+			for (std::size_t current = record; current < last && records.offsets[current] < block_end; current++) {
+				uint64_t begin = std::max<uint64_t>(records.offsets[current], block_begin);
+				uint64_t end = std::min<uint64_t>(records.offsets[current] + records.lengths[current], block_end);
+				if (begin < end) fill(lanes, current, static_cast<std::size_t>(begin - block_begin), static_cast<std::size_t>(end - block_begin), static_cast<std::size_t>(begin - records.offsets[current]));
+			}
+
+			kernel(records.arena.data() + block_begin, output.data() + block_begin, lanes, size);
+		}
+	}
+
+	static void xor_lanes(const uint8_t* input, uint8_t* output, const uint8_t* lanes, std::size_t size) {
+		/* A key as long as the data, which apply_xor runs through its vector kernels without wrapping */
+		Xor::apply_xor(input, output, size, lanes, size);
+	}
+
+	/* Latin letters move forward by their lane's shift, case is kept and everything else is copied */
+	static void shift_lanes(const uint8_t* input, uint8_t* output, const uint8_t* lanes, std::size_t size) {
+		std::size_t processed = 0;
+
+#if CIPHERS_SIMD_X86
+		Simd::Level level = Simd::level();
+		if (level >= Simd::Level::AVX2) processed = shift_lanes_avx2(input, output, lanes, size);
+		else if (level >= Simd::Level::SSE2) processed = shift_lanes_sse2(input, output, lanes, size);
+#endif
+
+		for (std::size_t i = processed; i < size; i++) {
+			uint8_t lowered = input[i] | 0x20;
+			uint8_t index = static_cast<uint8_t>(lowered - 'a');
+			if (index > 25) {
+				output[i] = input[i];
+				continue;
+			}
+
+			uint8_t shifted = static_cast<uint8_t>(index + lanes[i]);
+			if (shifted > 25) shifted -= 26;
+			output[i] = static_cast<uint8_t>((shifted + 'a') ^ (input[i] ^ lowered));
+		}
+	}
+
+#if CIPHERS_SIMD_X86
+	SIMD_TARGET("sse2")
+	static std::size_t shift_lanes_sse2(const uint8_t* input, uint8_t* output, const uint8_t* lanes, std::size_t size) {
+		const __m128i case_bit = _mm_set1_epi8(0x20);
+		const __m128i letter_a = _mm_set1_epi8('a');
+		const __m128i last_index = _mm_set1_epi8(25);
+		const __m128i alphabet_size = _mm_set1_epi8(26);
+		std::size_t i = 0;
+
+		for (; i + 16 <= size; i += 16) {
+			__m128i data_vector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+			__m128i lowered = _mm_or_si128(data_vector, case_bit);
+			__m128i letter_index = _mm_sub_epi8(lowered, letter_a);
+			__m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter_index, last_index), letter_index);
+
+			__m128i shifted = _mm_add_epi8(letter_index, _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes + i)));
+			shifted = _mm_sub_epi8(shifted, _mm_and_si128(_mm_cmpgt_epi8(shifted, last_index), alphabet_size));
+
+			__m128i encoded = _mm_xor_si128(_mm_add_epi8(shifted, letter_a), _mm_xor_si128(data_vector, lowered));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_or_si128(_mm_and_si128(is_letter, encoded), _mm_andnot_si128(is_letter, data_vector)));
+		}
+
+		return i;
+	}
+
+	SIMD_TARGET("avx2")
+	static std::size_t shift_lanes_avx2(const uint8_t* input, uint8_t* output, const uint8_t* lanes, std::size_t size) {
+		const __m256i case_bit = _mm256_set1_epi8(0x20);
+		const __m256i letter_a = _mm256_set1_epi8('a');
+		const __m256i last_index = _mm256_set1_epi8(25);
+		const __m256i alphabet_size = _mm256_set1_epi8(26);
+		std::size_t i = 0;
+
+		for (; i + 32 <= size; i += 32) {
+			__m256i data_vector = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+			__m256i lowered = _mm256_or_si256(data_vector, case_bit);
+			__m256i letter_index = _mm256_sub_epi8(lowered, letter_a);
+			__m256i is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter_index, last_index), letter_index);
+
+			__m256i shifted = _mm256_add_epi8(letter_index, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes + i)));
+			shifted = _mm256_sub_epi8(shifted, _mm256_and_si256(_mm256_cmpgt_epi8(shifted, last_index), alphabet_size));
+
+			__m256i encoded = _mm256_xor_si256(_mm256_add_epi8(shifted, letter_a), _mm256_xor_si256(data_vector, lowered));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_blendv_epi8(data_vector, encoded, is_letter));
+		}
+
+		return i;
+	}
+#endif
+};
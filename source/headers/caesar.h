@@ -1,48 +1,96 @@
 #pragma once
 
 #include <string>
+#include <vector>
+
+#include "alphabet.h"
+#include "metrics.h"
+#include "span.h"
+#include "translation_table.h"
 
 class Caesar {
 public:
-	static std::string caesar_shift(std::string data, uint32_t amount, bool shift_backwards=false) {
-		std::string alphabet_lower = "abcdefghijklmnopqrstuvwxyz";
-		std::string alphabet_upper = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-		std::string shifted_data = std::string();
-
-		for (std::size_t i = 0; i < data.size(); i++) {
-			uint32_t index_character = data.at(i);
-			auto iterator_lower = std::find(alphabet_lower.begin(), alphabet_lower.end(), index_character);
-			auto iterator_upper = std::find(alphabet_upper.begin(), alphabet_upper.end(), index_character);
-
-			std::string* target_alphabet = nullptr;
-			int32_t character_index = 0;
-			
-			if (iterator_lower != alphabet_lower.end()) {
-				character_index = std::distance(alphabet_lower.begin(), iterator_lower);
-				target_alphabet = &alphabet_lower;
-			}
-			
-			else if (iterator_upper != alphabet_upper.end()) {
-				character_index = std::distance(alphabet_upper.begin(), iterator_upper);
-				target_alphabet = &alphabet_upper;
-			}
+	/* Translation table that shifts the symbols of a byte alphabet by amount, in both cases, and leaves
+	every other byte unchanged */
+	template <std::size_t alphabet_size>
+	static constexpr TranslationTable shift_table(const ByteAlphabet<alphabet_size>& alphabet, uint32_t amount, bool shift_backwards = false) {
+		std::size_t shift = amount % alphabet_size;
+		if (shift_backwards) shift = (alphabet_size - shift) % alphabet_size;
+
+		TranslationTable table;
+		/* Lowercase goes last, so symbols without case (digits) keep their lowercase mapping */
+		for (std::size_t i = 0; i < alphabet_size; i++)
+			table.set(static_cast<uint8_t>(alphabet.symbol_at(i, true)), static_cast<uint8_t>(alphabet.symbol_at((i + shift) % alphabet_size, true)));
+		for (std::size_t i = 0; i < alphabet_size; i++)
+			table.set(static_cast<uint8_t>(alphabet.symbol_at(i, false)), static_cast<uint8_t>(alphabet.symbol_at((i + shift) % alphabet_size, false)));
 
-			int32_t shifted_index;
+		return table;
+	}
 
-			if (shift_backwards) {
-				shifted_index = character_index - amount;
-				while (shifted_index < 0) shifted_index += 26;
-			} else {
-				shifted_index = character_index + amount;
-				while (shifted_index > 25) shifted_index -= 26;
+	static constexpr TranslationTable shift_table(uint32_t amount, bool shift_backwards = false) {
+		return shift_table(Alphabets::make_latin(), amount, shift_backwards);
+	}
+
+	/* Shifts the symbols of any alphabet, for alphabets that do not fit a translation table. Symbols
+	outside the alphabet are copied unchanged. Input and output may alias. */
+	template <typename alphabet_type, typename symbol_type>
+	static void alphabet_shift(const alphabet_type& alphabet, const symbol_type* input, symbol_type* output, std::size_t size, uint32_t amount, bool shift_backwards = false) {
+		const std::size_t alphabet_size = alphabet.size();
+		std::size_t shift = amount % alphabet_size;
+		if (shift_backwards) shift = (alphabet_size - shift) % alphabet_size;
+
+		for (std::size_t i = 0; i < size; i++) {
+			bool uppercase = false;
+			int32_t index = alphabet.locate(static_cast<uint32_t>(input[i]), uppercase);
+			if (index < 0) {
+				output[i] = input[i];
+				continue;
 			}
 
-			shifted_data.push_back(target_alphabet->at(shifted_index));
+			std::size_t shifted = index + shift;
+			if (shifted >= alphabet_size) shifted -= alphabet_size;
+			output[i] = static_cast<symbol_type>(alphabet.symbol_at(shifted, uppercase));
 		}
+	}
+
+	static std::vector<uint32_t> alphabet_shift(const Alphabet& alphabet, std::vector<uint32_t> data, uint32_t amount, bool shift_backwards = false) {
+		alphabet_shift(alphabet, data.data(), data.data(), data.size(), amount, shift_backwards);
+		return data;
+	}
+
+	static std::string caesar_shift(std::string data, uint32_t amount, bool shift_backwards=false) {
+		CIPHERS_METRICS_SCOPE("caesar", shift_backwards ? "decode" : "encode", data.size());
+		return shift_table(amount, shift_backwards).apply(data);
+	}
+
+	/* Shifts the latin letters of input into output, every other byte is copied unchanged. Input and output may alias. */
+	static void caesar_shift(const uint8_t* input, uint8_t* output, std::size_t size, uint32_t amount, bool shift_backwards = false) {
+		CIPHERS_METRICS_SCOPE("caesar", shift_backwards ? "decode" : "encode", size);
+		shift_table(amount, shift_backwards).apply(input, output, size);
+	}
 
-		return shifted_data;
+	/* Span form of the above, output must be at least as large as input */
+	static void caesar_shift(Span<const uint8_t> input, Span<uint8_t> output, uint32_t amount, bool shift_backwards = false) {
+		CIPHERS_METRICS_SCOPE("caesar", shift_backwards ? "decode" : "encode", input.size());
+		require_output(output, input.size());
+		shift_table(amount, shift_backwards).apply(input.data(), output.data(), input.size());
 	}
 
-	static std::string rot13(std::string data) { return caesar_shift(data, 13); }
+	static std::string rot13(std::string data) {
+		CIPHERS_METRICS_SCOPE("rot13", "apply", data.size());
+		return rot13_table().apply(data);
+	}
+
+	static void rot13(Span<const uint8_t> input, Span<uint8_t> output) {
+		CIPHERS_METRICS_SCOPE("rot13", "apply", input.size());
+		require_output(output, input.size());
+		rot13_table().apply(input.data(), output.data(), input.size());
+	}
+
+private:
+	static const TranslationTable& rot13_table() {
+		static constexpr TranslationTable table = shift_table(13);
+		return table;
+	}
 
-};
\ No newline at end of file
+};
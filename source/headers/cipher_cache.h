@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "vigenere.h"
+#include "polybius.h"
+#include "xor.h"
+
+/* Thread safe least recently used cache of compiled ciphers, for callers that only hold raw keys.
+Entries are shared, so one that gets evicted stays valid for anyone still holding it. */
+class CipherCache {
+public:
+	enum class Cipher : uint8_t { Vigenere, Polybius, Xor };
+
+	explicit CipherCache(std::size_t capacity = 256) : capacity(capacity == 0 ? 1 : capacity) {}
+
+	/* Cache used by callers that do not manage their own */
+	static CipherCache& shared() {
+		static CipherCache cache;
+		return cache;
+	}
+
+	std::shared_ptr<const CompiledVigenere> vigenere(const std::string& key, bool preserve_case = true) {
+		return lookup<CompiledVigenere>(Cipher::Vigenere, key, preserve_case ? "latin" : "latin-lower", '\0', [&] {
+			return std::make_shared<const CompiledVigenere>(key, preserve_case);
+		});
+	}
+
+	std::shared_ptr<const CompiledPolybius> polybius(const std::string& key, int8_t sacrifice = '\0') {
+		return lookup<CompiledPolybius>(Cipher::Polybius, key, "latin", sacrifice, [&] {
+			return std::make_shared<const CompiledPolybius>(key, sacrifice);
+		});
+	}
+
+	std::shared_ptr<const CompiledXor> xor_key(const std::string& key) {
+		return lookup<CompiledXor>(Cipher::Xor, key, "", '\0', [&] {
+			return std::make_shared<const CompiledXor>(key);
+		});
+	}
+
+	std::size_t size() {
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		return entries.size();
+	}
+
+	void clear() {
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		entries.clear();
+		index.clear();
+	}
+
+private:
+	struct Entry {
+		std::string cache_key;
+		std::shared_ptr<const void> compiled;
+	};
+
+	/* (cipher, alphabet, sacrifice, key) flattened into one string, the key goes last so it may hold any byte */
+	static std::string make_cache_key(Cipher cipher, const std::string& key, const std::string& alphabet, int8_t sacrifice) {
+		std::string cache_key;
+		cache_key.reserve(key.size() + alphabet.size() + 4);
+		cache_key.push_back(static_cast<char>(cipher));
+		cache_key.push_back(static_cast<char>(sacrifice));
+		cache_key.append(alphabet);
+		cache_key.push_back('\0');
+		cache_key.append(key);
+		return cache_key;
+	}
+
+	/* Compiling happens outside the lock so a slow key schedule never blocks other lookups,
+	if two threads race on the same key the first one to finish wins and the other result is dropped. */
+	template <typename compiled_type, typename factory_type>
+	std::shared_ptr<const compiled_type> lookup(Cipher cipher, const std::string& key, const std::string& alphabet, int8_t sacrifice, factory_type build) {
+		std::string cache_key = make_cache_key(cipher, key, alphabet, sacrifice);
+
+		{
+			std::lock_guard<std::mutex> lock(cache_mutex);
+			auto iterator = index.find(cache_key);
+			if (iterator != index.end()) {
+				entries.splice(entries.begin(), entries, iterator->second);
+				return std::static_pointer_cast<const compiled_type>(iterator->second->compiled);
+			}
+		}
+
+		std::shared_ptr<const compiled_type> compiled = build();
+
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		auto iterator = index.find(cache_key);
+		if (iterator != index.end()) {
+			entries.splice(entries.begin(), entries, iterator->second);
+			return std::static_pointer_cast<const compiled_type>(iterator->second->compiled);
+		}
+
+		entries.push_front(Entry{ cache_key, compiled });
+		index.emplace(std::move(cache_key), entries.begin());
+
+		while (entries.size() > capacity) {
+			index.erase(entries.back().cache_key);
+			entries.pop_back();
+		}
+
+		return compiled;
+	}
+
+	std::size_t capacity;
+	std::list<Entry> entries;
+	std::unordered_map<std::string, std::list<Entry>::iterator> index;
+	std::mutex cache_mutex;
+};
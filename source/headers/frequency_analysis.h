@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "alphabet.h"
+#include "language_model.h"
+#include "metrics.h"
+#include "parallel.h"
+#include "caesar.h"
+#include "atbash.h"
+
+/* Occurrences of every byte value. Counts go through four interleaved sub-tables so consecutive equal
+bytes do not wait on each other's increments, which is what limits a plain counting loop. Histograms
+of separate chunks merge by addition, so large inputs are counted in pieces and across threads. */
+class ByteHistogram {
+public:
+	uint64_t counts[256];
+
+	ByteHistogram() : counts{} {}
+
+	void add(const uint8_t* data, std::size_t size) {
+		/* 32 bit sub-counters are flushed before any of them can overflow */
+		const std::size_t block_size = std::size_t(1) << 30;
+
+		while (size > 0) {
+			std::size_t block = std::min(size, block_size);
+			uint32_t lanes[4][256];
+			std::memset(lanes, 0, sizeof(lanes));
+
+			std::size_t i = 0;
+			for (; i + 8 <= block; i += 8) {
+				uint64_t word;
+				std::memcpy(&word, data + i, 8);
+				lanes[0][word & 0xFF]++;
+				lanes[1][(word >> 8) & 0xFF]++;
+				lanes[2][(word >> 16) & 0xFF]++;
+				lanes[3][(word >> 24) & 0xFF]++;
+				lanes[0][(word >> 32) & 0xFF]++;
+				lanes[1][(word >> 40) & 0xFF]++;
+				lanes[2][(word >> 48) & 0xFF]++;
+				lanes[3][word >> 56]++;
+			}
+			for (; i < block; i++) lanes[0][data[i]]++;
+
+			for (std::size_t value = 0; value < 256; value++)
+				counts[value] += static_cast<uint64_t>(lanes[0][value]) + lanes[1][value] + lanes[2][value] + lanes[3][value];
+
+			data += block;
+			size -= block;
+		}
+	}
+
+	void merge(const ByteHistogram& other) {
+		for (std::size_t value = 0; value < 256; value++) counts[value] += other.counts[value];
+	}
+
+	uint64_t total() const {
+		uint64_t sum = 0;
+		for (uint64_t count : counts) sum += count;
+		return sum;
+	}
+
+	/* Counts per alphabet index, with both cases of a symbol landing on the same index */
+	template <std::size_t alphabet_size>
+	std::vector<uint64_t> fold(const ByteAlphabet<alphabet_size>& alphabet) const {
+		std::vector<uint64_t> folded(alphabet_size, 0);
+		for (std::size_t value = 0; value < 256; value++) {
+			int32_t index = alphabet.index_of(static_cast<uint32_t>(value));
+			if (index >= 0) folded[index] += counts[value];
+		}
+		return folded;
+	}
+
+	/* Histogram of a buffer, counted chunk by chunk across the pool */
+	static ByteHistogram count(const uint8_t* data, std::size_t size, const ParallelOptions& options = ParallelOptions()) {
+		std::size_t chunk_size = options.chunk_size == 0 ? size : options.chunk_size;
+		std::size_t chunk_count = chunk_size == 0 ? 0 : (size + chunk_size - 1) / chunk_size;
+
+		ByteHistogram histogram;
+		if (chunk_count <= 1) {
+			histogram.add(data, size);
+			return histogram;
+		}
+
+		std::vector<ByteHistogram> partials(chunk_count);
+		Parallel::for_each_chunk(size, options, [&](std::size_t begin, std::size_t end) {
+			partials[begin / chunk_size].add(data + begin, end - begin);
+		});
+
+		for (const ByteHistogram& partial : partials) histogram.merge(partial);
+		return histogram;
+	}
+
+	/* Histogram of a whole stream in one pass, reading buffer_size bytes at a time and counting every
+	buffer across the pool, so memory use stays flat however large the input is */
+	static ByteHistogram count(std::istream& stream, const ParallelOptions& options = ParallelOptions(), std::size_t buffer_size = std::size_t(16) << 20) {
+		std::vector<uint8_t> buffer(buffer_size == 0 ? 1 : buffer_size);
+		ByteHistogram histogram;
+
+		while (stream) {
+			stream.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+			std::size_t received = static_cast<std::size_t>(stream.gcount());
+			if (received == 0) break;
+
+			histogram.merge(count(buffer.data(), received, options));
+		}
+
+		return histogram;
+	}
+};
+
+/* Recovers the key of monoalphabetic ciphertext from letter frequencies alone. Every Caesar shift and
+Atbash is tried against a language model with the chi-squared statistic, which only needs the letter
+histogram of the ciphertext, so the cost of scoring is independent of the input size. */
+class FrequencyAnalysis {
+public:
+	enum class Cipher { Caesar, Atbash };
+
+	struct Candidate {
+		Cipher cipher;
+
+		/* Amount the plaintext was shifted by, decode with caesar_shift(data, shift, true). Zero for Atbash. */
+		uint32_t shift;
+
+		/* Lower is a better fit to the model */
+		double chi_squared;
+
+		/* Share of the likelihood among all candidates, the ranked confidences add up to one */
+		double confidence;
+	};
+
+	/* Chi-squared of letter counts against the model, where the plaintext letter at index i was observed
+	as ciphertext letter mapping[i] */
+	static double chi_squared(const std::vector<uint64_t>& letters, const LanguageModel& model, const uint8_t mapping[LanguageModel::letter_count]) {
+		double total = 0;
+		for (uint64_t count : letters) total += static_cast<double>(count);
+		if (total == 0) return 0;
+
+		double statistic = 0;
+		for (std::size_t i = 0; i < LanguageModel::letter_count; i++) {
+			double expected = total * model.probability(i);
+			double difference = static_cast<double>(letters[mapping[i]]) - expected;
+			statistic += difference * difference / expected;
+		}
+
+		return statistic;
+	}
+
+	/* Every Caesar shift and Atbash scored against the model, best first */
+	static std::vector<Candidate> rank(const ByteHistogram& histogram, const LanguageModel& model = LanguageModel::english()) {
+		return rank(histogram.fold(Alphabets::latin()), model);
+	}
+
+	/* Same over letter counts in alphabet order, Atbash can be left out when only shifts are possible */
+	static std::vector<Candidate> rank(const std::vector<uint64_t>& letters, const LanguageModel& model, bool include_atbash = true) {
+		std::vector<Candidate> candidates;
+		uint8_t mapping[LanguageModel::letter_count];
+
+		for (uint32_t shift = 0; shift < LanguageModel::letter_count; shift++) {
+			for (std::size_t i = 0; i < LanguageModel::letter_count; i++) mapping[i] = static_cast<uint8_t>((i + shift) % LanguageModel::letter_count);
+			candidates.push_back({ Cipher::Caesar, shift, chi_squared(letters, model, mapping), 0 });
+		}
+
+		if (include_atbash) {
+			for (std::size_t i = 0; i < LanguageModel::letter_count; i++) mapping[i] = static_cast<uint8_t>(LanguageModel::letter_count - 1 - i);
+			candidates.push_back({ Cipher::Atbash, 0, chi_squared(letters, model, mapping), 0 });
+		}
+
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.chi_squared < b.chi_squared; });
+
+		/* Chi-squared is minus twice the log likelihood up to a constant, so exp(-chi / 2) weighs
+		the candidates against each other. Measured from the best one to stay in range. */
+		double weight_sum = 0;
+		for (Candidate& candidate : candidates) {
+			candidate.confidence = std::exp(-(candidate.chi_squared - candidates.front().chi_squared) / 2);
+			weight_sum += candidate.confidence;
+		}
+		for (Candidate& candidate : candidates) candidate.confidence /= weight_sum;
+
+		return candidates;
+	}
+
+	static std::vector<Candidate> crack(const uint8_t* data, std::size_t size, const LanguageModel& model = LanguageModel::english(), const ParallelOptions& options = ParallelOptions()) {
+		CIPHERS_METRICS_SCOPE("analysis", "caesar", size);
+		return rank(ByteHistogram::count(data, size, options), model);
+	}
+
+	static std::vector<Candidate> crack(const std::string& data, const LanguageModel& model = LanguageModel::english(), const ParallelOptions& options = ParallelOptions()) {
+		return crack(reinterpret_cast<const uint8_t*>(data.data()), data.size(), model, options);
+	}
+
+	static std::vector<Candidate> crack(std::istream& stream, const LanguageModel& model = LanguageModel::english(), const ParallelOptions& options = ParallelOptions()) {
+		return rank(ByteHistogram::count(stream, options), model);
+	}
+
+	/* Best candidate among several models, for input of unknown language */
+	static Candidate best_of(const ByteHistogram& histogram, const std::vector<const LanguageModel*>& models, const LanguageModel** matched_model = nullptr) {
+		Candidate best = { Cipher::Caesar, 0, std::numeric_limits<double>::infinity(), 0 };
+		for (const LanguageModel* model : models) {
+			Candidate candidate = rank(histogram, *model).front();
+			if (candidate.chi_squared < best.chi_squared) {
+				best = candidate;
+				if (matched_model != nullptr) *matched_model = model;
+			}
+		}
+		return best;
+	}
+
+	/* Undoes the candidate's cipher on the data */
+	static std::string decode(const Candidate& candidate, std::string data) {
+		if (candidate.cipher == Cipher::Atbash) return Atbash::atbash_apply(std::move(data));
+		return Caesar::caesar_shift(std::move(data), candidate.shift, true);
+	}
+
+	static void decode(const Candidate& candidate, const uint8_t* input, uint8_t* output, std::size_t size) {
+		if (candidate.cipher == Cipher::Atbash) Atbash::atbash_apply(input, output, size);
+		else Caesar::caesar_shift(input, output, size, candidate.shift, true);
+	}
+};
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "alphabet.h"
+
+/* Expected letter distribution of a language over the latin alphabet, the yardstick frequency analysis
+measures candidate plaintexts against. Models are plain data, so any corpus or language can be plugged
+in through from_counts or from_text next to the built in ones. */
+class LanguageModel {
+public:
+	class EmptyModelException : public std::runtime_error {
+	public: EmptyModelException() : std::runtime_error("A language model needs one weight for every letter of the alphabet.") {}
+	};
+
+	static const std::size_t letter_count = 26;
+
+	/* Weights in alphabet order, normalized to probabilities. Letters the model never saw still get
+	a small probability so that no ciphertext is ruled out entirely. */
+	LanguageModel(std::string name, const std::vector<double>& weights) : model_name(std::move(name)), letter_probabilities(letter_count) {
+		if (weights.size() != letter_count) throw EmptyModelException();
+
+		double total = 0;
+		for (double weight : weights) total += weight > 0 ? weight : 0;
+		if (total <= 0) throw EmptyModelException();
+
+		const double minimum_probability = 1e-5;
+		for (std::size_t i = 0; i < letter_count; i++) {
+			double probability = weights[i] > 0 ? weights[i] / total : 0;
+			letter_probabilities[i] = probability > minimum_probability ? probability : minimum_probability;
+		}
+	}
+
+	static LanguageModel from_counts(std::string name, const uint64_t counts[letter_count]) {
+		return LanguageModel(std::move(name), std::vector<double>(counts, counts + letter_count));
+	}
+
+	/* Model learned from a sample of the language, case is folded and everything else is ignored */
+	static LanguageModel from_text(std::string name, const std::string& sample) {
+		uint64_t counts[letter_count] = {};
+		const Alphabets::Latin& latin = Alphabets::latin();
+		for (char character : sample) {
+			int32_t index = latin.index_of(static_cast<uint8_t>(character));
+			if (index >= 0) counts[index]++;
+		}
+
+		return from_counts(std::move(name), counts);
+	}
+
+	/* Letter frequencies in percent from large corpora of each language */
+	static const LanguageModel& english() {
+		static const LanguageModel model("english", {
+			8.167, 1.492, 2.782, 4.253, 12.702, 2.228, 2.015, 6.094, 6.966, 0.153, 0.772, 4.025, 2.406,
+			6.749, 7.507, 1.929, 0.095, 5.987, 6.327, 9.056, 2.758, 0.978, 2.360, 0.150, 1.974, 0.074 });
+		return model;
+	}
+
+	static const LanguageModel& german() {
+		static const LanguageModel model("german", {
+			6.516, 1.886, 2.732, 5.076, 16.396, 1.656, 3.009, 4.577, 6.550, 0.268, 1.417, 3.437, 2.534,
+			9.776, 2.594, 0.670, 0.018, 7.003, 7.270, 6.154, 4.166, 0.846, 1.921, 0.034, 0.039, 1.134 });
+		return model;
+	}
+
+	static const LanguageModel& french() {
+		static const LanguageModel model("french", {
+			7.636, 0.901, 3.260, 3.669, 14.715, 1.066, 0.866, 0.737, 7.529, 0.613, 0.074, 5.456, 2.968,
+			7.095, 5.796, 2.521, 1.362, 6.693, 7.948, 7.244, 6.311, 1.838, 0.049, 0.427, 0.128, 0.326 });
+		return model;
+	}
+
+	static const LanguageModel& spanish() {
+		static const LanguageModel model("spanish", {
+			11.525, 2.215, 4.019, 5.010, 12.181, 0.692, 1.768, 0.703, 6.247, 0.493, 0.011, 4.967, 3.157,
+			6.712, 8.683, 2.510, 0.877, 6.871, 7.977, 4.632, 2.927, 1.138, 0.017, 0.215, 1.008, 0.467 });
+		return model;
+	}
+
+	const std::string& name() const { return model_name; }
+
+	/* Probability of the letter at the given alphabet index */
+	double probability(std::size_t index) const { return letter_probabilities[index]; }
+	const std::vector<double>& probabilities() const { return letter_probabilities; }
+
+	/* Sum of squared probabilities, the index of coincidence of text in this language */
+	double coincidence() const {
+		double sum = 0;
+		for (double probability : letter_probabilities) sum += probability * probability;
+		return sum;
+	}
+
+private:
+	std::string model_name;
+	std::vector<double> letter_probabilities;
+};
+
+/* Log probabilities of every run of order consecutive letters, stored flat and indexed by the run's
+base 26 value so that scoring a candidate plaintext costs one load per letter. Runs are counted over
+the letters of a sample with everything else dropped, the way ciphers such as Polybius leave their
+plaintext. Runs the sample never had get a floor below the rarest one it had. */
+class NgramModel {
+public:
+	class InvalidModelException : public std::runtime_error {
+	public: InvalidModelException() : std::runtime_error("An n-gram model needs an order between 1 and 5 and a sample with at least that many letters.") {}
+	};
+
+	static const std::size_t letter_count = LanguageModel::letter_count;
+	static const std::size_t max_order = 5;
+
+	/* Counts of every run in base 26 order, 26^order of them */
+	NgramModel(std::string name, std::size_t order, const std::vector<uint64_t>& counts) : model_name(std::move(name)), run_length(order) {
+		if (order == 0 || order > max_order || counts.size() != table_size(order)) throw InvalidModelException();
+
+		uint64_t total = 0;
+		for (uint64_t count : counts) total += count;
+		if (total == 0) throw InvalidModelException();
+
+		const double scale = 1.0 / static_cast<double>(total);
+		floor_value = static_cast<float>(std::log(0.01 * scale));
+		log_probabilities.resize(counts.size());
+		for (std::size_t i = 0; i < counts.size(); i++) {
+			log_probabilities[i] = counts[i] == 0 ? floor_value : static_cast<float>(std::log(static_cast<double>(counts[i]) * scale));
+		}
+	}
+
+	/* Model learned from a sample of the language, case is folded and everything else is ignored */
+	static NgramModel from_text(std::string name, const std::string& sample, std::size_t order = 4) {
+		if (order == 0 || order > max_order) throw InvalidModelException();
+
+		const std::size_t modulus = table_size(order);
+		std::vector<uint64_t> counts(modulus, 0);
+		const Alphabets::Latin& latin = Alphabets::latin();
+		std::size_t run = 0, letters = 0;
+
+		for (char character : sample) {
+			int32_t index = latin.index_of(static_cast<uint8_t>(character));
+			if (index < 0) continue;
+
+			run = (run * letter_count + static_cast<std::size_t>(index)) % modulus;
+			if (++letters >= order) counts[run]++;
+		}
+
+		return NgramModel(std::move(name), order, counts);
+	}
+
+	static std::size_t table_size(std::size_t order) {
+		std::size_t size = 1;
+		for (std::size_t i = 0; i < order; i++) size *= letter_count;
+		return size;
+	}
+
+	const std::string& name() const { return model_name; }
+	std::size_t order() const { return run_length; }
+
+	/* Log probability of the run with the given base 26 value, and that of unseen runs */
+	float log_probability(std::size_t run) const { return log_probabilities[run]; }
+	float floor() const { return floor_value; }
+	const float* table() const { return log_probabilities.data(); }
+
+	/* Sum of the log probabilities of every run in a sequence of alphabet indices */
+	double score(const uint8_t* letters, std::size_t size) const {
+		if (size < run_length) return 0;
+
+		const std::size_t high = table_size(run_length - 1);
+		std::size_t run = 0;
+		for (std::size_t i = 0; i + 1 < run_length; i++) run = run * letter_count + letters[i];
+
+		double total = 0;
+		for (std::size_t i = run_length - 1; i < size; i++) {
+			run = run * letter_count + letters[i];
+			total += log_probabilities[run];
+			run -= letters[i + 1 - run_length] * high;
+		}
+
+		return total;
+	}
+
+private:
+	std::string model_name;
+	std::size_t run_length;
+	float floor_value;
+	std::vector<float> log_probabilities;
+};
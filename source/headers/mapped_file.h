@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* A whole file mapped into memory, so ciphers can run over it in place or from one mapping straight
+into another without copying through read and write buffers. Mappings are shared, writes go to the
+file. Empty files are never mapped, data() is null for them. */
+class MappedFile {
+public:
+	class MappingException : public std::runtime_error {
+	public: explicit MappingException(const std::string& message) : std::runtime_error(message) {}
+	};
+
+	/* Create truncates or creates the file at the size given to the constructor */
+	enum class Access { Read, ReadWrite, Create };
+
+	MappedFile(const std::string& path, Access access, std::size_t create_size = 0) : file_path(path), mapping_access(access) {
+		open(create_size);
+	}
+
+	~MappedFile() {
+		unmap();
+		close_handles();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	uint8_t* data() { return mapped; }
+	const uint8_t* data() const { return mapped; }
+	std::size_t size() const { return mapped_size; }
+
+	/* Tells the kernel the mapping is read front to back, so it reads ahead aggressively and drops
+	pages behind. Windows gets the same hint when the file is opened. */
+	void advise_sequential() {
+#if !defined(_WIN32) && defined(MADV_SEQUENTIAL)
+		if (mapped != nullptr) madvise(mapped, mapped_size, MADV_SEQUENTIAL);
+#endif
+	}
+
+	/* Unmaps and closes the file, cutting it to final_size first when that is shorter, for ciphers
+	whose output is smaller than their input */
+	void close(std::size_t final_size) {
+		unmap();
+
+		if (final_size < mapped_size && mapping_access != Access::Read) {
+#if defined(_WIN32)
+			LARGE_INTEGER position;
+			position.QuadPart = static_cast<LONGLONG>(final_size);
+			if (!SetFilePointerEx(file_handle, position, nullptr, FILE_BEGIN) || !SetEndOfFile(file_handle)) fail("truncate");
+#else
+			if (ftruncate(descriptor, static_cast<off_t>(final_size)) != 0) fail("truncate");
+#endif
+		}
+
+		mapped_size = final_size < mapped_size ? final_size : mapped_size;
+		close_handles();
+	}
+
+	/* Only regular files can be mapped, pipes, terminals and devices have to be streamed */
+	static bool mappable(const std::string& path) {
+#if defined(_WIN32)
+		DWORD attributes = GetFileAttributesA(path.c_str());
+		return attributes != INVALID_FILE_ATTRIBUTES && (attributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE)) == 0;
+#else
+		struct stat status;
+		return stat(path.c_str(), &status) == 0 && S_ISREG(status.st_mode);
+#endif
+	}
+
+	/* True when both paths lead to the same file however they are spelled, through ./, symbolic links
+	or hard links alike. False when either of them does not exist. */
+	static bool same_file(const std::string& first, const std::string& second) {
+#if defined(_WIN32)
+		BY_HANDLE_FILE_INFORMATION first_identity, second_identity;
+		return file_identity(first, first_identity) && file_identity(second, second_identity)
+			&& first_identity.dwVolumeSerialNumber == second_identity.dwVolumeSerialNumber
+			&& first_identity.nFileIndexHigh == second_identity.nFileIndexHigh
+			&& first_identity.nFileIndexLow == second_identity.nFileIndexLow;
+#else
+		struct stat first_status, second_status;
+		return stat(first.c_str(), &first_status) == 0 && stat(second.c_str(), &second_status) == 0
+			&& first_status.st_dev == second_status.st_dev && first_status.st_ino == second_status.st_ino;
+#endif
+	}
+
+private:
+	std::string file_path;
+	Access mapping_access;
+	uint8_t* mapped = nullptr;
+	std::size_t mapped_size = 0;
+
+#if defined(_WIN32)
+	HANDLE file_handle = INVALID_HANDLE_VALUE;
+	HANDLE mapping_handle = nullptr;
+
+	/* Volume serial number and file index, without asking for any access to the file */
+	static bool file_identity(const std::string& path, BY_HANDLE_FILE_INFORMATION& identity) {
+		HANDLE handle = CreateFileA(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+		if (handle == INVALID_HANDLE_VALUE) return false;
+
+		bool found = GetFileInformationByHandle(handle, &identity) != 0;
+		CloseHandle(handle);
+		return found;
+	}
+
+	void open(std::size_t create_size) {
+		DWORD desired = mapping_access == Access::Read ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE;
+		DWORD disposition = mapping_access == Access::Create ? CREATE_ALWAYS : OPEN_EXISTING;
+		file_handle = CreateFileA(file_path.c_str(), desired, FILE_SHARE_READ, nullptr, disposition, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file_handle == INVALID_HANDLE_VALUE) fail("open");
+
+		if (mapping_access == Access::Create) {
+			mapped_size = create_size;
+		} else {
+			LARGE_INTEGER file_size;
+			if (!GetFileSizeEx(file_handle, &file_size)) fail("stat");
+			mapped_size = static_cast<std::size_t>(file_size.QuadPart);
+		}
+
+		if (mapped_size == 0) return;
+
+		DWORD protection = mapping_access == Access::Read ? PAGE_READONLY : PAGE_READWRITE;
+		uint64_t size = static_cast<uint64_t>(mapped_size);
+		mapping_handle = CreateFileMappingA(file_handle, nullptr, protection, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+		if (mapping_handle == nullptr) fail("map");
+
+		mapped = static_cast<uint8_t*>(MapViewOfFile(mapping_handle, mapping_access == Access::Read ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, mapped_size));
+		if (mapped == nullptr) fail("map");
+	}
+
+	void unmap() {
+		if (mapped != nullptr) UnmapViewOfFile(mapped);
+		if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+		mapped = nullptr;
+		mapping_handle = nullptr;
+	}
+
+	void close_handles() {
+		if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+		file_handle = INVALID_HANDLE_VALUE;
+	}
+
+	void fail(const char* operation) {
+		DWORD error = GetLastError();
+		unmap();
+		close_handles();
+		throw MappingException("Could not " + std::string(operation) + " " + file_path + " (error " + std::to_string(error) + ").");
+	}
+#else
+	int descriptor = -1;
+
+	void open(std::size_t create_size) {
+		int flags = mapping_access == Access::Read ? O_RDONLY : mapping_access == Access::ReadWrite ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC;
+		descriptor = ::open(file_path.c_str(), flags, 0644);
+		if (descriptor < 0) fail("open");
+
+		if (mapping_access == Access::Create) {
+			if (ftruncate(descriptor, static_cast<off_t>(create_size)) != 0) fail("resize");
+			mapped_size = create_size;
+		} else {
+			struct stat status;
+			if (fstat(descriptor, &status) != 0) fail("stat");
+			mapped_size = static_cast<std::size_t>(status.st_size);
+		}
+
+		if (mapped_size == 0) return;
+
+		int protection = mapping_access == Access::Read ? PROT_READ : PROT_READ | PROT_WRITE;
+		void* address = mmap(nullptr, mapped_size, protection, MAP_SHARED, descriptor, 0);
+		if (address == MAP_FAILED) fail("map");
+		mapped = static_cast<uint8_t*>(address);
+	}
+
+	void unmap() {
+		if (mapped != nullptr) munmap(mapped, mapped_size);
+		mapped = nullptr;
+	}
+
+	void close_handles() {
+		if (descriptor >= 0) ::close(descriptor);
+		descriptor = -1;
+	}
+
+	void fail(const char* operation) {
+		int error = errno;
+		unmap();
+		close_handles();
+		throw MappingException("Could not " + std::string(operation) + " " + file_path + ": " + std::strerror(error));
+	}
+#endif
+};
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/* Instrumentation of the cipher entry points, compiled in only when CIPHERS_ENABLE_METRICS is
+defined. Without it CIPHERS_METRICS_SCOPE expands to nothing and the ciphers carry no trace of it.
+
+With it every entry point records calls, bytes, heap allocations and a latency histogram under a
+cipher and mode name. Each thread writes its own counters, which only it ever writes, so recording
+takes no locks and no atomic read-modify-writes. Metrics::snapshot adds up every thread's counters
+when asked and writes them as JSON or in the Prometheus text format. Entry points that call other
+entry points are recorded at both. */
+#if defined(CIPHERS_ENABLE_METRICS)
+#define CIPHERS_METRICS_SCOPE(cipher, mode, bytes) Metrics::Scope ciphers_metrics_scope(cipher, mode, static_cast<uint64_t>(bytes))
+#else
+#define CIPHERS_METRICS_SCOPE(cipher, mode, bytes) ((void)0)
+#endif
+
+class Metrics {
+public:
+	/* Distinct cipher and mode pairs, pairs past this are not recorded */
+	static const std::size_t max_series = 128;
+
+	/* Bucket b counts calls that took less than 2^(b + 7) ns, the last one everything slower */
+	static const std::size_t histogram_buckets = 28;
+
+	struct Series {
+		std::string cipher;
+		std::string mode;
+		uint64_t calls = 0;
+		uint64_t bytes = 0;
+		uint64_t allocations = 0;
+		uint64_t nanoseconds = 0;
+		uint64_t buckets[histogram_buckets] = {};
+	};
+
+	struct Snapshot {
+		std::vector<Series> series;
+
+		void write_json(std::ostream& stream) const {
+			stream << "{\n  \"enabled\": " << (enabled() ? "true" : "false") << ",\n  \"latency_bounds_ns\": [";
+			for (std::size_t b = 0; b + 1 < histogram_buckets; b++) stream << (b == 0 ? "" : ", ") << bucket_bound(b);
+			stream << "],\n  \"series\": [\n";
+
+			for (std::size_t i = 0; i < series.size(); i++) {
+				const Series& entry = series[i];
+				stream << "    {\"cipher\": \"" << entry.cipher << "\", \"mode\": \"" << entry.mode << "\", \"calls\": " << entry.calls
+					<< ", \"bytes\": " << entry.bytes << ", \"allocations\": " << entry.allocations << ", \"nanoseconds\": " << entry.nanoseconds
+					<< ", \"latency_histogram\": [";
+				for (std::size_t b = 0; b < histogram_buckets; b++) stream << (b == 0 ? "" : ", ") << entry.buckets[b];
+				stream << "]}" << (i + 1 == series.size() ? "" : ",") << "\n";
+			}
+
+			stream << "  ]\n}" << std::endl;
+		}
+
+		/* Counters plus a cumulative latency histogram in seconds, as Prometheus expects them */
+		void write_prometheus(std::ostream& stream) const {
+			write_family(stream, "ciphers_calls_total", "Calls into each cipher entry point.", [](const Series& entry) { return entry.calls; });
+			write_family(stream, "ciphers_bytes_total", "Bytes of input processed.", [](const Series& entry) { return entry.bytes; });
+			write_family(stream, "ciphers_allocations_total", "Heap allocations made during calls.", [](const Series& entry) { return entry.allocations; });
+
+			stream << "# HELP ciphers_latency_seconds Time spent in each call.\n# TYPE ciphers_latency_seconds histogram\n";
+			for (const Series& entry : series) {
+				std::string labels = "cipher=\"" + entry.cipher + "\",mode=\"" + entry.mode + "\"";
+				uint64_t cumulative = 0;
+
+				for (std::size_t b = 0; b < histogram_buckets; b++) {
+					cumulative += entry.buckets[b];
+					char bound[32];
+					if (b + 1 == histogram_buckets) std::strcpy(bound, "+Inf");
+					else std::snprintf(bound, sizeof(bound), "%g", static_cast<double>(bucket_bound(b)) * 1e-9);
+					stream << "ciphers_latency_seconds_bucket{" << labels << ",le=\"" << bound << "\"} " << cumulative << "\n";
+				}
+
+				char sum[32];
+				std::snprintf(sum, sizeof(sum), "%.9f", static_cast<double>(entry.nanoseconds) * 1e-9);
+				stream << "ciphers_latency_seconds_sum{" << labels << "} " << sum << "\n";
+				stream << "ciphers_latency_seconds_count{" << labels << "} " << entry.calls << "\n";
+			}
+		}
+
+	private:
+		template <typename value_function>
+		void write_family(std::ostream& stream, const char* name, const char* help, value_function value) const {
+			stream << "# HELP " << name << " " << help << "\n# TYPE " << name << " counter\n";
+			for (const Series& entry : series) stream << name << "{cipher=\"" << entry.cipher << "\",mode=\"" << entry.mode << "\"} " << value(entry) << "\n";
+		}
+	};
+
+	static constexpr bool enabled() {
+#if defined(CIPHERS_ENABLE_METRICS)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	static constexpr uint64_t bucket_bound(std::size_t bucket) { return uint64_t(1) << (bucket + 7); }
+
+	/* Totals of every series recorded so far, by every thread including those that have exited */
+	static Snapshot snapshot() {
+		Registry& state = registry();
+		std::lock_guard<std::mutex> lock(state.mutex);
+
+		Snapshot result;
+		result.series = state.retired;
+		for (ThreadStore* store : state.stores) store->add_to(result.series);
+		return result;
+	}
+
+	/* Heap allocations made by the calling thread, bumped by the global operator new of executables
+	that count them, see main.cpp */
+	static uint64_t& thread_allocations() {
+		static thread_local uint64_t count = 0;
+		return count;
+	}
+
+private:
+	struct ThreadStore;
+
+	/* Written by the owning thread alone with plain loads and stores, read by snapshot */
+	struct Counters {
+		std::atomic<uint64_t> calls{ 0 };
+		std::atomic<uint64_t> bytes{ 0 };
+		std::atomic<uint64_t> allocations{ 0 };
+		std::atomic<uint64_t> nanoseconds{ 0 };
+		std::atomic<uint64_t> buckets[histogram_buckets];
+
+		Counters() {
+			for (std::atomic<uint64_t>& bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	/* Names of every series and the stores of the running threads. Never destroyed, threads can
+	still exit and fold their counters in after static destruction has begun. */
+	struct Registry {
+		std::mutex mutex;
+		std::vector<std::pair<std::string, std::string>> names;
+		std::vector<ThreadStore*> stores;
+		std::vector<Series> retired;
+	};
+
+	static Registry& registry() {
+		static Registry* state = new Registry();
+		return *state;
+	}
+
+	/* Series are looked up by the addresses of their name literals, through a small cache in front of
+	the registry so that the mutex is only taken the first time a thread meets a series */
+	struct ThreadStore {
+		static const std::size_t cache_size = 256;
+
+		struct CacheEntry {
+			const char* cipher = nullptr;
+			const char* mode = nullptr;
+			std::size_t series = 0;
+		};
+
+		Counters counters[max_series];
+		CacheEntry cache[cache_size];
+
+		ThreadStore() {
+			Registry& state = registry();
+			std::lock_guard<std::mutex> lock(state.mutex);
+			state.stores.push_back(this);
+		}
+
+		~ThreadStore() {
+			Registry& state = registry();
+			std::lock_guard<std::mutex> lock(state.mutex);
+			add_to(state.retired);
+			for (std::size_t i = 0; i < state.stores.size(); i++) {
+				if (state.stores[i] != this) continue;
+				state.stores[i] = state.stores.back();
+				state.stores.pop_back();
+				break;
+			}
+		}
+
+		std::size_t lookup(const char* cipher, const char* mode) {
+			std::size_t slot = ((reinterpret_cast<uintptr_t>(cipher) >> 3) * 31 + (reinterpret_cast<uintptr_t>(mode) >> 3)) % cache_size;
+
+			for (std::size_t probe = 0; probe < cache_size; probe++) {
+				CacheEntry& entry = cache[(slot + probe) % cache_size];
+				if (entry.cipher == cipher && entry.mode == mode) return entry.series;
+				if (entry.cipher != nullptr) continue;
+
+				entry.cipher = cipher;
+				entry.mode = mode;
+				entry.series = register_series(cipher, mode);
+				return entry.series;
+			}
+
+			return register_series(cipher, mode);
+		}
+
+		void record(std::size_t series, uint64_t bytes, uint64_t allocations, uint64_t elapsed) {
+			Counters& target = counters[series];
+			std::size_t bucket = 0;
+			while (bucket + 1 < histogram_buckets && elapsed >= bucket_bound(bucket)) bucket++;
+
+			bump(target.calls, 1);
+			bump(target.bytes, bytes);
+			bump(target.allocations, allocations);
+			bump(target.nanoseconds, elapsed);
+			bump(target.buckets[bucket], 1);
+		}
+
+		/* Registry mutex held by the caller */
+		void add_to(std::vector<Series>& totals) const {
+			const std::vector<std::pair<std::string, std::string>>& names = registry().names;
+
+			for (std::size_t i = 0; i < names.size(); i++) {
+				if (totals.size() <= i) {
+					totals.emplace_back();
+					totals.back().cipher = names[i].first;
+					totals.back().mode = names[i].second;
+				}
+
+				Series& total = totals[i];
+				total.calls += counters[i].calls.load(std::memory_order_relaxed);
+				total.bytes += counters[i].bytes.load(std::memory_order_relaxed);
+				total.allocations += counters[i].allocations.load(std::memory_order_relaxed);
+				total.nanoseconds += counters[i].nanoseconds.load(std::memory_order_relaxed);
+				for (std::size_t b = 0; b < histogram_buckets; b++) total.buckets[b] += counters[i].buckets[b].load(std::memory_order_relaxed);
+			}
+		}
+
+		static void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+			counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+		}
+
+		static std::size_t register_series(const char* cipher, const char* mode) {
+			Registry& state = registry();
+			std::lock_guard<std::mutex> lock(state.mutex);
+
+			for (std::size_t i = 0; i < state.names.size(); i++) {
+				if (state.names[i].first == cipher && state.names[i].second == mode) return i;
+			}
+
+			if (state.names.size() == max_series) return max_series;
+			state.names.emplace_back(cipher, mode);
+			return state.names.size() - 1;
+		}
+	};
+
+	/* Allocated the first time a thread records, so threads that never call a cipher cost nothing */
+	static ThreadStore& thread_store() {
+		static thread_local std::unique_ptr<ThreadStore> store;
+		if (!store) store.reset(new ThreadStore());
+		return *store;
+	}
+
+public:
+	/* Records one call from construction to destruction, see CIPHERS_METRICS_SCOPE */
+	class Scope {
+	public:
+		Scope(const char* cipher, const char* mode, uint64_t bytes)
+			: store(thread_store()), series(store.lookup(cipher, mode)), bytes(bytes), allocations(thread_allocations()), start(clock::now()) {}
+
+		~Scope() {
+			uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+			if (series < max_series) store.record(series, bytes, thread_allocations() - allocations, elapsed);
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		using clock = std::chrono::steady_clock;
+
+		ThreadStore& store;
+		std::size_t series;
+		uint64_t bytes;
+		uint64_t allocations;
+		clock::time_point start;
+	};
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "thread_pool.h"
+#include "xor.h"
+#include "caesar.h"
+#include "vigenere.h"
+
+struct ParallelOptions {
+	/* Bytes handed to a worker at a time, inputs no larger than this run on the calling thread */
+	std::size_t chunk_size = 1 << 20;
+
+	/* Pool to run on, the shared pool sized to the hardware when left empty */
+	ThreadPool* pool = nullptr;
+};
+
+/* Splits large buffers into chunks and runs them across a thread pool. Every chunk seeks to its own
+position in the key stream, so the result is identical to running the cipher over the whole buffer. */
+class Parallel {
+public:
+	using Options = ParallelOptions;
+
+	/* XOR against a repeating key, chunk offsets map straight onto key offsets */
+	static std::size_t apply_xor(const uint8_t* input, uint8_t* output, std::size_t size, const uint8_t* key, std::size_t key_size, std::size_t key_offset = 0, const Options& options = Options()) {
+		std::vector<uint8_t> key_buffer = Xor::expand_key(key, key_size);
+		key_offset %= key_size;
+
+		for_each_chunk(size, options, [&](std::size_t begin, std::size_t end) {
+			std::size_t key_index = (key_offset + begin) % key_size;
+			Xor::apply_expanded(input + begin, output + begin, end - begin, key_buffer.data(), key_size, key_index);
+		});
+
+		return static_cast<std::size_t>((key_offset + static_cast<uint64_t>(size)) % key_size);
+	}
+
+	static std::string apply_xor(std::string data, const std::string& key, const Options& options = Options()) {
+		if (data.empty()) return data;
+		uint8_t* bytes = reinterpret_cast<uint8_t*>(&data[0]);
+		apply_xor(bytes, bytes, data.size(), reinterpret_cast<const uint8_t*>(key.data()), key.size(), 0, options);
+		return data;
+	}
+
+	/* Caesar has no key stream at all, every chunk is independent */
+	static void caesar_shift(const uint8_t* input, uint8_t* output, std::size_t size, uint32_t amount, bool shift_backwards = false, const Options& options = Options()) {
+		const TranslationTable table = Caesar::shift_table(amount, shift_backwards);
+		for_each_chunk(size, options, [&](std::size_t begin, std::size_t end) {
+			table.apply(input + begin, output + begin, end - begin);
+		});
+	}
+
+	static std::string caesar_shift(std::string data, uint32_t amount, bool shift_backwards = false, const Options& options = Options()) {
+		if (data.empty()) return data;
+		uint8_t* bytes = reinterpret_cast<uint8_t*>(&data[0]);
+		caesar_shift(bytes, bytes, data.size(), amount, shift_backwards, options);
+		return data;
+	}
+
+	/* The Vigenere key only moves on letters, so a first pass counts the letters of every chunk and
+	the prefix sum of those counts gives each chunk its starting key position for the second pass.
+	The shifts and counts live in the calling thread's arena, every worker builds its key stream in its own. */
+	static std::size_t vigenere_lookup(const uint8_t* input, uint8_t* output, std::size_t size, const uint8_t* key, std::size_t key_size, bool decode_lookup = false, bool preserve_case = true, std::size_t key_position = 0, const Options& options = Options()) {
+		if (key_size == 0) throw Vigenere::ZeroKeyLengthException();
+
+		Arena::Scope scratch;
+		ScratchVector<int32_t> shift_buffer(key_size);
+		Vigenere::key_shifts(key, key_size, shift_buffer.data());
+		const Span<const int32_t> shifts(shift_buffer.data(), shift_buffer.size());
+
+		std::size_t chunk_size = options.chunk_size == 0 ? size : options.chunk_size;
+		std::size_t chunk_count = chunk_size == 0 ? 0 : (size + chunk_size - 1) / chunk_size;
+
+		if (chunk_count <= 1) return Vigenere::vigenere_apply(input, output, size, shifts, key_position, decode_lookup, preserve_case);
+
+		ScratchVector<uint64_t> letters(chunk_count + 1, 0);
+		for_each_chunk(size, options, [&](std::size_t begin, std::size_t end) {
+			letters[begin / chunk_size + 1] = Vigenere::count_letters(input + begin, end - begin);
+		});
+
+		for (std::size_t i = 1; i < letters.size(); i++) letters[i] += letters[i - 1];
+
+		for_each_chunk(size, options, [&](std::size_t begin, std::size_t end) {
+			std::size_t chunk_position = Vigenere::advance_key(shifts, key_position, letters[begin / chunk_size]);
+			Vigenere::vigenere_apply(input + begin, output + begin, end - begin, shifts, chunk_position, decode_lookup, preserve_case);
+		});
+
+		return Vigenere::advance_key(shifts, key_position, letters.back());
+	}
+
+	static std::string vigenere_lookup(std::string data, const std::string& key, bool decode_lookup = false, bool preserve_case = true, const Options& options = Options()) {
+		if (key.empty()) throw Vigenere::ZeroKeyLengthException();
+		if (data.empty()) return data;
+
+		uint8_t* bytes = reinterpret_cast<uint8_t*>(&data[0]);
+		vigenere_lookup(bytes, bytes, data.size(), reinterpret_cast<const uint8_t*>(key.data()), key.size(), decode_lookup, preserve_case, 0, options);
+		return data;
+	}
+
+	/* Calls body(begin, end) for every chunk of [0, size), on the pool when there is more than one */
+	template <typename chunk_function>
+	static void for_each_chunk(std::size_t size, const Options& options, chunk_function body) {
+		if (size == 0) return;
+
+		std::size_t chunk_size = options.chunk_size == 0 ? size : options.chunk_size;
+		std::size_t chunk_count = (size + chunk_size - 1) / chunk_size;
+
+		if (chunk_count == 1) {
+			body(0, size);
+			return;
+		}
+
+		ThreadPool& pool = options.pool != nullptr ? *options.pool : ThreadPool::shared();
+		pool.parallel_for(chunk_count, [&](std::size_t chunk) {
+			std::size_t begin = chunk * chunk_size;
+			body(begin, std::min(begin + chunk_size, size));
+		});
+	}
+};
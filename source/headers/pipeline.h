@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "atbash.h"
+#include "caesar.h"
+#include "metrics.h"
+#include "polybius.h"
+#include "span.h"
+#include "translation_table.h"
+#include "vigenere.h"
+#include "xor.h"
+
+/* Layered scheme such as Vigenere, then XOR, then Polybius, run as one pass over the data. The input
+goes through every stage a block at a time, so each block is still in cache when the next stage
+reads it and no intermediate buffer the size of the input is ever allocated. Monoalphabetic stages
+next to each other (Caesar, ROT13, Atbash, any TranslationTable) are composed into a single table
+when they are added, so a chain of them costs one lookup per byte however long it is. */
+class Pipeline {
+public:
+	/* Bytes every stage runs over before the next stage takes them */
+	static const std::size_t block_size = 1 << 14;
+
+	/* Key position of every stage, carried from one run over a piece of a stream to the next */
+	using State = std::vector<std::size_t>;
+
+	/* Any byte substitution, merged into the stage before it when that is a substitution too */
+	Pipeline& substitute(const TranslationTable& table) {
+		if (!stages.empty() && stages.back().kind == Kind::Table) {
+			stages.back().table = stages.back().table.then(table);
+			return *this;
+		}
+
+		Stage stage;
+		stage.kind = Kind::Table;
+		stage.table = table;
+		stages.push_back(std::move(stage));
+		return *this;
+	}
+
+	Pipeline& caesar(uint32_t amount, bool shift_backwards = false) { return substitute(Caesar::shift_table(amount, shift_backwards)); }
+	Pipeline& rot13() { return substitute(Caesar::shift_table(13)); }
+	Pipeline& atbash() { return substitute(Atbash::atbash_table()); }
+
+	Pipeline& vigenere(const std::string& key, bool decode_lookup = false, bool preserve_case = true) {
+		if (key.empty()) throw Vigenere::ZeroKeyLengthException();
+
+		Stage stage;
+		stage.kind = Kind::Vigenere;
+		stage.decode = decode_lookup;
+		stage.vigenere = std::make_shared<CompiledVigenere>(key, preserve_case);
+		stages.push_back(std::move(stage));
+		return *this;
+	}
+
+	Pipeline& repeating_xor(const std::string& key) {
+		Stage stage;
+		stage.kind = Kind::Xor;
+		stage.repeating_key = std::make_shared<CompiledXor>(key);
+		stages.push_back(std::move(stage));
+		return *this;
+	}
+
+	/* Packed Polybius, see Polybius::encode_packed. Encoding drops everything that is not a letter,
+	so the stages after it see fewer bytes than the stages before it. */
+	Pipeline& polybius(const Polybius::Square& square, bool decode = false) {
+		Stage stage;
+		stage.kind = Kind::Polybius;
+		stage.decode = decode;
+		stage.square = std::make_shared<Polybius::Square>(square);
+		stages.push_back(std::move(stage));
+		return *this;
+	}
+
+	/* Pipeline that runs this one and then next, substitutions meeting at the seam are merged */
+	Pipeline then(const Pipeline& next) const {
+		Pipeline composed(*this);
+		for (const Stage& stage : next.stages) {
+			if (stage.kind == Kind::Table) composed.substitute(stage.table);
+			else composed.stages.push_back(stage);
+		}
+		return composed;
+	}
+
+	/* Pipeline that undoes this one, stages in reverse order with every stage inverted. Substitutions
+	have to be permutations, and Polybius decoding cannot bring back case or dropped characters. */
+	Pipeline inverse() const {
+		Pipeline inverted;
+		for (std::size_t i = stages.size(); i-- > 0;) {
+			Stage stage = stages[i];
+			if (stage.kind == Kind::Table) stage.table = stage.table.inverse();
+			else stage.decode = !stage.decode;
+			inverted.stages.push_back(std::move(stage));
+		}
+		return inverted;
+	}
+
+	std::size_t stage_count() const { return stages.size(); }
+
+	State start() const { return State(stages.size(), 0); }
+
+	/* Runs size bytes through every stage, returns the number of bytes written. Output must hold size
+	bytes, no stage makes its input longer. Input and output may be the same buffer. */
+	std::size_t run(const uint8_t* input, uint8_t* output, std::size_t size, State& state) const {
+		if (state.size() != stages.size()) state.assign(stages.size(), 0);
+		return run_stages(input, output, size, state.data());
+	}
+
+	std::size_t run(const uint8_t* input, uint8_t* output, std::size_t size) const {
+		/* Usual pipelines keep their key positions on the stack, so one-off runs never allocate */
+		std::size_t positions[16] = {};
+		if (stages.size() <= 16) return run_stages(input, output, size, positions);
+
+		State state = start();
+		return run(input, output, size, state);
+	}
+
+	/* Span form, output must be at least as large as input */
+	std::size_t run(Span<const uint8_t> input, Span<uint8_t> output) const {
+		require_output(output, input.size());
+		return run(input.data(), output.data(), input.size());
+	}
+
+	std::string run(std::string data) const {
+		if (!data.empty()) data.resize(run(reinterpret_cast<const uint8_t*>(data.data()), reinterpret_cast<uint8_t*>(&data[0]), data.size()));
+		return data;
+	}
+
+private:
+	std::size_t run_stages(const uint8_t* input, uint8_t* output, std::size_t size, std::size_t* positions) const {
+		CIPHERS_METRICS_SCOPE("pipeline", "run", size);
+		std::size_t written = 0;
+
+		for (std::size_t offset = 0; offset < size; offset += block_size) {
+			std::size_t length = size - offset < block_size ? size - offset : block_size;
+			const uint8_t* source = input + offset;
+			uint8_t* block = output + written;
+
+			/* The first stage reads the input, the others work on the block in the output in place */
+			if (stages.empty() && block != source) std::memmove(block, source, length);
+			for (std::size_t s = 0; s < stages.size(); s++) length = stages[s].apply(s == 0 ? source : block, block, length, positions[s]);
+
+			written += length;
+		}
+
+		return written;
+	}
+
+	enum class Kind { Table, Vigenere, Xor, Polybius };
+
+	/* Keyed stages share their compiled keys between copies of the pipeline. Every stage after the first
+	runs in place on the block, so apply has to accept input and output that are the same buffer. */
+	struct Stage {
+		Kind kind = Kind::Table;
+		bool decode = false;
+		TranslationTable table;
+		std::shared_ptr<const CompiledVigenere> vigenere;
+		std::shared_ptr<const CompiledXor> repeating_key;
+		std::shared_ptr<const Polybius::Square> square;
+
+		std::size_t apply(const uint8_t* input, uint8_t* output, std::size_t size, std::size_t& position) const {
+			switch (kind) {
+			case Kind::Table:
+				table.apply(input, output, size);
+				return size;
+			case Kind::Vigenere:
+				position = decode ? vigenere->decode(input, output, size, position) : vigenere->encode(input, output, size, position);
+				return size;
+			case Kind::Xor:
+				position = repeating_key->apply(input, output, size, position);
+				return size;
+			case Kind::Polybius:
+				return decode ? Polybius::decode_packed(*square, input, size, output) : Polybius::encode_packed(*square, input, size, output);
+			}
+			return size;
+		}
+	};
+
+	std::vector<Stage> stages;
+};
@@ -2,14 +2,25 @@
 
 #include <string>
 #include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <memory>
+
+#include "alphabet.h"
+#include "arena.h"
+#include "metrics.h"
+#include "span.h"
 
 class Polybius {
 private:
 	/* Method that returns true if duplicate items are found within a vector */
-	static bool duplicate_items(std::vector<uint32_t> target) {
+	static bool duplicate_items(const std::string& target) {
 		std::vector<uint32_t> item_buffer;
 		for (std::size_t i = 0; i < target.size(); i++) {
-			uint32_t current_item = target.at(i);
+			uint32_t current_item = static_cast<uint32_t>(target[i]);
 			auto iterator = std::find(item_buffer.begin(), item_buffer.end(), current_item);
 			if (iterator != item_buffer.end()) return true;
 		}
@@ -17,93 +28,149 @@ private:
 		return false;
 	}
 
-	/* Method that converts lowercase characters to uppercase */
+	/* Method that converts lowercase letters to uppercase */
 	static std::string convert_uppercase(std::string target) {
-		std::string buffer_string;
-		for (std::size_t i = 0; i < target.size(); i++) {
-			int8_t current_character = target.at(i);
-			if (current_character >= 'a' && current_character <= 'z')
-				buffer_string.push_back(current_character - 32);
-			else 
-				buffer_string.push_back(current_character);
+		const Alphabets::Latin& latin = Alphabets::latin();
+		for (char& character : target) {
+			int32_t index = latin.index_of(static_cast<uint8_t>(character));
+			if (index >= 0) character = static_cast<char>(latin.symbol_at(index, true));
 		}
-		return buffer_string;
+		return target;
 	}
 
-	/* Method that removes any character that are not uppercase */
+	/* Method that removes any character that is not a letter */
 	static std::string remove_specials(std::string target) {
-		std::string buffer_string;
-		for (std::size_t i = 0; i < target.size(); i++) {
-			int8_t current_character = target.at(i);
-			if (current_character >= 'A' && current_character <= 'Z')
-				buffer_string.push_back(current_character);
-		}
-		return buffer_string;
+		const Alphabets::Latin& latin = Alphabets::latin();
+		target.erase(std::remove_if(target.begin(), target.end(), [&latin](char character) { return latin.index_of(static_cast<uint8_t>(character)) < 0; }), target.end());
+		return target;
+	}
+
+	/* Uppercase symbols of an alphabet in order, the base a keyed matrix is filled from */
+	template <typename alphabet_type>
+	static std::vector<uint32_t> alphabet_base(const alphabet_type& alphabet) {
+		std::vector<uint32_t> base(alphabet.size());
+		for (std::size_t i = 0; i < base.size(); i++) base[i] = alphabet.symbol_at(i, true);
+		return base;
 	}
 
 public:
 	template <typename matrix_type>
 	using matrix = std::vector<std::vector<matrix_type>>;
 
-	class SacrificeNotInBaseException : public std::exception {
+	class SacrificeNotInBaseException : public std::runtime_error {
 	public: 
-		SacrificeNotInBaseException() : std::exception("The specified sacrificed character does not appear in the base vector.") {}
+		SacrificeNotInBaseException() : std::runtime_error("The specified sacrificed character does not appear in the base vector.") {}
 	};
-	class KeyLengthGreaterThanBaseException : public std::exception {
+	class KeyLengthGreaterThanBaseException : public std::runtime_error {
 	public:
-		KeyLengthGreaterThanBaseException() : std::exception("The ,length of the supplied key is greater than the length of the base.") {}
+		KeyLengthGreaterThanBaseException() : std::runtime_error("The ,length of the supplied key is greater than the length of the base.") {}
 	};
-	class SacrificeAppearsInKeyException : public std::exception {
-	public: SacrificeAppearsInKeyException() : std::exception("Sacrifice appears in supplied key.") {}
+	class SacrificeAppearsInKeyException : public std::runtime_error {
+	public: SacrificeAppearsInKeyException() : std::runtime_error("Sacrifice appears in supplied key.") {}
 	};
-	class DuplicateCharInKeyException : public std::exception {
+	class DuplicateCharInKeyException : public std::runtime_error {
 	public:
-		DuplicateCharInKeyException() : std::exception("The key has duplicate characters inside of it.") {}
+		DuplicateCharInKeyException() : std::runtime_error("The key has duplicate characters inside of it.") {}
 	};
+	class MalformedCiphertextException : public std::runtime_error {
+	public:
+		MalformedCiphertextException() : std::runtime_error("The ciphertext has an odd number of coordinate digits or a coordinate outside of the matrix.") {}
+	};
+
+	/* Keyed matrix flattened into one contiguous array, along with an inverse table that maps every
+	byte symbol straight onto its coordinates packed into one byte as (row << 4) | column, and a table
+	from every packed byte to its symbol. Symbols that do not fit a byte fall back to a hash map.
+	Encoding and decoding are then single loads. */
+	struct Square {
+		static const uint8_t absent = 0xFF;
+		static const uint32_t max_size = 15;
+
+		uint32_t size = 0;
+		uint32_t cells[max_size * max_size];
+		uint8_t inverse[256];
+		std::unordered_map<uint32_t, uint8_t> wide_inverse;
+
+		/* Symbol of every packed byte, and whether its coordinates fall inside the square at all */
+		uint32_t packed_symbols[256];
+		uint8_t packed_valid[256];
+
+		/* Only square matrices of up to 15x15 can pack their coordinates into a byte */
+		static bool representable(const matrix<uint32_t>& source) {
+			if (source.empty() || source.size() > max_size) return false;
+			for (const std::vector<uint32_t>& row : source) if (row.size() != source.size()) return false;
+			return true;
+		}
 
-	static matrix<uint32_t> create_matrix(std::vector<uint32_t> base, std::vector<uint32_t> key, uint32_t matrix_size) {
-		matrix<uint32_t> matrix_buffer;
-		uint32_t current_key_index = 0;
-		uint32_t current_base_index = 0;
-
-		for (std::size_t i = 0; i < matrix_size; i++) {
-			std::vector<uint32_t> matrix_row_buffer;
-
-			for (std::size_t c = 0; c < matrix_size; c++) {
-				if (current_key_index < key.size()) {
-					matrix_row_buffer.push_back(key.at(current_key_index));
-					current_key_index++;
-				}
-				else if (current_base_index < base.size()) {
-					uint32_t base_character = base.at(current_base_index);
-					auto iterator = std::find(key.begin(), key.end(), base_character);
-
-					while (iterator != key.end()) {
-						current_base_index++;
-						if (current_base_index > base.size() - 1) {
-							matrix_row_buffer.push_back(NULL);
-							break;
-						}
-
-						base_character = base.at(current_base_index);
-						iterator = std::find(key.begin(), key.end(), base_character);
-					}
-
-					matrix_row_buffer.push_back(base_character);
-					current_base_index++;
-				}
-				else {
-					matrix_row_buffer.push_back(NULL);
-				}
+		explicit Square(const matrix<uint32_t>& source) : size(static_cast<uint32_t>(source.size())) {
+			if (!representable(source)) throw std::out_of_range("Matrix is not square or larger than 15x15.");
+
+			for (uint32_t i = 0; i < size * size; i++) cells[i] = source[i / size][i % size];
+			build_tables();
+		}
+
+		/* Square of square_size rows from its cells in row order */
+		Square(const uint32_t* source, uint32_t square_size) : size(square_size) {
+			if (size == 0 || size > max_size) throw std::out_of_range("Matrix is not square or larger than 15x15.");
+
+			std::memcpy(cells, source, sizeof(uint32_t) * size * size);
+			build_tables();
+		}
+
+		/* Packed coordinates of the symbol, or absent if it is not in the square */
+		uint8_t locate(uint32_t symbol) const {
+			if (symbol < 256) return inverse[symbol];
+			if (wide_inverse.empty()) return absent;
+
+			auto iterator = wide_inverse.find(symbol);
+			return iterator == wide_inverse.end() ? absent : iterator->second;
+		}
+
+		uint32_t at(uint32_t row, uint32_t column) const {
+			if (row >= size || column >= size) throw std::out_of_range("Coordinates fall outside of the matrix.");
+			return cells[row * size + column];
+		}
+
+		uint32_t at_packed(uint8_t packed) const { return at(packed >> 4, packed & 0x0F); }
+
+		/* Symbols that are not in the square encode as (0, 0), just like single_encode */
+		std::pair<uint32_t, uint32_t> encode(uint32_t symbol) const {
+			uint8_t packed = locate(symbol);
+			if (packed == absent) return std::make_pair(0u, 0u);
+			return std::make_pair(static_cast<uint32_t>(packed >> 4), static_cast<uint32_t>(packed & 0x0F));
+		}
+
+		/* The square in the form keyed_matrix returns */
+		matrix<uint32_t> rows() const { return cell_rows(cells, size); }
+
+	private:
+		void build_tables() {
+			std::memset(inverse, absent, sizeof(inverse));
+
+			/* Filled back to front so that the first cell holding a symbol wins, like single_encode */
+			for (uint32_t i = size * size; i-- > 0;) {
+				uint32_t symbol = cells[i];
+				uint8_t packed = static_cast<uint8_t>(((i / size) << 4) | (i % size));
+
+				if (symbol < 256) inverse[symbol] = packed;
+				else wide_inverse[symbol] = packed;
 			}
 
-			matrix_buffer.push_back(matrix_row_buffer);
-			matrix_row_buffer.clear();
+			for (uint32_t packed = 0; packed < 256; packed++) {
+				bool valid = (packed >> 4) < size && (packed & 0x0F) < size;
+				packed_symbols[packed] = valid ? cells[(packed >> 4) * size + (packed & 0x0F)] : 0;
+				packed_valid[packed] = valid ? 1 : 0;
+			}
 		}
-		return matrix_buffer;
+	};
+
+	static matrix<uint32_t> create_matrix(const std::vector<uint32_t>& base, const std::vector<uint32_t>& key, uint32_t matrix_size) {
+		Arena::Scope scratch;
+		ScratchVector<uint32_t> cells(matrix_size * matrix_size);
+		fill_cells(base.data(), base.size(), key.data(), key.size(), matrix_size, cells.data());
+		return cell_rows(cells.data(), matrix_size);
 	}
 
-	static std::pair<uint32_t, uint32_t> single_encode(uint32_t data, matrix<uint32_t> matrix) {
+	static std::pair<uint32_t, uint32_t> single_encode(uint32_t data, const matrix<uint32_t>& matrix) {
 		for (std::size_t i = 0; i < matrix.size(); i++) {
 			for (std::size_t c = 0; c < matrix.at(i).size(); c++) {
 				if (matrix.at(i).at(c) == data) 
@@ -112,134 +179,403 @@ public:
 		}
 		return std::make_pair(0, 0);
 	}
-	static uint32_t single_decode(std::pair<uint32_t, uint32_t> location, matrix<uint32_t> matrix) {
+	static uint32_t single_decode(std::pair<uint32_t, uint32_t> location, const matrix<uint32_t>& matrix) {
 		return matrix.at(location.first).at(location.second);
 	}
 
-	static std::vector<std::pair<uint32_t, uint32_t>> encode_data(std::string data, std::string key, int8_t sacrifice = '\0', matrix<uint32_t>* matrix_output=nullptr) {
-		/* This is the character set that will be used for the encoding */
-		std::vector<uint32_t> matrix_base {'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P','Q','R','S','T','U','V','W','X','Y','Z'};
+	/* Validates the key and sacrifice and builds the keyed matrix from them. Without a sacrifice the
+	matrix grows from 5x5 to 6x6 so that no letter has to be dropped. */
+	static matrix<uint32_t> keyed_matrix(const std::string& key, int8_t sacrifice = '\0') {
+		uint32_t cells[Square::max_size * Square::max_size];
+		uint32_t matrix_size = keyed_cells(key, sacrifice, cells);
+		return cell_rows(cells, matrix_size);
+	}
 
-		/* Sanitizes the key: Checks for duplicate characters, checks key length, and converts case.
-		Removes non-letter characters from key */
-		if (key.size() > matrix_base.size()) throw KeyLengthGreaterThanBaseException();
-		if (duplicate_items(std::vector<uint32_t>(key.begin(), key.end()))) throw DuplicateCharInKeyException();
-		else { 
-			key = convert_uppercase(key);
-			key = remove_specials(key);
+	/* Square of the matrix keyed_matrix builds, validated the same way but without building the matrix */
+	static Square keyed_square(const std::string& key, int8_t sacrifice = '\0') {
+		uint32_t cells[Square::max_size * Square::max_size];
+		uint32_t matrix_size = keyed_cells(key, sacrifice, cells);
+		return Square(cells, matrix_size);
+	}
+
+	/* Keyed matrix over any alphabet, filled from its uppercase symbols. Key symbols are folded the same
+	way and must be distinct, symbols outside the alphabet are dropped from the key. The matrix is the
+	smallest square that holds the alphabet once the sacrifice is removed, 0 sacrifices nothing. */
+	template <typename alphabet_type>
+	static matrix<uint32_t> keyed_matrix(const alphabet_type& alphabet, const std::vector<uint32_t>& key, uint32_t sacrifice = 0) {
+		std::vector<uint32_t> matrix_base = alphabet_base(alphabet);
+		std::vector<uint32_t> folded_key = sanitize_data(alphabet, key);
+		if (folded_key.size() > matrix_base.size()) throw KeyLengthGreaterThanBaseException();
+
+		std::vector<uint32_t> sorted_key(folded_key);
+		std::sort(sorted_key.begin(), sorted_key.end());
+		if (std::adjacent_find(sorted_key.begin(), sorted_key.end()) != sorted_key.end()) throw DuplicateCharInKeyException();
+
+		if (sacrifice != 0) {
+			int32_t sacrifice_index = alphabet.index_of(sacrifice);
+			if (sacrifice_index < 0) throw SacrificeNotInBaseException();
+
+			sacrifice = matrix_base[sacrifice_index];
+			if (std::binary_search(sorted_key.begin(), sorted_key.end(), sacrifice)) throw SacrificeAppearsInKeyException();
+			matrix_base.erase(matrix_base.begin() + sacrifice_index);
 		}
 
-		/* Checks the presence of the sacrifice in the key */
-		auto key_iterator = std::find(key.begin(), key.end(), sacrifice);
-		if (key_iterator != key.end()) throw SacrificeAppearsInKeyException();
+		uint32_t matrix_size = 1;
+		while (matrix_size * matrix_size < matrix_base.size()) matrix_size++;
+		return create_matrix(matrix_base, folded_key, matrix_size);
+	}
 
-		/* Checks the presence of the sacrifice in the base, and erases from base 
-		this will not run if the sacrifice is a nullbyte, which means the matrix will expand
-		beyond 5x5 to 6x6 in order to include the additional characters, so that no 
-		characters will have to be sacrificed. */
-		if (sacrifice != '\0') {
-			auto base_iterator = std::find(matrix_base.begin(), matrix_base.end(), sacrifice);
-			if (base_iterator == matrix_base.end()) throw SacrificeNotInBaseException();
-			else matrix_base.erase(base_iterator);
+	/* Converts input data to uppercase and strips everything that is not a letter */
+	static std::string sanitize_data(std::string data) {
+		return remove_specials(convert_uppercase(std::move(data)));
+	}
+
+	/* Same for any alphabet: symbols are folded onto their uppercase form and everything else is dropped */
+	template <typename alphabet_type>
+	static std::vector<uint32_t> sanitize_data(const alphabet_type& alphabet, const std::vector<uint32_t>& data) {
+		std::vector<uint32_t> sanitized;
+		sanitized.reserve(data.size());
+
+		for (uint32_t symbol : data) {
+			int32_t index = alphabet.index_of(symbol);
+			if (index >= 0) sanitized.push_back(alphabet.symbol_at(index, true));
 		}
 
-		/* Sanitizes input data to uppercase and strips non-letters */
-		data = convert_uppercase(data);
-		data = remove_specials(data);
+		return sanitized;
+	}
 
-		/* Creates the matrix that will be used to encode data */
-		matrix<uint32_t> encoder_matrix = create_matrix(matrix_base, std::vector<uint32_t>(key.begin(), key.end()), sacrifice == '\0' ? 6 : 5);
-			
-		/* Stores the created matrix if user wishes */
-		if (matrix_output != nullptr) *matrix_output = encoder_matrix;
+	static std::vector<std::pair<uint32_t, uint32_t>> encode_data(const std::string& data, const std::string& key, int8_t sacrifice = '\0', matrix<uint32_t>* matrix_output=nullptr) {
+		CIPHERS_METRICS_SCOPE("polybius", "encode", data.size());
+		/* Builds the square straight from the key, the matrix only exists if the user wishes to keep it */
+		Square encoder_square = keyed_square(key, sacrifice);
+		if (matrix_output != nullptr) *matrix_output = encoder_square.rows();
 
-		/* This will store the encoded output data. */
-		std::vector<std::pair<uint32_t, uint32_t>> encoded_output_data;
+		return encode_data(data, encoder_square);
+	}
 
-		/* Loops over every character in the input data, encodes and writes to output data */
-		for (std::size_t i = 0; i < data.size(); i++) {
-			int8_t current_character = data.at(i);
-			
-			/* Encodes the current character */
-			std::pair<uint32_t, uint32_t> encoded = single_encode(current_character, encoder_matrix);
+	/* Folds case and skips anything that is not a letter while encoding, so the only allocation is
+	the output. Letters missing from the square encode as (0, 0). */
+	static std::vector<std::pair<uint32_t, uint32_t>> encode_data(const std::string& data, const Square& square) {
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+		uint8_t packed = 0;
+
+		std::size_t letters = 0;
+		for (std::size_t i = 0; i < data.size(); i++) letters += pack_letter(square, bytes[i], packed) ? 1 : 0;
 
-			/* Adds the encoded character to the output data */
-			encoded_output_data.push_back(encoded);
+		std::vector<std::pair<uint32_t, uint32_t>> encoded_data(letters);
+		for (std::size_t i = 0, written = 0; written < letters; i++) {
+			if (pack_letter(square, bytes[i], packed)) encoded_data[written++] = std::make_pair(static_cast<uint32_t>(packed >> 4), static_cast<uint32_t>(packed & 0x0F));
 		}
 
-		return encoded_output_data;
+		return encoded_data;
 	}
-	static std::vector<std::pair<uint32_t, uint32_t>> encode_data(std::vector<uint32_t> data, matrix<uint32_t> encoder_matrix) {
+	static std::vector<std::pair<uint32_t, uint32_t>> encode_data(std::vector<uint32_t> data, const matrix<uint32_t>& encoder_matrix) {
 		/* This is where the encoded output data will be stored */
-		std::vector<std::pair<uint32_t, uint32_t>> encoded_data;
-		
-		/* Loops over every item in input data, encodes, and adds to encoded_data vector */
-		for (std::size_t i = 0; i < data.size(); i++) {
-			uint32_t current_int = data.at(i);
-			std::pair<uint32_t, uint32_t> encoded = single_encode(current_int, encoder_matrix);
-			encoded_data.push_back(encoded);
+		std::vector<std::pair<uint32_t, uint32_t>> encoded_data(data.size());
+
+		/* Matrices that cannot be flattened fall back to scanning for every item */
+		if (!Square::representable(encoder_matrix)) {
+			for (std::size_t i = 0; i < data.size(); i++) encoded_data[i] = single_encode(data[i], encoder_matrix);
+			return encoded_data;
 		}
 
+		Square square(encoder_matrix);
+		for (std::size_t i = 0; i < data.size(); i++) encoded_data[i] = square.encode(data[i]);
 		return encoded_data;
 	}
 
-	static std::vector<uint32_t> decode_data(std::vector<std::pair<uint32_t, uint32_t>> data, std::string key, int8_t sacrifice = '\0', matrix<uint32_t>* matrix_output=nullptr) {
-		/* This is the character set that will be used for the decoding */
-		std::vector<uint32_t> matrix_base{ 'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P','Q','R','S','T','U','V','W','X','Y','Z' };
+	/* Inverse of encode_data with the same key and sacrifice, the matrix is built and validated the same way */
+	static std::vector<uint32_t> decode_data(const std::vector<std::pair<uint32_t, uint32_t>>& data, const std::string& key, int8_t sacrifice = '\0', matrix<uint32_t>* matrix_output=nullptr) {
+		CIPHERS_METRICS_SCOPE("polybius", "decode", data.size());
+		/* Builds the square straight from the key, the matrix only exists if the user wishes to keep it */
+		Square decoder_square = keyed_square(key, sacrifice);
+		if (matrix_output != nullptr) *matrix_output = decoder_square.rows();
 
-		/* Sanitizes the key: Checks for duplicate characters, checks key length, and converts case.
-		Removes non-letter characters from key */
-		if (key.size() > matrix_base.size()) throw KeyLengthGreaterThanBaseException();
-		if (duplicate_items(std::vector<uint32_t>(key.begin(), key.end()))) throw DuplicateCharInKeyException();
-		else { 
-			key = convert_uppercase(key);
-			key = remove_specials(key);
+		return decode_data(data, decoder_square);
+	}
+	static std::vector<uint32_t> decode_data(const std::vector<std::pair<uint32_t, uint32_t>>& data, const matrix<uint32_t>& matrix) {
+		/* Squares that can be flattened allocate their own output, only the scan over the matrix needs one here */
+		if (Square::representable(matrix)) return decode_data(data, Square(matrix));
+
+		std::vector<uint32_t> decoded_data(data.size());
+		for (std::size_t i = 0; i < data.size(); i++) decoded_data[i] = matrix.at(data[i].first).at(data[i].second);
+		return decoded_data;
+	}
+
+	static std::vector<uint32_t> decode_data(const std::vector<std::pair<uint32_t, uint32_t>>& data, const Square& square) {
+		std::vector<uint32_t> decoded_data(data.size());
+		for (std::size_t i = 0; i < data.size(); i++) decoded_data[i] = square.at(data[i].first, data[i].second);
+		return decoded_data;
+	}
+
+	/* Packed ciphertext stores each coordinate pair in one byte as (row << 4) | column, the digit form
+	stores it as two characters, 0-9 followed by A-E for squares larger than 10x10. Both are written
+	straight into a caller supplied buffer and decoded straight out of one, so large inputs can be
+	streamed through fixed size buffers. */
+
+	/* Folds case, skips anything that is not a letter like encode_data does, and writes one packed byte
+	per remaining character. Output must hold size bytes, returns the number of bytes written. */
+	static std::size_t encode_packed(const Square& square, const uint8_t* input, std::size_t size, uint8_t* output) {
+		CIPHERS_METRICS_SCOPE("polybius", "encode_packed", size);
+		std::size_t written = 0;
+
+		for (std::size_t i = 0; i < size; i++) {
+			if (pack_letter(square, input[i], output[written])) written++;
 		}
 
-		/* Checks the presence of the sacrifice in the key */
-		auto key_iterator = std::find(key.begin(), key.end(), sacrifice);
-		if (key_iterator != key.end()) throw SacrificeAppearsInKeyException();
+		return written;
+	}
 
-		/* Checks the presence of the sacrifice in the base, and erases from base
-		this will not run if the sacrifice is a nullbyte, which means the matrix will expand
-		beyond 5x5 to 6x6 in order to include the additional characters, so that no
-		characters will have to be sacrificed. */
-		if (sacrifice != '\0') {
-			auto base_iterator = std::find(matrix_base.begin(), matrix_base.end(), sacrifice);
-			if (base_iterator == matrix_base.end()) throw SacrificeNotInBaseException();
-			else matrix_base.erase(base_iterator);
+	/* Same as encode_packed but writes two digits per character with the separator between pairs.
+	Output must hold size * (2 + strlen(separator)) characters, returns the number written. */
+	static std::size_t encode_digits(const Square& square, const uint8_t* input, std::size_t size, char* output, const char* separator = "") {
+		CIPHERS_METRICS_SCOPE("polybius", "encode_digits", size);
+		const std::size_t separator_size = std::strlen(separator);
+		std::size_t written = 0;
+
+		for (std::size_t i = 0; i < size; i++) {
+			uint8_t packed;
+			if (!pack_letter(square, input[i], packed)) continue;
+
+			if (written != 0 && separator_size != 0) {
+				std::memcpy(output + written, separator, separator_size);
+				written += separator_size;
+			}
+
+			output[written++] = coordinate_digit(packed >> 4);
+			output[written++] = coordinate_digit(packed & 0x0F);
 		}
 
-		/* Creates the matrix that will be used to decode data */
-		matrix<uint32_t> decoder_matrix = create_matrix(matrix_base, std::vector<uint32_t>(key.begin(), key.end()), sacrifice == '\0' ? 6 : 5);
+		return written;
+	}
 
-		/* Stores the created matrix if user wishes */
-		if (matrix_output != nullptr) *matrix_output = decoder_matrix;
+	/* Writes the symbol of every packed byte, returns the number of symbols written. The loop has no
+	branches so that it vectorizes, coordinates outside of the square are only reported once it is done.
+	Byte input and output may alias, every packed byte is read before its symbol is written. */
+	template <typename symbol_type>
+	static std::size_t decode_packed(const Square& square, const uint8_t* input, std::size_t size, symbol_type* output) {
+		CIPHERS_METRICS_SCOPE("polybius", "decode_packed", size);
+		uint8_t valid = 1;
+		for (std::size_t i = 0; i < size; i++) {
+			const uint8_t packed = input[i];
+			valid &= square.packed_valid[packed];
+			output[i] = static_cast<symbol_type>(square.packed_symbols[packed]);
+		}
 
-		/* This will store the decoded output data */
-		std::vector<uint32_t> decoded_output_data;
+		if (valid == 0) throw MalformedCiphertextException();
+		return size;
+	}
 
+	/* Reads digit pairs, skipping any separator characters between them, and writes their symbols.
+	Output must hold size / 2 symbols, returns the number of symbols written. */
+	template <typename symbol_type>
+	static std::size_t decode_digits(const Square& square, const char* input, std::size_t size, symbol_type* output) {
+		CIPHERS_METRICS_SCOPE("polybius", "decode_digits", size);
+		std::size_t written = 0;
+		int32_t row = -1;
+
+		for (std::size_t i = 0; i < size; i++) {
+			int32_t digit = digit_value(input[i]);
+			if (digit < 0) continue;
+
+			if (row < 0) {
+				row = digit;
+				continue;
+			}
+
+			output[written++] = static_cast<symbol_type>(unpack_symbol(square, static_cast<uint8_t>((row << 4) | digit)));
+			row = -1;
+		}
+
+		if (row >= 0) throw MalformedCiphertextException();
+		return written;
+	}
+
+	/* Span forms of encode_packed and decode_packed, they return the number of bytes written. The
+	output must be as large as the input, encoding writes less when the input has non-letters. */
+	static std::size_t encode_packed(const Square& square, Span<const uint8_t> input, Span<uint8_t> output) {
+		require_output(output, input.size());
+		return encode_packed(square, input.data(), input.size(), output.data());
+	}
 
+	static std::size_t decode_packed(const Square& square, Span<const uint8_t> input, Span<uint8_t> output) {
+		require_output(output, input.size());
+		return decode_packed(square, input.data(), input.size(), output.data());
+	}
+
+	/* Converts between the pair vectors returned by encode_data and the packed form */
+	static std::string pack(const std::vector<std::pair<uint32_t, uint32_t>>& data) {
+		std::string packed(data.size(), '\0');
 		for (std::size_t i = 0; i < data.size(); i++) {
+			if (data[i].first >= Square::max_size || data[i].second >= Square::max_size) throw MalformedCiphertextException();
+			packed[i] = static_cast<char>((data[i].first << 4) | data[i].second);
+		}
+		return packed;
+	}
 
+	static std::vector<std::pair<uint32_t, uint32_t>> unpack(const std::string& packed) {
+		std::vector<std::pair<uint32_t, uint32_t>> data(packed.size());
+		for (std::size_t i = 0; i < packed.size(); i++) {
+			uint8_t value = static_cast<uint8_t>(packed[i]);
+			data[i] = std::make_pair(static_cast<uint32_t>(value >> 4), static_cast<uint32_t>(value & 0x0F));
 		}
+		return data;
 	}
-	static std::vector<uint32_t> decode_data(std::vector<std::pair<uint32_t, uint32_t>> data, matrix<uint32_t> matrix) {
-		/* This will hold the decoded data */
-		std::vector<uint32_t> decoded_data;
+
+	/* Digit form of the pair vectors returned by encode_data, built in one preallocated string */
+	static std::string format_digits(const std::vector<std::pair<uint32_t, uint32_t>>& data, const std::string& separator = "") {
+		std::string text;
+		if (data.empty()) return text;
+
+		text.resize(data.size() * 2 + (data.size() - 1) * separator.size());
+		char* output = &text[0];
 
 		for (std::size_t i = 0; i < data.size(); i++) {
+			if (data[i].first >= Square::max_size || data[i].second >= Square::max_size) throw MalformedCiphertextException();
+			if (i != 0) output = std::copy(separator.begin(), separator.end(), output);
 
-			/* Reference to the current coordinate pair. */
-			std::pair<uint32_t, uint32_t>& current = data.at(i);
-			
-			/* The current decoded item in the coordinate array */
-			uint32_t decoded_item = matrix.at(current.first).at(current.second);
+			*output++ = coordinate_digit(data[i].first);
+			*output++ = coordinate_digit(data[i].second);
+		}
 
-			/* Adds decoded item to vector */
-			decoded_data.push_back(decoded_item);
+		return text;
+	}
+
+	static std::string encode_packed(const std::string& data, const std::string& key, int8_t sacrifice = '\0') {
+		Square square = keyed_square(key, sacrifice);
+		std::string packed(data.size(), '\0');
+		if (data.empty()) return packed;
+
+		packed.resize(encode_packed(square, reinterpret_cast<const uint8_t*>(data.data()), data.size(), reinterpret_cast<uint8_t*>(&packed[0])));
+		return packed;
+	}
+
+	static std::string decode_packed(const std::string& packed, const std::string& key, int8_t sacrifice = '\0') {
+		Square square = keyed_square(key, sacrifice);
+		std::string decoded(packed.size(), '\0');
+		if (packed.empty()) return decoded;
+
+		decode_packed(square, reinterpret_cast<const uint8_t*>(packed.data()), packed.size(), reinterpret_cast<uint8_t*>(&decoded[0]));
+		return decoded;
+	}
+
+private:
+	/* Cells of create_matrix in row order: the key, then the base characters that are not in it, then
+	empty cells once the base runs out. Cells must hold matrix_size * matrix_size symbols. */
+	static void fill_cells(const uint32_t* base, std::size_t base_size, const uint32_t* key, std::size_t key_size, uint32_t matrix_size, uint32_t* cells) {
+		/* Sorted copy of the key so that skipping base characters used by the key is a binary search */
+		Arena::Scope scratch;
+		ScratchVector<uint32_t> sorted_key(key, key + key_size);
+		std::sort(sorted_key.begin(), sorted_key.end());
+
+		std::size_t key_index = 0;
+		std::size_t base_index = 0;
+
+		for (std::size_t i = 0; i < matrix_size * matrix_size; i++) {
+			if (key_index < key_size) {
+				cells[i] = key[key_index++];
+				continue;
+			}
+
+			/* A key that holds every remaining base character leaves the cell empty */
+			while (base_index < base_size && std::binary_search(sorted_key.begin(), sorted_key.end(), base[base_index])) base_index++;
+			cells[i] = base_index < base_size ? base[base_index++] : 0;
 		}
+	}
 
-		return decoded_data;
+	/* Validates the key and sacrifice and writes the cells of the keyed matrix, returns its size.
+	Without a sacrifice the matrix grows from 5x5 to 6x6 so that no letter has to be dropped. */
+	static uint32_t keyed_cells(const std::string& key, int8_t sacrifice, uint32_t* cells) {
+		const Alphabets::Latin& latin = Alphabets::latin();
+		Arena::Scope scratch;
+
+		/* This is the character set that will be used for the encoding */
+		ScratchVector<uint32_t> matrix_base(latin.size());
+		for (std::size_t i = 0; i < matrix_base.size(); i++) matrix_base[i] = latin.symbol_at(i, true);
+
+		/* Checks key length and duplicates, then folds the key to uppercase letters */
+		if (key.size() > matrix_base.size()) throw KeyLengthGreaterThanBaseException();
+		if (duplicate_items(key)) throw DuplicateCharInKeyException();
+
+		ScratchVector<uint32_t> folded_key;
+		folded_key.reserve(key.size());
+		for (char character : key) {
+			int32_t index = latin.index_of(static_cast<uint8_t>(character));
+			if (index >= 0) folded_key.push_back(latin.symbol_at(index, true));
+		}
+
+		/* The sacrifice may not appear in the key. Without one nothing is erased from the base and the
+		matrix expands to 6x6 to hold every letter. */
+		const uint32_t sacrifice_symbol = static_cast<uint8_t>(sacrifice);
+		if (std::find(folded_key.begin(), folded_key.end(), sacrifice_symbol) != folded_key.end()) throw SacrificeAppearsInKeyException();
+
+		if (sacrifice != '\0') {
+			auto base_iterator = std::find(matrix_base.begin(), matrix_base.end(), sacrifice_symbol);
+			if (base_iterator == matrix_base.end()) throw SacrificeNotInBaseException();
+			matrix_base.erase(base_iterator);
+		}
+
+		uint32_t matrix_size = sacrifice == '\0' ? 6 : 5;
+		fill_cells(matrix_base.data(), matrix_base.size(), folded_key.data(), folded_key.size(), matrix_size, cells);
+		return matrix_size;
+	}
+
+	static matrix<uint32_t> cell_rows(const uint32_t* cells, uint32_t matrix_size) {
+		matrix<uint32_t> rows(matrix_size);
+		for (uint32_t i = 0; i < matrix_size; i++) rows[i].assign(cells + i * matrix_size, cells + (i + 1) * matrix_size);
+		return rows;
+	}
+
+	/* Packed coordinates of one byte of plaintext, case folded. False for anything that is not a letter,
+	letters missing from the square pack as (0, 0). */
+	static bool pack_letter(const Square& square, uint8_t character, uint8_t& packed) {
+		if (character >= 'a' && character <= 'z') character -= 32;
+		if (character < 'A' || character > 'Z') return false;
+
+		packed = square.inverse[character] == Square::absent ? 0 : square.inverse[character];
+		return true;
+	}
+
+	static uint32_t unpack_symbol(const Square& square, uint8_t packed) {
+		if (square.packed_valid[packed] == 0) throw MalformedCiphertextException();
+		return square.packed_symbols[packed];
+	}
+
+	static char coordinate_digit(uint32_t coordinate) {
+		return static_cast<char>(coordinate < 10 ? '0' + coordinate : 'A' + (coordinate - 10));
+	}
+
+	static int32_t digit_value(char digit) {
+		if (digit >= '0' && digit <= '9') return digit - '0';
+		if (digit >= 'A' && digit <= 'E') return digit - 'A' + 10;
+		return -1;
+	}
+};
+
+/* Keyed Polybius square validated and built once, then reused for any number of messages */
+class CompiledPolybius {
+public:
+	explicit CompiledPolybius(const std::string& key, int8_t sacrifice = '\0') : CompiledPolybius(Polybius::keyed_matrix(key, sacrifice)) {}
+
+	explicit CompiledPolybius(Polybius::matrix<uint32_t> source) : square(std::move(source)) {
+		if (Polybius::Square::representable(square)) flat = std::make_shared<const Polybius::Square>(square);
 	}
+
+	/* Same output as Polybius::encode_data with the key this square was built from */
+	std::vector<std::pair<uint32_t, uint32_t>> encode(const std::string& data) const {
+		if (flat) return Polybius::encode_data(data, *flat);
+
+		std::string sanitized = Polybius::sanitize_data(data);
+		return Polybius::encode_data(std::vector<uint32_t>(sanitized.begin(), sanitized.end()), square);
+	}
+
+	std::vector<uint32_t> decode(const std::vector<std::pair<uint32_t, uint32_t>>& data) const {
+		return flat ? Polybius::decode_data(data, *flat) : Polybius::decode_data(data, square);
+	}
+
+	const Polybius::matrix<uint32_t>& matrix() const { return square; }
+
+private:
+	Polybius::matrix<uint32_t> square;
+	std::shared_ptr<const Polybius::Square> flat;
 };
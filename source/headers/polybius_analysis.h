@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "alphabet.h"
+#include "language_model.h"
+#include "metrics.h"
+#include "polybius.h"
+#include "thread_pool.h"
+
+struct PolybiusAnalysisOptions {
+	/* Independent searches, each from its own random square, the best one wins */
+	std::size_t restarts = 32;
+
+	/* Swaps tried by every search, the last tenth of them without accepting anything worse */
+	std::size_t iterations = 20000;
+
+	/* Largest loss in log likelihood a swap may cost and still be taken early on, cooled to zero */
+	double temperature = 8.0;
+
+	/* Searches are deterministic for a given seed, whatever the number of threads */
+	uint64_t seed = 1;
+
+	/* Pool the searches are spread over, the shared pool when left empty */
+	ThreadPool* pool = nullptr;
+};
+
+/* Recovers unknown keyed Polybius squares from ciphertext, pairs as returned by encode_data or one
+packed byte per letter as written by encode_packed. The square is searched as a permutation of the
+letters over its cells, every candidate is scored by the n-gram log likelihood of its plaintext, and
+swapping two cells is the only move. Many searches start from random squares and run simulated
+annealing in parallel, the pool hands them out one at a time so that idle threads take the next one.
+
+Cells the ciphertext never uses cannot be told apart by their plaintext, they get the letters left
+over in alphabet order, which is where a keyed square puts them unless the key holds them. */
+class PolybiusAnalysis {
+public:
+	using Options = PolybiusAnalysisOptions;
+
+	struct Report {
+		/* Recovered square, in the form keyed_matrix returns */
+		Polybius::matrix<uint32_t> matrix;
+
+		/* Shortest key keyed_matrix turns into the square with the same sacrifice, empty when the square
+		is not one keyed_matrix could have built */
+		std::string key;
+		bool keyed = false;
+
+		/* Uppercase letters the ciphertext deciphers to with the recovered square */
+		std::string plaintext;
+
+		/* Mean log probability of the plaintext's n-grams, close to the model's own for a right square */
+		double score = 0;
+
+		/* Distinct cells the ciphertext uses, the rest of the square is a guess */
+		std::size_t cells_observed = 0;
+	};
+
+	/* Square size the keyed matrices have, 5x5 with a sacrificed letter and 6x6 without */
+	static uint32_t square_size(int8_t sacrifice) { return sacrifice == '\0' ? 6 : 5; }
+
+	static Report analyze(const std::vector<std::pair<uint32_t, uint32_t>>& data, const NgramModel& model, int8_t sacrifice = '\0', const Options& options = Options()) {
+		const uint32_t size = square_size(sacrifice);
+		std::vector<uint8_t> cells(data.size());
+
+		for (std::size_t i = 0; i < data.size(); i++) {
+			if (data[i].first >= size || data[i].second >= size) throw Polybius::MalformedCiphertextException();
+			cells[i] = static_cast<uint8_t>(data[i].first * size + data[i].second);
+		}
+
+		return search(cells, size, model, sacrifice, options);
+	}
+
+	static Report analyze_packed(const uint8_t* data, std::size_t length, const NgramModel& model, int8_t sacrifice = '\0', const Options& options = Options()) {
+		CIPHERS_METRICS_SCOPE("analysis", "polybius", length);
+		const uint32_t size = square_size(sacrifice);
+		std::vector<uint8_t> cells(length);
+
+		for (std::size_t i = 0; i < length; i++) {
+			uint32_t row = data[i] >> 4, column = data[i] & 0x0F;
+			if (row >= size || column >= size) throw Polybius::MalformedCiphertextException();
+			cells[i] = static_cast<uint8_t>(row * size + column);
+		}
+
+		return search(cells, size, model, sacrifice, options);
+	}
+
+	static Report analyze_packed(const std::string& data, const NgramModel& model, int8_t sacrifice = '\0', const Options& options = Options()) {
+		return analyze_packed(reinterpret_cast<const uint8_t*>(data.data()), data.size(), model, sacrifice, options);
+	}
+
+private:
+	/* Symbol of the cells a 6x6 square leaves empty, after the 26 letters */
+	static const uint8_t empty = 26;
+	static const uint32_t max_cells = Polybius::Square::max_size * Polybius::Square::max_size;
+
+	/* One square, as the letter index held by every cell, and the log likelihood of its plaintext */
+	struct Candidate {
+		uint8_t symbols[max_cells];
+		double score;
+	};
+
+	/* Ciphertext as cell indices together with what scoring a square needs. Plaintext of a square is
+	written into a scratch buffer and scored as a whole, a ciphertext of a few hundred letters is
+	short enough that this beats tracking which n-grams a swap touches. */
+	struct Problem {
+		const NgramModel& model;
+		const std::vector<uint8_t>& cells;
+		uint32_t cell_count;
+		uint64_t counts[max_cells];
+
+		/* Cells that occur in the ciphertext, the first cell of every swap is one of them */
+		std::vector<uint8_t> observed;
+
+		/* Every letter of a cell that holds no letter costs this, far below any real plaintext */
+		double empty_penalty;
+
+		Problem(const NgramModel& model, const std::vector<uint8_t>& cells, uint32_t cell_count) : model(model), cells(cells), cell_count(cell_count) {
+			std::memset(counts, 0, sizeof(counts));
+			for (uint8_t cell : cells) counts[cell]++;
+			for (uint32_t cell = 0; cell < cell_count; cell++) if (counts[cell] != 0) observed.push_back(static_cast<uint8_t>(cell));
+			empty_penalty = 2.0 * static_cast<double>(model.order()) * model.floor();
+		}
+
+		double score(const uint8_t* symbols, std::vector<uint8_t>& plaintext) const {
+			double penalty = 0;
+			for (uint8_t cell : observed) if (symbols[cell] == empty) penalty += empty_penalty * static_cast<double>(counts[cell]);
+
+			for (std::size_t i = 0; i < cells.size(); i++) {
+				uint8_t symbol = symbols[cells[i]];
+				plaintext[i] = symbol == empty ? 0 : symbol;
+			}
+
+			return model.score(plaintext.data(), plaintext.size()) + penalty;
+		}
+	};
+
+	static Report search(const std::vector<uint8_t>& cells, uint32_t size, const NgramModel& model, int8_t sacrifice, const Options& options) {
+		const uint32_t cell_count = size * size;
+		const Problem problem(model, cells, cell_count);
+
+		/* The letters of the square, padded with empty cells up to its size */
+		std::vector<uint8_t> symbols;
+		const Alphabets::Latin& latin = Alphabets::latin();
+		int32_t sacrificed = sacrifice == '\0' ? -1 : latin.index_of(static_cast<uint8_t>(sacrifice));
+		if (sacrifice != '\0' && sacrificed < 0) throw Polybius::SacrificeNotInBaseException();
+
+		for (uint8_t letter = 0; letter < LanguageModel::letter_count; letter++) if (letter != sacrificed) symbols.push_back(letter);
+		symbols.resize(cell_count, static_cast<uint8_t>(empty));
+
+		std::size_t restarts = options.restarts == 0 || problem.observed.empty() ? 1 : options.restarts;
+		std::vector<Candidate> candidates(restarts);
+
+		if (!problem.observed.empty()) {
+			ThreadPool& pool = options.pool != nullptr ? *options.pool : ThreadPool::shared();
+			pool.parallel_for(restarts, [&](std::size_t restart) {
+				candidates[restart] = anneal(problem, symbols, options, options.seed + 0x9E3779B97F4A7C15ull * (restart + 1));
+			});
+		} else {
+			std::memcpy(candidates[0].symbols, symbols.data(), cell_count);
+			candidates[0].score = 0;
+		}
+
+		/* Ties go to the earliest search so that the result does not depend on scheduling */
+		std::size_t best = 0;
+		for (std::size_t i = 1; i < candidates.size(); i++) if (candidates[i].score > candidates[best].score) best = i;
+		Candidate& chosen = candidates[best];
+
+		fill_unobserved(problem, chosen.symbols);
+		return report(problem, chosen, size, sacrificed);
+	}
+
+	static Candidate anneal(const Problem& problem, const std::vector<uint8_t>& symbols, const Options& options, uint64_t seed) {
+		std::mt19937_64 generator(seed);
+		std::uniform_real_distribution<double> uniform(0, 1);
+		std::vector<uint8_t> plaintext(problem.cells.size());
+		const std::size_t observed = problem.observed.size();
+		const std::size_t cell_count = problem.cell_count;
+
+		Candidate current;
+		std::memcpy(current.symbols, symbols.data(), cell_count);
+		for (std::size_t i = cell_count; i-- > 1;) std::swap(current.symbols[i], current.symbols[generator() % (i + 1)]);
+		current.score = problem.score(current.symbols, plaintext);
+
+		Candidate best = current;
+		const std::size_t cooling = options.iterations - options.iterations / 10;
+
+		for (std::size_t iteration = 0; iteration < options.iterations; iteration++) {
+			const double temperature = iteration < cooling ? options.temperature * static_cast<double>(cooling - iteration) / static_cast<double>(cooling) : 0;
+
+			std::size_t a = problem.observed[generator() % observed];
+			std::size_t b = generator() % (cell_count - 1);
+			if (b >= a) b++;
+			if (current.symbols[a] == current.symbols[b]) continue;
+
+			std::swap(current.symbols[a], current.symbols[b]);
+			double score = problem.score(current.symbols, plaintext);
+			double change = score - current.score;
+
+			bool accepted = change >= 0;
+			if (!accepted && temperature > 0) accepted = uniform(generator) < std::exp(change / temperature);
+
+			if (!accepted) {
+				std::swap(current.symbols[a], current.symbols[b]);
+				continue;
+			}
+
+			current.score = score;
+			if (score > best.score) best = current;
+		}
+
+		return best;
+	}
+
+	/* Hands the symbols of the cells the ciphertext never uses back out so that the square looks as
+	much like a keyed one as the observed cells allow. Every cell from some point on has to run through
+	the letters in order and then the empty cells, the shortest key in front of that tail wins. */
+	static void fill_unobserved(const Problem& problem, uint8_t* symbols) {
+		std::vector<uint8_t> leftover;
+		for (uint32_t cell = 0; cell < problem.cell_count; cell++) if (problem.counts[cell] == 0) leftover.push_back(symbols[cell]);
+		std::sort(leftover.begin(), leftover.end());
+
+		/* Empty cells follow each other in the tail, everything else is strictly increasing */
+		auto follows = [](int32_t symbol, int32_t previous) { return symbol > previous || (symbol == empty && previous == empty); };
+		const uint32_t letters = static_cast<uint32_t>(std::count_if(symbols, symbols + problem.cell_count, [](uint8_t symbol) { return symbol != empty; }));
+
+		for (uint32_t tail = 0; tail <= problem.cell_count; tail++) {
+			std::vector<uint8_t> filled(symbols, symbols + problem.cell_count);
+			std::vector<uint8_t> key_symbols;
+			std::size_t key_cells = 0, next = 0;
+			int32_t previous = -1;
+			bool ordered = true;
+
+			for (uint32_t cell = 0; cell < tail; cell++) key_cells += problem.counts[cell] == 0;
+
+			/* Leftovers are taken in order, the tail cells take every one that fits their place and the
+			key the ones that are too small for it. No other split keeps the tail in order. */
+			for (uint32_t cell = tail; cell < problem.cell_count && ordered; cell++) {
+				if (problem.counts[cell] == 0) {
+					uint32_t upper = cell + 1;
+					while (upper < problem.cell_count && problem.counts[upper] == 0) upper++;
+					int32_t bound = upper < problem.cell_count ? symbols[upper] : empty + 1;
+
+					/* The first cells hold the letters and the last ones are empty */
+					auto fits = [&](uint8_t symbol) { return follows(symbol, previous) && follows(bound, symbol) && (symbol == empty) == (cell >= letters); };
+					while (next < leftover.size() && !fits(leftover[next]) && leftover[next] != empty) key_symbols.push_back(leftover[next++]);
+					ordered = next < leftover.size() && fits(leftover[next]);
+					if (ordered) filled[cell] = leftover[next++];
+				}
+
+				ordered = ordered && follows(filled[cell], previous);
+				previous = filled[cell];
+			}
+
+			while (ordered && next < leftover.size()) {
+				ordered = leftover[next] != empty;
+				key_symbols.push_back(leftover[next++]);
+			}
+
+			if (!ordered || key_symbols.size() != key_cells) continue;
+
+			for (uint32_t cell = 0, key = 0; cell < tail; cell++) if (problem.counts[cell] == 0) filled[cell] = key_symbols[key++];
+			std::memcpy(symbols, filled.data(), problem.cell_count);
+			return;
+		}
+
+		/* Nothing keyed fits around the observed cells, the leftovers go out in plain order */
+		for (uint32_t cell = 0, next = 0; cell < problem.cell_count; cell++) if (problem.counts[cell] == 0) symbols[cell] = leftover[next++];
+	}
+
+	static Report report(const Problem& problem, const Candidate& chosen, uint32_t size, int32_t sacrificed) {
+		const Alphabets::Latin& latin = Alphabets::latin();
+		auto letter = [&latin](uint8_t symbol) { return symbol == empty ? 0u : latin.symbol_at(symbol, true); };
+
+		Report result;
+		result.cells_observed = problem.observed.size();
+		result.matrix.assign(size, std::vector<uint32_t>(size, 0));
+		for (uint32_t cell = 0; cell < problem.cell_count; cell++) result.matrix[cell / size][cell % size] = letter(chosen.symbols[cell]);
+
+		result.plaintext.resize(problem.cells.size());
+		for (std::size_t i = 0; i < problem.cells.size(); i++) result.plaintext[i] = static_cast<char>(letter(chosen.symbols[problem.cells[i]]));
+
+		std::size_t runs = problem.cells.size() >= problem.model.order() ? problem.cells.size() - problem.model.order() + 1 : 0;
+		result.score = runs == 0 ? 0 : chosen.score / static_cast<double>(runs);
+
+		/* A keyed square is the key followed by the rest of the letters in order, then empty cells */
+		std::size_t letters = LanguageModel::letter_count - (sacrificed >= 0 ? 1 : 0);
+		result.keyed = true;
+		for (std::size_t cell = 0; cell < letters; cell++) result.keyed = result.keyed && chosen.symbols[cell] != empty;
+		if (!result.keyed) return result;
+
+		std::size_t tail = letters;
+		while (tail > 0 && (tail == letters || chosen.symbols[tail - 1] < chosen.symbols[tail])) tail--;
+		for (std::size_t cell = 0; cell < tail; cell++) result.key.push_back(static_cast<char>(letter(chosen.symbols[cell])));
+		return result;
+	}
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#if !defined(CIPHERS_DISABLE_SIMD) && (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+#define CIPHERS_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define CIPHERS_SIMD_X86 0
+#endif
+
+/* MSVC lets any intrinsic be used in any function, GCC and Clang need the instruction set
+enabled per function so that the rest of the binary stays baseline and dispatch stays at runtime. */
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+class Simd {
+public:
+	/* Instruction set levels in dispatch order, every level implies the ones before it. */
+	enum class Level : uint32_t { Scalar = 0, SSE2, SSSE3, AVX2, AVX512 };
+
+	struct Features {
+		bool sse2 = false;
+		bool ssse3 = false;
+		bool sse41 = false;
+		bool popcnt = false;
+		bool avx2 = false;
+		bool avx512f = false;
+		bool avx512bw = false;
+		bool avx512vbmi = false;
+	};
+
+	/* Queries the processor once, later calls return the cached result */
+	static const Features& features() {
+		static const Features detected = detect();
+		return detected;
+	}
+
+	/* Highest level that is both supported by the processor and allowed by limit() */
+	static Level level() {
+		static const Level supported = detect_level(features());
+		Level cap = static_cast<Level>(level_cap().load(std::memory_order_relaxed));
+		return supported < cap ? supported : cap;
+	}
+
+	/* Caps runtime dispatch at the given level, useful to compare kernels against each other */
+	static void limit(Level cap) {
+		level_cap().store(static_cast<uint32_t>(cap), std::memory_order_relaxed);
+	}
+
+private:
+	static std::atomic<uint32_t>& level_cap() {
+		static std::atomic<uint32_t> cap(static_cast<uint32_t>(Level::AVX512));
+		return cap;
+	}
+
+	static Level detect_level(const Features& cpu) {
+		if (cpu.avx512f && cpu.avx512bw) return Level::AVX512;
+		if (cpu.avx2) return Level::AVX2;
+		if (cpu.ssse3) return Level::SSSE3;
+		if (cpu.sse2) return Level::SSE2;
+		return Level::Scalar;
+	}
+
+#if CIPHERS_SIMD_X86
+	static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t registers[4]) {
+#if defined(_MSC_VER)
+		int buffer[4];
+		__cpuidex(buffer, static_cast<int>(leaf), static_cast<int>(subleaf));
+		for (std::size_t i = 0; i < 4; i++) registers[i] = static_cast<uint32_t>(buffer[i]);
+#else
+		__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+	}
+
+	static uint64_t xgetbv() {
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		uint32_t eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+	}
+
+	static Features detect() {
+		Features cpu;
+		uint32_t registers[4] = { 0, 0, 0, 0 };
+
+		cpuid(0, 0, registers);
+		uint32_t max_leaf = registers[0];
+		if (max_leaf < 1) return cpu;
+
+		cpuid(1, 0, registers);
+		cpu.sse2 = (registers[3] >> 26) & 1;
+		cpu.ssse3 = (registers[2] >> 9) & 1;
+		cpu.sse41 = (registers[2] >> 19) & 1;
+		cpu.popcnt = (registers[2] >> 23) & 1;
+
+		/* The wider registers are only usable if the operating system saves them on context switches */
+		bool osxsave = (registers[2] >> 27) & 1;
+		bool avx = (registers[2] >> 28) & 1;
+		uint64_t xcr0 = osxsave ? xgetbv() : 0;
+		bool ymm_state = (xcr0 & 0x06) == 0x06;
+		bool zmm_state = (xcr0 & 0xE6) == 0xE6;
+
+		if (max_leaf >= 7) {
+			cpuid(7, 0, registers);
+			cpu.avx2 = avx && ymm_state && ((registers[1] >> 5) & 1);
+			cpu.avx512f = zmm_state && ((registers[1] >> 16) & 1);
+			cpu.avx512bw = cpu.avx512f && ((registers[1] >> 30) & 1);
+			cpu.avx512vbmi = cpu.avx512f && ((registers[2] >> 1) & 1);
+		}
+
+		return cpu;
+	}
+#else
+	static Features detect() { return Features(); }
+#endif
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/* Non owning view of contiguous elements, the subset of std::span the ciphers need while the project
+builds as C++14. The span overloads of every cipher read from one span and write into a caller owned
+one, they never allocate, so they can run on request threads without touching the heap. */
+template <typename element_type>
+class Span {
+public:
+	using value_type = typename std::remove_cv<element_type>::type;
+
+	constexpr Span() : pointer(nullptr), length(0) {}
+	constexpr Span(element_type* data, std::size_t size) : pointer(data), length(size) {}
+
+	template <std::size_t size>
+	constexpr Span(element_type (&array)[size]) : pointer(array), length(size) {}
+
+	template <std::size_t size>
+	Span(std::array<value_type, size>& array) : pointer(array.data()), length(size) {}
+
+	template <std::size_t size, typename constant = element_type, typename = typename std::enable_if<std::is_const<constant>::value>::type>
+	Span(const std::array<value_type, size>& array) : pointer(array.data()), length(size) {}
+
+	Span(std::vector<value_type>& vector) : pointer(vector.data()), length(vector.size()) {}
+
+	template <typename constant = element_type, typename = typename std::enable_if<std::is_const<constant>::value>::type>
+	Span(const std::vector<value_type>& vector) : pointer(vector.data()), length(vector.size()) {}
+
+	/* Spans of mutable elements convert to spans of const ones */
+	template <typename other_type, typename = typename std::enable_if<std::is_same<const other_type, element_type>::value>::type>
+	constexpr Span(const Span<other_type>& other) : pointer(other.data()), length(other.size()) {}
+
+	constexpr element_type* data() const { return pointer; }
+	constexpr std::size_t size() const { return length; }
+	constexpr bool empty() const { return length == 0; }
+
+	constexpr element_type* begin() const { return pointer; }
+	constexpr element_type* end() const { return pointer + length; }
+
+	element_type& operator[](std::size_t index) const { return pointer[index]; }
+
+	Span first(std::size_t count) const { return Span(pointer, count < length ? count : length); }
+
+	Span subspan(std::size_t offset, std::size_t count = static_cast<std::size_t>(-1)) const {
+		if (offset > length) offset = length;
+		std::size_t remaining = length - offset;
+		return Span(pointer + offset, count < remaining ? count : remaining);
+	}
+
+private:
+	element_type* pointer;
+	std::size_t length;
+};
+
+/* Byte views of strings, which hold char where the ciphers work on uint8_t */
+inline Span<const uint8_t> byte_span(const std::string& text) {
+	return Span<const uint8_t>(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+}
+
+inline Span<uint8_t> byte_span(std::string& text) {
+	return Span<uint8_t>(text.empty() ? nullptr : reinterpret_cast<uint8_t*>(&text[0]), text.size());
+}
+
+/* Thrown by the span overloads when the output span cannot hold everything they would write */
+class OutputTooSmallException : public std::runtime_error {
+public: OutputTooSmallException() : std::runtime_error("The output span is smaller than the output.") {}
+};
+
+/* Checks an output span against the number of elements about to be written into it */
+template <typename element_type>
+inline void require_output(const Span<element_type>& output, std::size_t size) {
+	if (output.size() < size) throw OutputTooSmallException();
+}
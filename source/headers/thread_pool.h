@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed size pool of worker threads. Work is handed out one index at a time from a shared counter,
+so uneven chunks balance themselves, and the calling thread always helps so nested use cannot stall. */
+class ThreadPool {
+public:
+	explicit ThreadPool(std::size_t thread_count = 0) {
+		if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+		if (thread_count == 0) thread_count = 1;
+
+		/* The calling thread is the last worker of every parallel_for */
+		for (std::size_t i = 1; i < thread_count; i++)
+			workers.emplace_back([this] { worker_loop(); });
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			stopping = true;
+		}
+
+		queue_condition.notify_all();
+		for (std::thread& worker : workers) worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/* Pool shared by the parallel drivers when none is supplied, sized to the hardware */
+	static ThreadPool& shared() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	std::size_t size() const { return workers.size() + 1; }
+
+	/* Runs body(i) for every i in [0, task_count) across the pool and returns once all have finished.
+	The first exception thrown by a task is rethrown on the calling thread. */
+	void parallel_for(std::size_t task_count, const std::function<void(std::size_t)>& body) {
+		if (task_count == 0) return;
+		if (task_count == 1 || workers.empty()) {
+			for (std::size_t i = 0; i < task_count; i++) body(i);
+			return;
+		}
+
+		struct Job {
+			std::atomic<std::size_t> next_task{ 0 };
+			std::atomic<std::size_t> finished_tasks{ 0 };
+			std::atomic<bool> cancelled{ false };
+			std::mutex done_mutex;
+			std::condition_variable done_condition;
+			std::exception_ptr error;
+		};
+
+		/* Helpers that only get dequeued after every task was claimed exit without touching body,
+		so the caller only has to wait for claimed tasks and never for queued helpers. */
+		auto job = std::make_shared<Job>();
+		std::size_t helpers = std::min(task_count - 1, workers.size());
+
+		auto runner = [job, task_count, &body] {
+			for (std::size_t i = job->next_task++; i < task_count; i = job->next_task++) {
+				if (!job->cancelled) {
+					try {
+						body(i);
+					} catch (...) {
+						std::lock_guard<std::mutex> lock(job->done_mutex);
+						if (!job->error) job->error = std::current_exception();
+						job->cancelled = true;
+					}
+				}
+
+				if (++job->finished_tasks == task_count) {
+					std::lock_guard<std::mutex> lock(job->done_mutex);
+					job->done_condition.notify_all();
+				}
+			}
+		};
+
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			for (std::size_t i = 0; i < helpers; i++) tasks.push_back(runner);
+		}
+
+		queue_condition.notify_all();
+		runner();
+
+		std::unique_lock<std::mutex> lock(job->done_mutex);
+		job->done_condition.wait(lock, [&job, task_count] { return job->finished_tasks == task_count; });
+		if (job->error) std::rethrow_exception(job->error);
+	}
+
+private:
+	void worker_loop() {
+		while (true) {
+			std::function<void()> task;
+
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				queue_condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+				if (stopping && tasks.empty()) return;
+
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+
+			task();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex queue_mutex;
+	std::condition_variable queue_condition;
+	bool stopping = false;
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include "simd.h"
+
+/* Byte to byte substitution table. Every monoalphabetic cipher over bytes (Caesar, ROT13, Atbash)
+compiles down to one of these, so applying it costs one lookup per byte whatever the key was. */
+class TranslationTable {
+public:
+	/* Identity table, every byte maps onto itself */
+	constexpr TranslationTable() : table{} {
+		for (std::size_t i = 0; i < 256; i++) table[i] = static_cast<uint8_t>(i);
+	}
+
+	constexpr uint8_t operator[](uint8_t symbol) const { return table[symbol]; }
+
+	constexpr void set(uint8_t symbol, uint8_t replacement) { table[symbol] = replacement; }
+
+	const uint8_t* data() const { return table; }
+
+	/* Table that applies this table first and then next */
+	constexpr TranslationTable then(const TranslationTable& next) const {
+		TranslationTable composed;
+		for (std::size_t i = 0; i < 256; i++) composed.table[i] = next.table[table[i]];
+		return composed;
+	}
+
+	/* Table that undoes this one, only meaningful when the table is a permutation */
+	constexpr TranslationTable inverse() const {
+		TranslationTable inverted;
+		for (std::size_t i = 0; i < 256; i++) inverted.table[table[i]] = static_cast<uint8_t>(i);
+		return inverted;
+	}
+
+	/* Translates size bytes of input into output. Input and output may alias. */
+	void apply(const uint8_t* input, uint8_t* output, std::size_t size) const {
+		std::size_t processed = 0;
+
+#if CIPHERS_SIMD_X86
+		switch (Simd::level()) {
+		case Simd::Level::AVX512:
+			if (Simd::features().avx512vbmi) {
+				processed = apply_avx512vbmi(input, output, size);
+				break;
+			}
+			/* fall through */
+		case Simd::Level::AVX2: processed = apply_avx2(input, output, size); break;
+		case Simd::Level::SSSE3: processed = apply_ssse3(input, output, size); break;
+		default: break;
+		}
+#endif
+
+		for (std::size_t i = processed; i < size; i++) output[i] = table[input[i]];
+	}
+
+	std::string apply(std::string data) const {
+		if (!data.empty()) apply(reinterpret_cast<const uint8_t*>(data.data()), reinterpret_cast<uint8_t*>(&data[0]), data.size());
+		return data;
+	}
+
+private:
+	uint8_t table[256];
+
+#if CIPHERS_SIMD_X86
+	/* Rows of 16 entries that differ from the identity, the only ones a vector kernel has to look up */
+	uint32_t changed_rows(uint8_t rows[16]) const {
+		uint32_t count = 0;
+		for (std::size_t h = 0; h < 16; h++) {
+			for (std::size_t l = 0; l < 16; l++) {
+				if (table[h * 16 + l] != h * 16 + l) {
+					rows[count++] = static_cast<uint8_t>(h);
+					break;
+				}
+			}
+		}
+		return count;
+	}
+
+	/* pshufb looks up 16 entries at a time, so the table is split into 16 rows selected by the high
+	nibble of each byte. Bytes start out as themselves and only rows that differ from the identity
+	are looked up and merged in, which keeps letter-only tables like Caesar down to four rows. */
+	SIMD_TARGET("ssse3")
+	std::size_t apply_ssse3(const uint8_t* input, uint8_t* output, std::size_t size) const {
+		uint8_t row_numbers[16];
+		uint32_t row_count = changed_rows(row_numbers);
+
+		__m128i rows[16], row_ids[16];
+		for (std::size_t r = 0; r < row_count; r++) {
+			rows[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + row_numbers[r] * 16));
+			row_ids[r] = _mm_set1_epi8(static_cast<char>(row_numbers[r]));
+		}
+
+		const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+		std::size_t i = 0;
+
+		for (; i + 16 <= size; i += 16) {
+			__m128i data_vector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+			__m128i low = _mm_and_si128(data_vector, nibble_mask);
+			__m128i high = _mm_and_si128(_mm_srli_epi16(data_vector, 4), nibble_mask);
+			__m128i result = data_vector;
+
+			for (std::size_t r = 0; r < row_count; r++) {
+				__m128i row_mask = _mm_cmpeq_epi8(high, row_ids[r]);
+				result = _mm_or_si128(_mm_andnot_si128(row_mask, result), _mm_and_si128(row_mask, _mm_shuffle_epi8(rows[r], low)));
+			}
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), result);
+		}
+
+		return i;
+	}
+
+	SIMD_TARGET("avx2")
+	std::size_t apply_avx2(const uint8_t* input, uint8_t* output, std::size_t size) const {
+		uint8_t row_numbers[16];
+		uint32_t row_count = changed_rows(row_numbers);
+
+		__m256i rows[16], row_ids[16];
+		for (std::size_t r = 0; r < row_count; r++) {
+			rows[r] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table + row_numbers[r] * 16)));
+			row_ids[r] = _mm256_set1_epi8(static_cast<char>(row_numbers[r]));
+		}
+
+		const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+		std::size_t i = 0;
+
+		for (; i + 32 <= size; i += 32) {
+			__m256i data_vector = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+			__m256i low = _mm256_and_si256(data_vector, nibble_mask);
+			__m256i high = _mm256_and_si256(_mm256_srli_epi16(data_vector, 4), nibble_mask);
+			__m256i result = data_vector;
+
+			for (std::size_t r = 0; r < row_count; r++) {
+				__m256i row_mask = _mm256_cmpeq_epi8(high, row_ids[r]);
+				result = _mm256_blendv_epi8(result, _mm256_shuffle_epi8(rows[r], low), row_mask);
+			}
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), result);
+		}
+
+		return i;
+	}
+
+	/* VBMI permutes across two registers, which covers 128 entries, so each half of the table
+	is looked up once and the top bit of every byte picks between the two. */
+	SIMD_TARGET("avx512f,avx512bw,avx512vbmi")
+	std::size_t apply_avx512vbmi(const uint8_t* input, uint8_t* output, std::size_t size) const {
+		const __m512i table_0 = _mm512_loadu_si512(table);
+		const __m512i table_1 = _mm512_loadu_si512(table + 64);
+		const __m512i table_2 = _mm512_loadu_si512(table + 128);
+		const __m512i table_3 = _mm512_loadu_si512(table + 192);
+		std::size_t i = 0;
+
+		for (; i + 64 <= size; i += 64) {
+			__m512i data_vector = _mm512_loadu_si512(input + i);
+			__m512i lower_half = _mm512_permutex2var_epi8(table_0, data_vector, table_1);
+			__m512i upper_half = _mm512_permutex2var_epi8(table_2, data_vector, table_3);
+			__mmask64 upper_mask = _mm512_movepi8_mask(data_vector);
+			_mm512_storeu_si512(output + i, _mm512_mask_blend_epi8(upper_mask, lower_half, upper_half));
+		}
+
+		return i;
+	}
+#endif
+};
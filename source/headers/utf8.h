@@ -0,0 +1,453 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "simd.h"
+
+/* Conversion between UTF-8 text and code points, for ciphers whose alphabets go past ASCII.
+Validation runs the Keiser-Lemire lookup algorithm on SSSE3 and AVX2, which checks every byte
+against the one to three bytes before it with three nibble table lookups, and skips blocks of ASCII
+outright. Decoding widens ASCII blocks sixteen bytes at a time and only walks multibyte sequences. */
+class Utf8 {
+public:
+	class InvalidUtf8Exception : public std::runtime_error {
+	public: InvalidUtf8Exception() : std::runtime_error("The input is not valid UTF-8.") {}
+	};
+
+	/* Length of the sequence a lead byte starts, 0 for continuation bytes and bytes that never start one */
+	static std::size_t sequence_length(uint8_t lead) {
+		if (lead < 0x80) return 1;
+		if (lead >= 0xC2 && lead <= 0xDF) return 2;
+		if ((lead & 0xF0) == 0xE0) return 3;
+		if (lead >= 0xF0 && lead <= 0xF4) return 4;
+		return 0;
+	}
+
+	/* Decodes the code point at position and moves position past it. Overlong forms, surrogates,
+	code points past U+10FFFF and truncated sequences are rejected. */
+	static uint32_t decode_one(const uint8_t* data, std::size_t size, std::size_t& position) {
+		uint8_t lead = data[position];
+		if (lead < 0x80) {
+			position++;
+			return lead;
+		}
+
+		std::size_t length;
+		uint32_t code_point, minimum;
+		if ((lead & 0xE0) == 0xC0) { length = 2; code_point = lead & 0x1F; minimum = 0x80; }
+		else if ((lead & 0xF0) == 0xE0) { length = 3; code_point = lead & 0x0F; minimum = 0x800; }
+		else if ((lead & 0xF8) == 0xF0) { length = 4; code_point = lead & 0x07; minimum = 0x10000; }
+		else throw InvalidUtf8Exception();
+
+		if (size - position < length) throw InvalidUtf8Exception();
+		for (std::size_t i = 1; i < length; i++) {
+			uint8_t continuation = data[position + i];
+			if ((continuation & 0xC0) != 0x80) throw InvalidUtf8Exception();
+			code_point = (code_point << 6) | (continuation & 0x3F);
+		}
+
+		if (code_point < minimum || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF)) throw InvalidUtf8Exception();
+		position += length;
+		return code_point;
+	}
+
+	/* Writes the encoding of a code point, at most four bytes, and returns its length */
+	static std::size_t encode_one(uint32_t code_point, uint8_t* output) {
+		if (code_point < 0x80) {
+			output[0] = static_cast<uint8_t>(code_point);
+			return 1;
+		}
+		if (code_point < 0x800) {
+			output[0] = static_cast<uint8_t>(0xC0 | (code_point >> 6));
+			output[1] = static_cast<uint8_t>(0x80 | (code_point & 0x3F));
+			return 2;
+		}
+		if (code_point < 0x10000) {
+			if (code_point >= 0xD800 && code_point <= 0xDFFF) throw InvalidUtf8Exception();
+			output[0] = static_cast<uint8_t>(0xE0 | (code_point >> 12));
+			output[1] = static_cast<uint8_t>(0x80 | ((code_point >> 6) & 0x3F));
+			output[2] = static_cast<uint8_t>(0x80 | (code_point & 0x3F));
+			return 3;
+		}
+		if (code_point > 0x10FFFF) throw InvalidUtf8Exception();
+		output[0] = static_cast<uint8_t>(0xF0 | (code_point >> 18));
+		output[1] = static_cast<uint8_t>(0x80 | ((code_point >> 12) & 0x3F));
+		output[2] = static_cast<uint8_t>(0x80 | ((code_point >> 6) & 0x3F));
+		output[3] = static_cast<uint8_t>(0x80 | (code_point & 0x3F));
+		return 4;
+	}
+
+	static bool validate(const uint8_t* data, std::size_t size) {
+		std::size_t checked = 0;
+
+#if CIPHERS_SIMD_X86
+		Simd::Level level = Simd::level();
+		if (level >= Simd::Level::AVX2) checked = validate_avx2(data, size);
+		else if (level >= Simd::Level::SSSE3) checked = validate_ssse3(data, size);
+		if (checked == invalid) return false;
+
+		/* The vector pass checked every byte against the ones before it, but a sequence may still run
+		past where it stopped, so the scalar check picks up again at the last lead byte before that */
+		std::size_t lookback = std::min<std::size_t>(checked, 3);
+		for (std::size_t back = 1; back <= lookback; back++) {
+			if ((data[checked - back] & 0xC0) != 0x80) {
+				checked -= back;
+				break;
+			}
+		}
+#endif
+
+		return validate_scalar(data + checked, size - checked);
+	}
+
+	static bool validate(const std::string& text) {
+		return validate(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+	}
+
+	/* Decodes text that validate accepted, without checking it again. Output must hold size code
+	points, returns the number written. */
+	static std::size_t decode_valid(const uint8_t* data, std::size_t size, uint32_t* output) {
+		std::size_t position = 0, written = 0;
+
+#if CIPHERS_SIMD_X86
+		bool widen = Simd::level() >= Simd::Level::SSE2;
+#endif
+
+		while (position < size) {
+#if CIPHERS_SIMD_X86
+			if (widen && size - position >= 16) {
+				std::size_t widened = widen_ascii_sse2(data + position, size - position, output + written);
+				position += widened;
+				written += widened;
+				if (position == size) break;
+			}
+#endif
+
+			uint8_t lead = data[position];
+			if (lead < 0x80) {
+				output[written++] = lead;
+				position++;
+				continue;
+			}
+
+			std::size_t length = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : 2;
+			uint32_t code_point = lead & (0x7F >> length);
+			for (std::size_t i = 1; i < length; i++) code_point = (code_point << 6) | (data[position + i] & 0x3F);
+
+			output[written++] = code_point;
+			position += length;
+		}
+
+		return written;
+	}
+
+	/* Appends the encoding of every code point */
+	static void encode_append(const uint32_t* code_points, std::size_t count, std::string& output) {
+		std::size_t start = output.size();
+		output.resize(start + count * 4);
+		uint8_t* bytes = reinterpret_cast<uint8_t*>(&output[0]) + start;
+
+		std::size_t written = 0;
+		for (std::size_t i = 0; i < count; i++) {
+			if (code_points[i] < 0x80) bytes[written++] = static_cast<uint8_t>(code_points[i]);
+			else written += encode_one(code_points[i], bytes + written);
+		}
+
+		output.resize(start + written);
+	}
+
+	static std::vector<uint32_t> decode(const std::string& text) {
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+		if (!validate(data, text.size())) throw InvalidUtf8Exception();
+
+		std::vector<uint32_t> code_points(text.size());
+		code_points.resize(decode_valid(data, text.size(), code_points.data()));
+		return code_points;
+	}
+
+	static std::string encode(const std::vector<uint32_t>& code_points) {
+		std::string text;
+		encode_append(code_points.data(), code_points.size(), text);
+		return text;
+	}
+
+	/* Runs a code point cipher, cipher(code_points, count) rewriting them in place, over UTF-8 text.
+	Only one chunk of code points exists at a time, never the whole document. */
+	template <typename cipher_function>
+	static std::string transform(const std::string& text, cipher_function cipher);
+
+	/* Same over a stream, read buffer_size bytes at a time */
+	template <typename cipher_function>
+	static void transform(std::istream& input, std::ostream& output, cipher_function cipher, std::size_t buffer_size = 1 << 16);
+
+private:
+	static const std::size_t invalid = static_cast<std::size_t>(-1);
+
+	static bool validate_scalar(const uint8_t* data, std::size_t size) {
+		std::size_t position = 0;
+		while (position < size) {
+			if (data[position] < 0x80) {
+				position++;
+				continue;
+			}
+
+			try {
+				decode_one(data, size, position);
+			} catch (const InvalidUtf8Exception&) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+#if CIPHERS_SIMD_X86
+	/* Copies the leading ASCII of a block of at least 16 bytes as code points, returns how many */
+	SIMD_TARGET("sse2")
+	static std::size_t widen_ascii_sse2(const uint8_t* data, std::size_t size, uint32_t* output) {
+		const __m128i zero = _mm_setzero_si128();
+		std::size_t i = 0;
+
+		for (; i + 16 <= size; i += 16) {
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			if (_mm_movemask_epi8(block) != 0) break;
+
+			__m128i low = _mm_unpacklo_epi8(block, zero), high = _mm_unpackhi_epi8(block, zero);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_unpacklo_epi16(low, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i + 4), _mm_unpackhi_epi16(low, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i + 8), _mm_unpacklo_epi16(high, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i + 12), _mm_unpackhi_epi16(high, zero));
+		}
+
+		return i;
+	}
+
+	/* Error classes of the lookup algorithm. A byte pair is invalid when the classes its first byte's
+	high nibble, first byte's low nibble and second byte's high nibble allow have one in common. */
+	enum : uint8_t {
+		too_short = 1 << 0, too_long = 1 << 1, overlong_3 = 1 << 2, too_large = 1 << 3,
+		surrogate = 1 << 4, overlong_2 = 1 << 5, too_large_1000 = 1 << 6, overlong_4 = 1 << 6,
+		two_continuations = 1 << 7, carry = too_short | too_long | two_continuations
+	};
+
+	struct LookupTables {
+		uint8_t first_high[16];
+		uint8_t first_low[16];
+		uint8_t second_high[16];
+	};
+
+	static const LookupTables& lookup_tables() {
+		static const LookupTables tables = {
+			{ too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+				two_continuations, two_continuations, two_continuations, two_continuations,
+				too_short | overlong_2, too_short, too_short | overlong_3 | surrogate, too_short | too_large | too_large_1000 | overlong_4 },
+			{ carry | overlong_3 | overlong_2 | overlong_4, carry | overlong_2, carry, carry,
+				carry | too_large, carry | too_large | too_large_1000, carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+				carry | too_large | too_large_1000, carry | too_large | too_large_1000, carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+				carry | too_large | too_large_1000, carry | too_large | too_large_1000 | surrogate, carry | too_large | too_large_1000, carry | too_large | too_large_1000 },
+			{ too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+				too_long | overlong_2 | two_continuations | overlong_3 | too_large_1000 | overlong_4,
+				too_long | overlong_2 | two_continuations | overlong_3 | too_large,
+				too_long | overlong_2 | two_continuations | surrogate | too_large,
+				too_long | overlong_2 | two_continuations | surrogate | too_large,
+				too_short, too_short, too_short, too_short }
+		};
+		return tables;
+	}
+
+	/* Returns the number of bytes checked, a multiple of 16, or invalid */
+	SIMD_TARGET("ssse3")
+	static std::size_t validate_ssse3(const uint8_t* data, std::size_t size) {
+		const LookupTables& tables = lookup_tables();
+		const __m128i first_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.first_high));
+		const __m128i first_low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.first_low));
+		const __m128i second_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.second_high));
+		const __m128i nibble = _mm_set1_epi8(0x0F);
+
+		/* Bytes that still need continuations when they are among the last three of a block */
+		const __m128i incomplete_limit = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, static_cast<char>(0xEF), static_cast<char>(0xDF), static_cast<char>(0xBF));
+
+		__m128i previous = _mm_setzero_si128(), incomplete = _mm_setzero_si128(), error = _mm_setzero_si128();
+		std::size_t i = 0;
+
+		for (; i + 16 <= size; i += 16) {
+			__m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			if (_mm_movemask_epi8(input) == 0) {
+				error = _mm_or_si128(error, incomplete);
+				previous = _mm_setzero_si128();
+				incomplete = _mm_setzero_si128();
+				continue;
+			}
+
+			__m128i previous_1 = _mm_alignr_epi8(input, previous, 15);
+			__m128i special = _mm_and_si128(_mm_and_si128(
+				_mm_shuffle_epi8(first_high, _mm_and_si128(_mm_srli_epi16(previous_1, 4), nibble)),
+				_mm_shuffle_epi8(first_low, _mm_and_si128(previous_1, nibble))),
+				_mm_shuffle_epi8(second_high, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+
+			/* Third and fourth bytes of a sequence are the only continuations allowed after a continuation */
+			__m128i third = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 14), _mm_set1_epi8(0xE0 - 0x80));
+			__m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 13), _mm_set1_epi8(0xF0 - 0x80));
+			__m128i required = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(static_cast<char>(0x80)));
+
+			error = _mm_or_si128(error, _mm_xor_si128(required, special));
+			incomplete = _mm_subs_epu8(input, incomplete_limit);
+			previous = input;
+
+			if ((i & 1023) == 1008 && _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF) return invalid;
+		}
+
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF ? i : invalid;
+	}
+
+	SIMD_TARGET("avx2")
+	static std::size_t validate_avx2(const uint8_t* data, std::size_t size) {
+		const LookupTables& tables = lookup_tables();
+		const __m256i first_high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.first_high)));
+		const __m256i first_low = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.first_low)));
+		const __m256i second_high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.second_high)));
+		const __m256i nibble = _mm256_set1_epi8(0x0F);
+		const __m256i incomplete_limit = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, static_cast<char>(0xEF), static_cast<char>(0xDF), static_cast<char>(0xBF));
+
+		__m256i previous = _mm256_setzero_si256(), incomplete = _mm256_setzero_si256(), error = _mm256_setzero_si256();
+		std::size_t i = 0;
+
+		for (; i + 32 <= size; i += 32) {
+			__m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+			if (_mm256_movemask_epi8(input) == 0) {
+				error = _mm256_or_si256(error, incomplete);
+				previous = _mm256_setzero_si256();
+				incomplete = _mm256_setzero_si256();
+				continue;
+			}
+
+			/* alignr works per 128 bit lane, so the lane below each lane of input is built first */
+			__m256i shifted_in = _mm256_permute2x128_si256(previous, input, 0x21);
+			__m256i previous_1 = _mm256_alignr_epi8(input, shifted_in, 15);
+			__m256i special = _mm256_and_si256(_mm256_and_si256(
+				_mm256_shuffle_epi8(first_high, _mm256_and_si256(_mm256_srli_epi16(previous_1, 4), nibble)),
+				_mm256_shuffle_epi8(first_low, _mm256_and_si256(previous_1, nibble))),
+				_mm256_shuffle_epi8(second_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+			__m256i third = _mm256_subs_epu8(_mm256_alignr_epi8(input, shifted_in, 14), _mm256_set1_epi8(0xE0 - 0x80));
+			__m256i fourth = _mm256_subs_epu8(_mm256_alignr_epi8(input, shifted_in, 13), _mm256_set1_epi8(0xF0 - 0x80));
+			__m256i required = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+
+			error = _mm256_or_si256(error, _mm256_xor_si256(required, special));
+			incomplete = _mm256_subs_epu8(input, incomplete_limit);
+			previous = input;
+
+			if ((i & 1023) == 992 && !_mm256_testz_si256(error, error)) return invalid;
+		}
+
+		return _mm256_testz_si256(error, error) ? i : invalid;
+	}
+#endif
+};
+
+/* Feeds UTF-8 text to a code point cipher piece by piece, as it arrives from a file or socket. A
+character split between two pieces is held back until the rest of it comes in. Every chunk is
+validated, decoded into one reused code point buffer, enciphered there and encoded onto the output. */
+class Utf8Transcoder {
+public:
+	explicit Utf8Transcoder(std::size_t chunk_size = 1 << 14) : code_points(chunk_size == 0 ? 1 : chunk_size) {}
+
+	/* Appends the enciphered text of every complete character of the piece to output */
+	template <typename cipher_function>
+	void update(const uint8_t* data, std::size_t size, std::string& output, cipher_function cipher) {
+		while (pending_size > 0 && size > 0) {
+			pending[pending_size++] = *data++;
+			size--;
+
+			std::size_t length = Utf8::sequence_length(pending[0]);
+			if (length == 0 || (pending[pending_size - 1] & 0xC0) != 0x80) throw Utf8::InvalidUtf8Exception();
+			if (pending_size < length) continue;
+
+			std::size_t position = 0;
+			code_points[0] = Utf8::decode_one(pending, length, position);
+			cipher(code_points.data(), std::size_t(1));
+			Utf8::encode_append(code_points.data(), 1, output);
+			pending_size = 0;
+		}
+
+		if (pending_size > 0) return;
+
+		std::size_t complete = complete_prefix(data, size);
+		std::size_t offset = 0;
+
+		while (offset < complete) {
+			std::size_t chunk = complete_prefix(data + offset, std::min(code_points.size(), complete - offset));
+			if (chunk == 0) chunk = std::min(std::max<std::size_t>(Utf8::sequence_length(data[offset]), 1), complete - offset);
+			if (!Utf8::validate(data + offset, chunk)) throw Utf8::InvalidUtf8Exception();
+
+			std::size_t count = Utf8::decode_valid(data + offset, chunk, code_points.data());
+			cipher(code_points.data(), count);
+			Utf8::encode_append(code_points.data(), count, output);
+			offset += chunk;
+		}
+
+		std::memcpy(pending, data + complete, size - complete);
+		pending_size = size - complete;
+	}
+
+	/* Throws if the text ended in the middle of a character */
+	void finish() {
+		if (pending_size != 0) throw Utf8::InvalidUtf8Exception();
+	}
+
+private:
+	/* Size without a trailing character that is still missing continuation bytes */
+	static std::size_t complete_prefix(const uint8_t* data, std::size_t size) {
+		std::size_t lookback = std::min<std::size_t>(size, 3);
+		for (std::size_t back = 1; back <= lookback; back++) {
+			uint8_t byte = data[size - back];
+			if ((byte & 0xC0) == 0x80) continue;
+
+			std::size_t length = Utf8::sequence_length(byte);
+			return length > back ? size - back : size;
+		}
+		return size;
+	}
+
+	std::vector<uint32_t> code_points;
+	uint8_t pending[4];
+	std::size_t pending_size = 0;
+};
+
+template <typename cipher_function>
+std::string Utf8::transform(const std::string& text, cipher_function cipher) {
+	std::string output;
+	output.reserve(text.size());
+
+	Utf8Transcoder transcoder;
+	transcoder.update(reinterpret_cast<const uint8_t*>(text.data()), text.size(), output, cipher);
+	transcoder.finish();
+	return output;
+}
+
+template <typename cipher_function>
+void Utf8::transform(std::istream& input, std::ostream& output, cipher_function cipher, std::size_t buffer_size) {
+	std::vector<char> buffer(buffer_size == 0 ? 1 : buffer_size);
+	std::string encoded;
+	Utf8Transcoder transcoder;
+
+	while (input) {
+		input.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		std::streamsize received = input.gcount();
+		if (received <= 0) break;
+
+		encoded.clear();
+		transcoder.update(reinterpret_cast<const uint8_t*>(buffer.data()), static_cast<std::size_t>(received), encoded, cipher);
+		output.write(encoded.data(), static_cast<std::streamsize>(encoded.size()));
+	}
+
+	transcoder.finish();
+}
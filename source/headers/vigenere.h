@@ -1,18 +1,29 @@
 #pragma once
 
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 #include <string>
 #include <vector>
+#include <memory>
+
+#include "alphabet.h"
+#include "arena.h"
+#include "metrics.h"
+#include "simd.h"
+#include "span.h"
+#include "utf8.h"
 
 class Vigenere {
 public:
 	template <typename matrix_type>
 	using matrix = std::vector<std::vector<matrix_type>>;
 
-	class ZeroBaseLengthException : public std::exception {
-	public: ZeroBaseLengthException() : std::exception("Length of supplied base vector is zero.") {}
+	class ZeroBaseLengthException : public std::runtime_error {
+	public: ZeroBaseLengthException() : std::runtime_error("Length of supplied base vector is zero.") {}
 	};
-	class ZeroKeyLengthException : public std::exception {
-	public: ZeroKeyLengthException() : std::exception("Length of supplied key is zero.") {}
+	class ZeroKeyLengthException : public std::runtime_error {
+	public: ZeroKeyLengthException() : std::runtime_error("Length of supplied key is zero.") {}
 	};
 
 	static matrix<uint32_t> construct_matrix(std::vector<uint32_t> base)  {
@@ -34,100 +45,463 @@ public:
 		return matrix_buffer;
 	}
 
-	static std::vector<uint32_t> matrix_encode(matrix<uint32_t>& matrix, std::vector<uint32_t> data, std::vector<uint32_t> key)  {
-		if (key.size() == 0) throw ZeroKeyLengthException();
-		std::vector<uint32_t> encoded_matrix;
-		
-		uint32_t key_position = 0;
+	/* Index of every key symbol in the alphabet, -1 for symbols that do not appear in it */
+	template <typename alphabet_type, typename key_type>
+	static std::vector<int32_t> key_indices(const alphabet_type& alphabet, const key_type* key, std::size_t key_size) {
+		if (key_size == 0) throw ZeroKeyLengthException();
+
+		std::vector<int32_t> indices(key_size);
+		key_indices(alphabet, key, key_size, indices.data());
+		return indices;
+	}
+
+	/* Same, written into indices, which must hold key_size entries */
+	template <typename alphabet_type, typename key_type>
+	static void key_indices(const alphabet_type& alphabet, const key_type* key, std::size_t key_size, int32_t* indices) {
+		for (std::size_t i = 0; i < key_size; i++) indices[i] = alphabet.index_of(static_cast<uint32_t>(key[i]));
+	}
+
+	template <typename alphabet_type>
+	static std::vector<int32_t> key_indices(const alphabet_type& alphabet, const std::vector<uint32_t>& key) {
+		return key_indices(alphabet, key.data(), key.size());
+	}
 
-		for (std::size_t i = 0; i < data.size(); i++) {
-			uint32_t data_index;
-			uint32_t key_index;
+	/* Row i of the tabula recta is the alphabet rotated by i, so a lookup in it is an addition modulo
+	the alphabet size and decoding is the matching subtraction. Symbols outside the alphabet pass
+	through and do not move the key, just like they do in the matrix, and a key symbol outside the
+	alphabet stalls the key from there on. Returns the key position after the data. The key indices can
+	be any container with size() and operator[], a vector from key_indices or a span. */
+	template <typename alphabet_type, typename indices_type, typename symbol_type>
+	static std::size_t alphabet_apply(const alphabet_type& alphabet, const indices_type& key_indices, const symbol_type* data, symbol_type* output, std::size_t size, bool decode_lookup = false, std::size_t key_position = 0, bool preserve_case = true) {
+		CIPHERS_METRICS_SCOPE("vigenere", decode_lookup ? "alphabet_decode" : "alphabet_encode", size);
+		const std::size_t alphabet_size = alphabet.size();
+		key_position %= key_indices.size();
 
-			auto data_iterator = std::find(matrix.at(0).begin(), matrix.at(0).end(), data.at(i));
-			auto key_iterator = std::find(matrix.at(0).begin(), matrix.at(0).end(), key.at(key_position));
+		for (std::size_t i = 0; i < size; i++) {
+			bool uppercase = false;
+			int32_t data_index = alphabet.locate(static_cast<uint32_t>(data[i]), uppercase);
+			int32_t key_index = key_indices[key_position];
 
-			if (data_iterator == matrix.at(0).end() || key_iterator == matrix.at(0).end()) {
-				encoded_matrix.push_back(data.at(i));
+			if (data_index < 0) {
+				output[i] = data[i];
 				continue;
 			}
 
-			data_index = std::distance(matrix.at(0).begin(), data_iterator);
-			key_index = std::distance(matrix.at(0).begin(), key_iterator);
-
-			uint32_t encoded_data = matrix.at(data_index).at(key_index);
-			encoded_matrix.push_back(encoded_data);
+			std::size_t shifted = static_cast<std::size_t>(data_index);
+			if (key_index >= 0) {
+				shifted = decode_lookup ? shifted + alphabet_size - key_index : shifted + key_index;
+				if (shifted >= alphabet_size) shifted -= alphabet_size;
+				if (++key_position == key_indices.size()) key_position = 0;
+			}
 
-			key_position++;
-			if (key_position > key.size() - 1) key_position = 0;
+			output[i] = static_cast<symbol_type>(alphabet.symbol_at(shifted, uppercase && preserve_case));
 		}
 
-		return encoded_matrix;
+		return key_position;
+	}
+
+	static std::vector<uint32_t> alphabet_apply(const Alphabet& alphabet, const std::vector<uint32_t>& data, const std::vector<uint32_t>& key, bool decode_lookup = false) {
+		if (key.size() == 0) throw ZeroKeyLengthException();
+
+		/* The key indices are scratch, only the output comes from the heap */
+		Arena::Scope scratch;
+		ScratchVector<int32_t> indices(key.size());
+		key_indices(alphabet, key.data(), key.size(), indices.data());
+
+		std::vector<uint32_t> output(data.size());
+		alphabet_apply(alphabet, indices, data.data(), output.data(), data.size(), decode_lookup);
+		return output;
+	}
+
+	/* The matrix is expected to come from construct_matrix, only its first row is read */
+	static std::vector<uint32_t> matrix_encode(matrix<uint32_t>& matrix, std::vector<uint32_t> data, std::vector<uint32_t> key)  {
+		if (key.size() == 0) throw ZeroKeyLengthException();
+		return alphabet_apply(Alphabet(matrix.at(0)), data, key, false);
 	}
 
 	static std::vector<uint32_t> matrix_decode(matrix<uint32_t>& matrix, std::vector<uint32_t> encoded, std::vector<uint32_t> key)  {
 		if (key.size() == 0) throw ZeroKeyLengthException();
-		std::vector<uint32_t> decoded_matrix;
-		uint32_t key_position = 0;
+		return alphabet_apply(Alphabet(matrix.at(0)), encoded, key, true);
+	}
 
-		for (std::size_t i = 0; i < encoded.size(); i++) {
-			uint32_t key_index;
+	/* Shift of every key character over the latin alphabet, or -1 for characters that are not letters.
+	Like matrix_encode, the key position never moves past a non-letter, so everything after it is left as is. */
+	static std::vector<int32_t> key_shifts(const uint8_t* key, std::size_t key_size) {
+		return key_indices(Alphabets::latin(), key, key_size);
+	}
 
-			auto data_iterator = std::find(matrix.at(0).begin(), matrix.at(0).end(), encoded.at(i));
-			auto key_iterator = std::find(matrix.at(0).begin(), matrix.at(0).end(), key.at(key_position));
-			
-			if (key_iterator == matrix.at(0).end() || data_iterator == matrix.at(0).end()) {
-				decoded_matrix.push_back(encoded.at(i));
-				continue;
-			}
+	static void key_shifts(const uint8_t* key, std::size_t key_size, int32_t* shifts) {
+		key_indices(Alphabets::latin(), key, key_size, shifts);
+	}
 
-			key_index = std::distance(matrix.at(0).begin(), key_iterator);
+	/* Key position reached after the given number of letters have been processed starting at key_position */
+	static std::size_t advance_key(Span<const int32_t> shifts, std::size_t key_position, uint64_t letters) {
+		for (std::size_t distance = 0; distance < shifts.size(); distance++) {
+			std::size_t position = (key_position + distance) % shifts.size();
+			if (shifts[position] < 0) return distance < letters ? position : (key_position + letters) % shifts.size();
+		}
 
-			for (std::size_t c = 0; c < matrix.size(); c++) {
-				if (matrix.at(c).at(key_index) == encoded.at(i)) 
-					decoded_matrix.push_back(matrix.at(0).at(c));
-			}
+		return static_cast<std::size_t>((key_position + letters) % shifts.size());
+	}
+
+	/* Number of data symbols that appear in the alphabet, which is how far the key moves over the data */
+	template <typename alphabet_type, typename symbol_type>
+	static uint64_t count_symbols(const alphabet_type& alphabet, const symbol_type* data, std::size_t size) {
+		uint64_t symbols = 0;
+		for (std::size_t i = 0; i < size; i++) symbols += alphabet.index_of(static_cast<uint32_t>(data[i])) >= 0;
+		return symbols;
+	}
+
+	static uint64_t count_letters(const uint8_t* data, std::size_t size) {
+		return count_symbols(Alphabets::latin(), data, size);
+	}
+
+	/* Everything the byte kernel derives from a key, built once so it can be reused across calls */
+	struct KeySchedule {
+		std::vector<int32_t> shifts;
 
-			key_position++;
-			if (key_position > key.size() - 1) key_position = 0;
+		/* Shifts repeated past the end of the key for the vector kernels, empty when the key stalls */
+		std::vector<uint8_t> encode_stream;
+		std::vector<uint8_t> decode_stream;
+	};
+
+	static KeySchedule key_schedule(const std::vector<int32_t>& shifts) {
+		KeySchedule schedule;
+		schedule.shifts = shifts;
+
+		if (std::find_if(shifts.begin(), shifts.end(), [](int32_t shift) { return shift < 0; }) == shifts.end()) {
+			schedule.encode_stream.resize(shifts.size() + key_stream_padding);
+			schedule.decode_stream.resize(shifts.size() + key_stream_padding);
+			fill_key_stream(shifts, false, schedule.encode_stream.data());
+			fill_key_stream(shifts, true, schedule.decode_stream.data());
+		}
+
+		return schedule;
+	}
+
+	static KeySchedule key_schedule(const uint8_t* key, std::size_t key_size) {
+		return key_schedule(key_shifts(key, key_size));
+	}
+
+	/* Byte oriented equivalent of vigenere_lookup over the latin alphabet, starting at key_position.
+	Returns the key position that follows the last processed byte. Input and output may alias. */
+	static std::size_t vigenere_apply(const uint8_t* input, uint8_t* output, std::size_t size, const KeySchedule& schedule, std::size_t key_position = 0, bool decode_lookup = false, bool preserve_case = true) {
+		CIPHERS_METRICS_SCOPE("vigenere", decode_lookup ? "decode" : "encode", size);
+		const uint8_t* key_stream = nullptr;
+		if (!schedule.encode_stream.empty()) key_stream = decode_lookup ? schedule.decode_stream.data() : schedule.encode_stream.data();
+		return apply_stream(input, output, size, schedule.shifts, key_stream, key_position, decode_lookup, preserve_case);
+	}
+
+	/* Same from bare shifts, the one key stream the direction needs is built in the thread's arena.
+	Short inputs never reach the vector kernels, so they skip building it. */
+	static std::size_t vigenere_apply(const uint8_t* input, uint8_t* output, std::size_t size, Span<const int32_t> shifts, std::size_t key_position = 0, bool decode_lookup = false, bool preserve_case = true) {
+		CIPHERS_METRICS_SCOPE("vigenere", decode_lookup ? "decode" : "encode", size);
+		Arena::Scope scratch;
+		ScratchVector<uint8_t> key_stream;
+
+		if (size >= 64 && std::find_if(shifts.begin(), shifts.end(), [](int32_t shift) { return shift < 0; }) == shifts.end()) {
+			key_stream.resize(shifts.size() + key_stream_padding);
+			fill_key_stream(shifts, decode_lookup, key_stream.data());
 		}
 
-		return decoded_matrix;
+		return apply_stream(input, output, size, shifts, key_stream.empty() ? nullptr : key_stream.data(), key_position, decode_lookup, preserve_case);
 	}
-	
-	static std::string vigenere_lookup(std::string data, std::string key, bool decode_lookup = false, bool preserve_case=true) {
+
+	static std::string vigenere_lookup(std::string data, const std::string& key, bool decode_lookup = false, bool preserve_case=true) {
 		if (key.size() == 0) throw ZeroKeyLengthException();
+		if (data.empty()) return data;
+
+		vigenere_lookup(byte_span(data), byte_span(data), byte_span(key), decode_lookup, preserve_case);
+		return data;
+	}
 
-		std::vector<std::vector<uint32_t>> matrix = 
-			construct_matrix({'a','b','c','d','e','f','g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v','w','x','y','z'});
+	/* Span form of vigenere_lookup that writes into output and returns the key position after the
+	input. Never allocates: keys of up to stack_key_size characters get their key stream built on the
+	stack for the vector kernels, longer keys take the scalar path and read their shifts straight
+	from the key. Input and output may alias. */
+	static std::size_t vigenere_lookup(Span<const uint8_t> input, Span<uint8_t> output, Span<const uint8_t> key, bool decode_lookup = false, bool preserve_case = true, std::size_t key_position = 0) {
+		CIPHERS_METRICS_SCOPE("vigenere", decode_lookup ? "decode" : "encode", input.size());
+		if (key.empty()) throw ZeroKeyLengthException();
+		require_output(output, input.size());
 
-		std::vector<uint32_t> uppercases;
-		if (preserve_case) {
-			for (std::size_t i = 0; i < data.size(); i++) {
-				char& ichar = data.at(i);
-				if (ichar >= 'A' && ichar <= 'Z') uppercases.push_back(i);
-			}
+		const int8_t* table = Alphabets::latin().index_table();
+		if (key.size() > stack_key_size) return apply_stream(input.data(), output.data(), input.size(), LatinKey{ key.data(), key.size(), table }, nullptr, key_position, decode_lookup, preserve_case);
+
+		int32_t shifts[stack_key_size];
+		uint8_t key_stream[stack_key_size + key_stream_padding];
+		bool stalled = false;
+
+		for (std::size_t i = 0; i < key.size(); i++) {
+			shifts[i] = table[key[i]];
+			stalled = stalled || shifts[i] < 0;
+		}
+
+		if (!stalled) fill_key_stream(Span<const int32_t>(shifts, key.size()), decode_lookup, key_stream);
+		return apply_stream(input.data(), output.data(), input.size(), Span<const int32_t>(shifts, key.size()), stalled ? nullptr : key_stream, key_position, decode_lookup, preserve_case);
+	}
+
+private:
+	/* Extra key stream past the key so a full vector of shifts can be loaded from any key position */
+	static const std::size_t key_stream_padding = 32;
+
+	/* Longest key the span form of vigenere_lookup compiles on the stack */
+	static const std::size_t stack_key_size = 256;
+
+	/* Shifts read straight from key characters, for keys too long to compile on the stack */
+	struct LatinKey {
+		const uint8_t* key;
+		std::size_t key_size;
+		const int8_t* table;
+
+		int32_t operator[](std::size_t index) const { return table[key[index]]; }
+		std::size_t size() const { return key_size; }
+	};
+
+	/* Shifts of a key that does not stall, repeated for key_stream_padding entries past its end.
+	Decoding streams hold the shift that undoes each one. */
+	template <typename shifts_type>
+	static void fill_key_stream(const shifts_type& shifts, bool decode_lookup, uint8_t* key_stream) {
+		for (std::size_t i = 0; i < shifts.size() + key_stream_padding; i++) {
+			uint8_t shift = static_cast<uint8_t>(shifts[i % shifts.size()]);
+			key_stream[i] = decode_lookup ? static_cast<uint8_t>((26 - shift) % 26) : shift;
+		}
+	}
+
+	/* Vector kernels first when there is a key stream, which a stalled key never has, then the
+	scalar path for the rest */
+	template <typename shifts_type>
+	static std::size_t apply_stream(const uint8_t* input, uint8_t* output, std::size_t size, const shifts_type& shifts, const uint8_t* key_stream, std::size_t key_position, bool decode_lookup, bool preserve_case) {
+		const std::size_t key_size = shifts.size();
+		key_position %= key_size;
+		std::size_t processed = 0;
+
+#if CIPHERS_SIMD_X86
+		Simd::Level level = Simd::level();
+		if (level >= Simd::Level::SSSE3 && key_stream != nullptr) {
+			if (level >= Simd::Level::AVX2) processed = apply_avx2(input, output, size, key_stream, key_size, key_position, preserve_case);
+			else processed = apply_ssse3(input, output, size, key_stream, key_size, key_position, preserve_case);
 		}
+#endif
 
-		std::vector<uint32_t> data_vector, key_vector;
-		data_vector = std::vector<uint32_t>(data.begin(), data.end());
-		key_vector = std::vector<uint32_t>(key.begin(), key.end());
+		return alphabet_apply(Alphabets::latin(), shifts, input + processed, output + processed, size - processed, decode_lookup, key_position, preserve_case);
+	}
 
-		auto lower_caser = [](std::vector<uint32_t>* target) {
-			for (std::size_t i = 0; i < target->size(); i++) {
-				uint32_t& index_data = target->at(i);
-				if (index_data >= 'A' && index_data <= 'Z') {
-					target->at(i) += 32;
+	/* For every byte mask, the shuffle control that spreads consecutive key shifts over the lanes whose
+	bit is set (0x80 zeroes the others), and how many lanes that was. This is how the key, which only
+	moves on letters, is lined up with the letters of a vector without a per byte loop. */
+	struct ExpandTable {
+		uint8_t lanes[256][8];
+		uint8_t counts[256];
+
+		constexpr ExpandTable() : lanes{}, counts{} {
+			for (uint32_t mask = 0; mask < 256; mask++) {
+				uint8_t count = 0;
+				for (uint32_t lane = 0; lane < 8; lane++) {
+					if (mask & (1u << lane)) lanes[mask][lane] = count++;
+					else lanes[mask][lane] = 0x80;
 				}
+				counts[mask] = count;
+			}
+		}
+	};
+
+	static const ExpandTable& expand_table() {
+		static constexpr ExpandTable table;
+		return table;
+	}
+
+#if CIPHERS_SIMD_X86
+	/* Shuffle control for 16 lanes with the given letter mask, returns the number of letters in it */
+	static __m128i expand_control(uint32_t mask, uint32_t& letters) {
+		const ExpandTable& table = expand_table();
+		uint32_t low = mask & 0xFF, high = (mask >> 8) & 0xFF;
+
+		uint64_t low_lanes, high_lanes;
+		std::memcpy(&low_lanes, table.lanes[low], 8);
+		std::memcpy(&high_lanes, table.lanes[high], 8);
+
+		/* Lanes of the upper half continue where the lower half stopped, the 0x80 lanes stay negative */
+		high_lanes += 0x0101010101010101ull * table.counts[low];
+		letters = table.counts[low] + table.counts[high];
+		return _mm_set_epi64x(static_cast<long long>(high_lanes), static_cast<long long>(low_lanes));
+	}
+
+	SIMD_TARGET("ssse3")
+	static std::size_t apply_ssse3(const uint8_t* input, uint8_t* output, std::size_t size, const uint8_t* key_stream, std::size_t key_size, std::size_t& key_position, bool preserve_case) {
+		const __m128i case_bit = _mm_set1_epi8(0x20);
+		const __m128i letter_a = _mm_set1_epi8('a');
+		const __m128i last_index = _mm_set1_epi8(25);
+		const __m128i alphabet_size = _mm_set1_epi8(26);
+		const __m128i case_mask = preserve_case ? case_bit : _mm_setzero_si128();
+		std::size_t i = 0;
+
+		for (; i + 16 <= size; i += 16) {
+			__m128i data_vector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+			__m128i lowered = _mm_or_si128(data_vector, case_bit);
+			__m128i letter_index = _mm_sub_epi8(lowered, letter_a);
+			__m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter_index, last_index), letter_index);
+
+			uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(is_letter));
+			if (mask == 0) {
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), data_vector);
+				continue;
+			}
+
+			uint32_t letters;
+			__m128i control = expand_control(mask, letters);
+			__m128i shifts = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(key_stream + key_position)), control);
+
+			__m128i shifted = _mm_add_epi8(letter_index, shifts);
+			shifted = _mm_sub_epi8(shifted, _mm_and_si128(_mm_cmpgt_epi8(shifted, last_index), alphabet_size));
+
+			/* Uppercase letters are the ones that differ from their lowered form */
+			__m128i encoded = _mm_xor_si128(_mm_add_epi8(shifted, letter_a), _mm_and_si128(_mm_xor_si128(data_vector, lowered), case_mask));
+			__m128i result = _mm_or_si128(_mm_and_si128(is_letter, encoded), _mm_andnot_si128(is_letter, data_vector));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), result);
+
+			key_position += letters;
+			if (key_position >= key_size) key_position %= key_size;
+		}
+
+		return i;
+	}
+
+	SIMD_TARGET("avx2")
+	static std::size_t apply_avx2(const uint8_t* input, uint8_t* output, std::size_t size, const uint8_t* key_stream, std::size_t key_size, std::size_t& key_position, bool preserve_case) {
+		const __m256i case_bit = _mm256_set1_epi8(0x20);
+		const __m256i letter_a = _mm256_set1_epi8('a');
+		const __m256i last_index = _mm256_set1_epi8(25);
+		const __m256i alphabet_size = _mm256_set1_epi8(26);
+		const __m256i case_mask = preserve_case ? case_bit : _mm256_setzero_si256();
+		std::size_t i = 0;
+
+		for (; i + 32 <= size; i += 32) {
+			__m256i data_vector = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+			__m256i lowered = _mm256_or_si256(data_vector, case_bit);
+			__m256i letter_index = _mm256_sub_epi8(lowered, letter_a);
+			__m256i is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter_index, last_index), letter_index);
+
+			uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(is_letter));
+			if (mask == 0) {
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), data_vector);
+				continue;
 			}
-		};
-		
-		lower_caser(&data_vector);
-		lower_caser(&key_vector);
-		
-		std::vector<uint32_t> output_data = decode_lookup ? matrix_decode(matrix, data_vector, key_vector) : matrix_encode(matrix, data_vector, key_vector);
-		for (std::size_t i = 0; i < uppercases.size(); i++) output_data.at(uppercases.at(i)) -= 32;
-		return std::string(output_data.begin(), output_data.end());
+
+			/* pshufb stays within 128 bit lanes, so each lane gets its own window of the key stream */
+			uint32_t low_letters, high_letters;
+			__m128i low_control = expand_control(mask & 0xFFFF, low_letters);
+			__m128i high_control = expand_control(mask >> 16, high_letters);
+
+			std::size_t high_position = key_position + low_letters;
+			if (high_position >= key_size) high_position %= key_size;
+
+			__m256i key_window = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(key_stream + key_position))), _mm_loadu_si128(reinterpret_cast<const __m128i*>(key_stream + high_position)), 1);
+			__m256i control = _mm256_inserti128_si256(_mm256_castsi128_si256(low_control), high_control, 1);
+			__m256i shifts = _mm256_shuffle_epi8(key_window, control);
+
+			__m256i shifted = _mm256_add_epi8(letter_index, shifts);
+			shifted = _mm256_sub_epi8(shifted, _mm256_and_si256(_mm256_cmpgt_epi8(shifted, last_index), alphabet_size));
+
+			__m256i encoded = _mm256_xor_si256(_mm256_add_epi8(shifted, letter_a), _mm256_and_si256(_mm256_xor_si256(data_vector, lowered), case_mask));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_blendv_epi8(data_vector, encoded, is_letter));
+
+			key_position = high_position + high_letters;
+			if (key_position >= key_size) key_position %= key_size;
+		}
+
+		return i;
+	}
+#endif
+};
+
+/* Vigenere key compiled once and reused across messages. Built from a string key it works like
+vigenere_lookup over the latin alphabet, built from a base and key it works like matrix_encode, and
+built from an alphabet it works over that alphabet's symbols and case. */
+class CompiledVigenere {
+public:
+	explicit CompiledVigenere(const std::string& key, bool preserve_case = true)
+		: schedule(Vigenere::key_schedule(reinterpret_cast<const uint8_t*>(key.data()), key.size())), preserve_case(preserve_case) {}
+
+	CompiledVigenere(const std::vector<uint32_t>& base, const std::vector<uint32_t>& key)
+		: CompiledVigenere(checked_alphabet(base), key, false) {}
+
+	CompiledVigenere(const Alphabet& alphabet, const std::vector<uint32_t>& key, bool preserve_case = true)
+		: alphabet(std::make_shared<Alphabet>(alphabet)), key_indices(Vigenere::key_indices(alphabet, key)), preserve_case(preserve_case) {}
+
+	std::size_t encode(const uint8_t* input, uint8_t* output, std::size_t size, std::size_t key_position = 0) const {
+		return apply(input, output, size, key_position, false);
+	}
+
+	std::size_t decode(const uint8_t* input, uint8_t* output, std::size_t size, std::size_t key_position = 0) const {
+		return apply(input, output, size, key_position, true);
+	}
+
+	/* Span forms, output must be at least as large as input */
+	std::size_t encode(Span<const uint8_t> input, Span<uint8_t> output, std::size_t key_position = 0) const {
+		require_output(output, input.size());
+		return apply(input.data(), output.data(), input.size(), key_position, false);
+	}
+
+	std::size_t decode(Span<const uint8_t> input, Span<uint8_t> output, std::size_t key_position = 0) const {
+		require_output(output, input.size());
+		return apply(input.data(), output.data(), input.size(), key_position, true);
+	}
+
+	std::string encode(std::string data) const { return apply(std::move(data), false); }
+	std::string decode(std::string data) const { return apply(std::move(data), true); }
+
+	/* Only available when built from a base or alphabet */
+	std::vector<uint32_t> encode(std::vector<uint32_t> data) const { return apply(std::move(data), false); }
+	std::vector<uint32_t> decode(std::vector<uint32_t> data) const { return apply(std::move(data), true); }
+
+	/* UTF-8 text over a base or alphabet of code points, the key carries on from one chunk to the next */
+	std::string encode_utf8(const std::string& text) const { return apply_utf8(text, false); }
+	std::string decode_utf8(const std::string& text) const { return apply_utf8(text, true); }
+
+	void encode_utf8(std::istream& input, std::ostream& output) const { apply_utf8(input, output, false); }
+	void decode_utf8(std::istream& input, std::ostream& output) const { apply_utf8(input, output, true); }
+
+private:
+	std::size_t apply(const uint8_t* input, uint8_t* output, std::size_t size, std::size_t key_position, bool decode_lookup) const {
+		if (alphabet) return Vigenere::alphabet_apply(*alphabet, key_indices, input, output, size, decode_lookup, key_position, preserve_case);
+		return Vigenere::vigenere_apply(input, output, size, schedule, key_position, decode_lookup, preserve_case);
+	}
+
+	std::string apply(std::string data, bool decode_lookup) const {
+		if (!data.empty()) apply(reinterpret_cast<const uint8_t*>(data.data()), reinterpret_cast<uint8_t*>(&data[0]), data.size(), 0, decode_lookup);
+		return data;
+	}
+
+	std::vector<uint32_t> apply(std::vector<uint32_t> data, bool decode_lookup) const {
+		if (!alphabet) throw Vigenere::ZeroBaseLengthException();
+		Vigenere::alphabet_apply(*alphabet, key_indices, data.data(), data.data(), data.size(), decode_lookup, 0, preserve_case);
+		return data;
+	}
+
+	std::string apply_utf8(const std::string& text, bool decode_lookup) const {
+		if (!alphabet) throw Vigenere::ZeroBaseLengthException();
+		std::size_t key_position = 0;
+		return Utf8::transform(text, [&](uint32_t* code_points, std::size_t count) {
+			key_position = Vigenere::alphabet_apply(*alphabet, key_indices, code_points, code_points, count, decode_lookup, key_position, preserve_case);
+		});
+	}
+
+	void apply_utf8(std::istream& input, std::ostream& output, bool decode_lookup) const {
+		if (!alphabet) throw Vigenere::ZeroBaseLengthException();
+		std::size_t key_position = 0;
+		Utf8::transform(input, output, [&](uint32_t* code_points, std::size_t count) {
+			key_position = Vigenere::alphabet_apply(*alphabet, key_indices, code_points, code_points, count, decode_lookup, key_position, preserve_case);
+		});
+	}
+
+	static Alphabet checked_alphabet(const std::vector<uint32_t>& base) {
+		if (base.empty()) throw Vigenere::ZeroBaseLengthException();
+		return Alphabet(base);
 	}
+
+	Vigenere::KeySchedule schedule;
+	std::shared_ptr<const Alphabet> alphabet;
+	std::vector<int32_t> key_indices;
+	bool preserve_case;
 };
 
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "alphabet.h"
+#include "language_model.h"
+#include "metrics.h"
+#include "frequency_analysis.h"
+#include "thread_pool.h"
+#include "vigenere.h"
+
+struct VigenereAnalysisOptions {
+	/* Longest key length that is tried */
+	std::size_t max_period = 40;
+
+	/* Length of the repeated sequences Kasiski examination looks for, between 3 and 6 */
+	std::size_t kasiski_length = 4;
+
+	/* Kasiski only looks at the start of the ciphertext, repeats are plentiful long before this */
+	std::size_t kasiski_letters = std::size_t(1) << 18;
+
+	/* Letters the column coincidences of every period are measured over, the coincidence is settled
+	long before this and keys are still solved over the whole ciphertext */
+	std::size_t period_letters = std::size_t(1) << 18;
+
+	/* Number of keys returned, each from a different period */
+	std::size_t key_candidates = 3;
+
+	/* Pool the periods are spread over, the shared pool when left empty */
+	ThreadPool* pool = nullptr;
+};
+
+/* Recovers unknown Vigenere keys from ciphertext, under the same rules as vigenere_lookup: only latin
+letters are enciphered and only they move the key. The ciphertext is reduced to letter indices once,
+then every candidate period gets its column histograms in a single sequential pass over them, with the
+columns of one period laid out next to each other. Periods run in parallel. The index of coincidence
+of the columns picks the period, Kasiski examination and the Friedman test are reported beside it, and
+every column is then solved as a Caesar shift with chi-squared against the language model. */
+class VigenereAnalysis {
+public:
+	using Options = VigenereAnalysisOptions;
+
+	struct Period {
+		std::size_t period;
+
+		/* Mean index of coincidence of the columns, close to the language's for the right period */
+		double coincidence;
+
+		/* Share of repeated sequences whose distance is a multiple of the period */
+		double kasiski;
+	};
+
+	struct KeyCandidate {
+		std::string key;
+
+		/* Sum of the chi-squared of every column, lower is a better fit */
+		double chi_squared;
+
+		/* Product of the confidences of the column shifts */
+		double confidence;
+	};
+
+	struct Report {
+		/* Index of coincidence of the whole ciphertext and the key length the Friedman test derives from it */
+		double coincidence;
+		double friedman_period;
+
+		/* Every candidate period, best first */
+		std::vector<Period> periods;
+
+		/* Recovered keys, the most likely first */
+		std::vector<KeyCandidate> keys;
+	};
+
+	/* Alphabet index of every latin letter in the data, in order, everything else dropped */
+	static std::vector<uint8_t> letter_indices(const uint8_t* data, std::size_t size) {
+		const int8_t* table = Alphabets::latin().index_table();
+		std::vector<uint8_t> letters(size + 1);
+		std::size_t count = 0;
+
+		/* Every byte is written, only letters advance the output */
+		for (std::size_t i = 0; i < size; i++) {
+			int8_t index = table[data[i]];
+			letters[count] = static_cast<uint8_t>(index);
+			count += index >= 0;
+		}
+
+		letters.resize(count);
+		return letters;
+	}
+
+	/* Letter counts of each column when the letters are dealt round robin into period columns,
+	column c occupies entries [c * 26, c * 26 + 26) */
+	static std::vector<uint64_t> column_histograms(const std::vector<uint8_t>& letters, std::size_t period) {
+		const std::size_t letter_count = LanguageModel::letter_count;
+		std::vector<uint64_t> counts(period * letter_count, 0);
+
+		uint64_t* row = counts.data();
+		uint64_t* const end = row + counts.size();
+		for (uint8_t letter : letters) {
+			row[letter]++;
+			row += letter_count;
+			if (row == end) row = counts.data();
+		}
+
+		return counts;
+	}
+
+	static double index_of_coincidence(const uint64_t* counts) {
+		double total = 0, pairs = 0;
+		for (std::size_t i = 0; i < LanguageModel::letter_count; i++) {
+			total += static_cast<double>(counts[i]);
+			pairs += static_cast<double>(counts[i]) * (static_cast<double>(counts[i]) - 1);
+		}
+
+		return total > 1 ? pairs / (total * (total - 1)) : 0;
+	}
+
+	/* Share of Kasiski repeat distances divisible by each period, indexed by period. Sequences are
+	indexed by their base 26 value in an open addressing table that keeps their last position. */
+	static std::vector<double> kasiski(const std::vector<uint8_t>& letters, const Options& options = Options()) {
+		std::vector<double> shares(options.max_period + 1, 0);
+		std::size_t length = std::min<std::size_t>(std::max<std::size_t>(options.kasiski_length, 3), 6);
+		std::size_t scanned = std::min(letters.size(), options.kasiski_letters);
+		if (scanned <= length) return shares;
+
+		uint32_t modulus = 1;
+		for (std::size_t i = 0; i < length; i++) modulus *= LanguageModel::letter_count;
+
+		/* Distances are tallied first, their divisors only once per distinct distance */
+		std::vector<uint32_t> distances(scanned, 0);
+		SymbolMap last_seen(scanned);
+		uint32_t sequence = 0;
+		uint64_t repeats = 0;
+
+		for (std::size_t i = 0; i < scanned; i++) {
+			sequence = (sequence * LanguageModel::letter_count + letters[i]) % modulus;
+			if (i + 1 < length) continue;
+
+			int32_t previous = last_seen.get(sequence);
+			if (previous >= 0) {
+				distances[i - previous]++;
+				repeats++;
+			}
+			last_seen.set(sequence, static_cast<int32_t>(i));
+		}
+
+		if (repeats == 0) return shares;
+		for (std::size_t period = 1; period <= options.max_period; period++) {
+			uint64_t divisible = 0;
+			for (std::size_t distance = period; distance < distances.size(); distance += period) divisible += distances[distance];
+			shares[period] = static_cast<double>(divisible) / static_cast<double>(repeats);
+		}
+
+		return shares;
+	}
+
+	/* Key of the given period that fits the model best, with its score */
+	static KeyCandidate solve_key(const std::vector<uint8_t>& letters, std::size_t period, const LanguageModel& model = LanguageModel::english()) {
+		return solve_columns(column_histograms(letters, period), period, model);
+	}
+
+	static Report analyze(const uint8_t* data, std::size_t size, const LanguageModel& model = LanguageModel::english(), const Options& options = Options()) {
+		CIPHERS_METRICS_SCOPE("analysis", "vigenere", size);
+		std::vector<uint8_t> letters = letter_indices(data, size);
+		std::size_t max_period = std::min(options.max_period, letters.size() / 2);
+
+		Report report{ 0, 0, {}, {} };
+		if (max_period == 0) return report;
+
+		std::vector<uint64_t> whole = column_histograms(letters, 1);
+		report.coincidence = index_of_coincidence(whole.data());
+
+		/* Friedman: the observed coincidence is a mix of the language's and that of random letters */
+		const double random_coincidence = 1.0 / LanguageModel::letter_count;
+		double excess = report.coincidence - random_coincidence;
+		report.friedman_period = excess > 0 ? (model.coincidence() - random_coincidence) / excess : static_cast<double>(max_period);
+
+		std::vector<double> kasiski_shares = kasiski(letters, options);
+		std::vector<Period> periods(max_period);
+		std::vector<uint8_t> sample(letters.begin(), letters.begin() + std::min(letters.size(), std::max(options.period_letters, max_period * 2)));
+
+		ThreadPool& pool = options.pool != nullptr ? *options.pool : ThreadPool::shared();
+		pool.parallel_for(max_period, [&](std::size_t i) {
+			std::size_t period = i + 1;
+			std::vector<uint64_t> counts = column_histograms(sample, period);
+
+			double coincidence = 0;
+			for (std::size_t column = 0; column < period; column++) coincidence += index_of_coincidence(counts.data() + column * LanguageModel::letter_count);
+			periods[i] = Period{ period, coincidence / period, period < kasiski_shares.size() ? kasiski_shares[period] : 0 };
+		});
+
+		/* Multiples of the key length score about as well as the key length itself, so the shortest
+		period that comes close to the best coincidence goes first */
+		double best = 0;
+		for (const Period& period : periods) best = std::max(best, period.coincidence);
+		double threshold = random_coincidence + 0.9 * (best - random_coincidence);
+
+		report.periods = periods;
+		std::stable_sort(report.periods.begin(), report.periods.end(), [](const Period& a, const Period& b) { return a.coincidence > b.coincidence; });
+		auto shortest = std::find_if(periods.begin(), periods.end(), [threshold](const Period& period) { return period.coincidence >= threshold; });
+		if (shortest != periods.end()) {
+			Period chosen = *shortest;
+			report.periods.erase(std::find_if(report.periods.begin(), report.periods.end(), [&chosen](const Period& period) { return period.period == chosen.period; }));
+			report.periods.insert(report.periods.begin(), chosen);
+		}
+
+		std::size_t key_count = std::min(options.key_candidates, report.periods.size());
+		report.keys.resize(key_count);
+		pool.parallel_for(key_count, [&](std::size_t i) {
+			report.keys[i] = solve_key(letters, report.periods[i].period, model);
+		});
+
+		return report;
+	}
+
+	static Report analyze(const std::string& data, const LanguageModel& model = LanguageModel::english(), const Options& options = Options()) {
+		return analyze(reinterpret_cast<const uint8_t*>(data.data()), data.size(), model, options);
+	}
+
+	/* Deciphers with the best recovered key, the data comes back unchanged if no key was found */
+	static std::string decode(const Report& report, std::string data) {
+		if (report.keys.empty() || report.keys.front().key.empty()) return data;
+		return Vigenere::vigenere_lookup(std::move(data), report.keys.front().key, true);
+	}
+
+private:
+	static KeyCandidate solve_columns(const std::vector<uint64_t>& counts, std::size_t period, const LanguageModel& model) {
+		KeyCandidate candidate{ std::string(period, 'a'), 0, 1 };
+
+		for (std::size_t column = 0; column < period; column++) {
+			const uint64_t* column_counts = counts.data() + column * LanguageModel::letter_count;
+			std::vector<uint64_t> letters(column_counts, column_counts + LanguageModel::letter_count);
+
+			FrequencyAnalysis::Candidate best = FrequencyAnalysis::rank(letters, model, false).front();
+			candidate.key[column] = static_cast<char>(Alphabets::latin().symbol_at(best.shift));
+			candidate.chi_squared += best.chi_squared;
+			candidate.confidence *= best.confidence;
+		}
+
+		return candidate;
+	}
+};
@@ -1,33 +1,306 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+
+#include "metrics.h"
+#include "simd.h"
+#include "span.h"
 
 class Xor {
 public:
-	static std::vector<uint32_t> apply_xor(std::vector<uint32_t> data, std::vector<uint32_t> key) {
-		std::vector<uint32_t> encoded_vector = std::vector<uint32_t>();
-		uint32_t key_index = 0;
+	class ZeroKeyLengthException : public std::runtime_error {
+	public: ZeroKeyLengthException() : std::runtime_error("Length of supplied key is zero.") {}
+	};
+
+	/* Number of bytes the key buffer extends past the key, so that a full vector of key stream
+	can be loaded from any starting position inside the key without wrapping. */
+	static const std::size_t key_buffer_padding = 64;
+
+	/* Repeats the key until it is key_size + key_buffer_padding bytes long */
+	static std::vector<uint8_t> expand_key(const uint8_t* key, std::size_t key_size) {
+		if (key_size == 0) throw ZeroKeyLengthException();
+
+		std::vector<uint8_t> key_buffer(key_size + key_buffer_padding);
+		for (std::size_t i = 0; i < key_buffer.size(); i++) key_buffer[i] = key[i % key_size];
+		return key_buffer;
+	}
+
+	/* XORs size bytes of input into output against an expanded key buffer, starting at key_index
+	within the key, and advances key_index past the processed bytes. Input and output may alias. */
+	static void apply_expanded(const uint8_t* input, uint8_t* output, std::size_t size, const uint8_t* key_buffer, std::size_t key_size, std::size_t& key_index) {
+		std::size_t processed = 0;
+
+#if CIPHERS_SIMD_X86
+		switch (Simd::level()) {
+		case Simd::Level::AVX512: processed = xor_avx512(input, output, size, key_buffer, key_size, key_index); break;
+		case Simd::Level::AVX2: processed = xor_avx2(input, output, size, key_buffer, key_size, key_index); break;
+		case Simd::Level::SSSE3:
+		case Simd::Level::SSE2: processed = xor_sse2(input, output, size, key_buffer, key_size, key_index); break;
+		default: break;
+		}
+#endif
+
+		xor_scalar(input + processed, output + processed, size - processed, key_buffer, key_size, key_index);
+	}
 
-		for (std::size_t i = 0; i < data.size(); i++) {
-			const uint32_t& index_value = data.at(i);
-			encoded_vector.push_back(index_value ^ key.at(key_index));
-			key_index >= key.size() - 1 ? 0 : key_index + 1;
+	/* Out of place XOR, returns the key offset that follows the last processed byte. Never allocates:
+	short keys are expanded on the stack, longer ones are walked in runs that do not wrap, which are
+	long enough for the vector kernels on their own. */
+	static std::size_t apply_xor(const uint8_t* input, uint8_t* output, std::size_t size, const uint8_t* key, std::size_t key_size, std::size_t key_offset = 0) {
+		CIPHERS_METRICS_SCOPE("xor", "apply", size);
+		if (key_size == 0) throw ZeroKeyLengthException();
+		std::size_t key_index = key_offset % key_size;
+		if (size == 0) return key_index;
+
+		if (key_size <= stack_key_size) {
+			uint8_t key_buffer[stack_key_size + key_buffer_padding];
+			for (std::size_t i = 0; i < key_size + key_buffer_padding; i++) key_buffer[i] = key[i % key_size];
+			apply_expanded(input, output, size, key_buffer, key_size, key_index);
+			return key_index;
+		}
+
+		while (size > 0) {
+			std::size_t run = std::min(size, key_size - key_index);
+			xor_run(input, output, run, key + key_index);
+
+			input += run;
+			output += run;
+			size -= run;
+			key_index += run;
+			if (key_index == key_size) key_index = 0;
 		}
 
-		return encoded_vector;
+		return key_index;
+	}
+
+	/* Span form of the above, output must be at least as large as input */
+	static std::size_t apply_xor(Span<const uint8_t> input, Span<uint8_t> output, Span<const uint8_t> key, std::size_t key_offset = 0) {
+		require_output(output, input.size());
+		return apply_xor(input.data(), output.data(), input.size(), key.data(), key.size(), key_offset);
+	}
+
+	/* In place XOR, returns the key offset that follows the last processed byte */
+	static std::size_t apply_xor(uint8_t* data, std::size_t size, const uint8_t* key, std::size_t key_size, std::size_t key_offset = 0) {
+		return apply_xor(data, data, size, key, key_size, key_offset);
+	}
+
+	static std::vector<uint32_t> apply_xor(std::vector<uint32_t> data, std::vector<uint32_t> key) {
+		if (data.empty()) return data;
+		if (key.empty()) throw ZeroKeyLengthException();
+
+		/* XORing 32 bit words against a repeating 32 bit key is the same as XORing their bytes in memory order */
+		apply_xor(reinterpret_cast<uint8_t*>(data.data()), data.size() * sizeof(uint32_t), reinterpret_cast<const uint8_t*>(key.data()), key.size() * sizeof(uint32_t));
+		return data;
 	}
 
 	static std::string apply_xor(std::string data, std::vector<uint32_t> key) {
-		std::vector<uint32_t> encoded = apply_xor(std::vector<uint32_t>(data.begin(), data.end()), key);
-		return std::string(encoded.begin(), encoded.end());
+		if (data.empty()) return data;
+		if (key.empty()) throw ZeroKeyLengthException();
+
+		/* Only the low byte of each key item survives the conversion back into characters */
+		std::vector<uint8_t> key_bytes(key.begin(), key.end());
+		apply_xor(reinterpret_cast<uint8_t*>(&data[0]), data.size(), key_bytes.data(), key_bytes.size());
+		return data;
 	}
-	
+
 	static std::string apply_xor(std::string data, uint32_t key) {
-		return apply_xor(data, { key });
+		return apply_xor(data, std::vector<uint32_t>{ key });
+	}
+
+	static std::string apply_xor(std::string data, std::string key) {
+		if (data.empty()) return data;
+		if (key.empty()) throw ZeroKeyLengthException();
+
+		apply_xor(reinterpret_cast<uint8_t*>(&data[0]), data.size(), reinterpret_cast<const uint8_t*>(key.data()), key.size());
+		return data;
+	}
+
+private:
+	/* Longest key that apply_xor expands on the stack */
+	static const std::size_t stack_key_size = 1024;
+
+	/* XORs two buffers of the same length byte by byte. Input and output may alias. */
+	static void xor_run(const uint8_t* input, uint8_t* output, std::size_t size, const uint8_t* key) {
+		/* A key as long as the data never wraps, so all but its last key_buffer_padding bytes can go
+		through the expanded kernels with the run itself as the expanded key */
+		std::size_t processed = size > key_buffer_padding ? size - key_buffer_padding : 0;
+		std::size_t key_index = 0;
+		apply_expanded(input, output, processed, key, size, key_index);
+
+		for (std::size_t i = processed; i < size; i++) output[i] = input[i] ^ key[i];
+	}
+
+	static void xor_scalar(const uint8_t* input, uint8_t* output, std::size_t size, const uint8_t* key_buffer, std::size_t key_size, std::size_t& key_index) {
+		std::size_t i = 0;
+		const std::size_t step = sizeof(uint64_t) % key_size;
+
+		for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+			uint64_t data_word, key_word;
+			std::memcpy(&data_word, input + i, sizeof(uint64_t));
+			std::memcpy(&key_word, key_buffer + key_index, sizeof(uint64_t));
+			data_word ^= key_word;
+			std::memcpy(output + i, &data_word, sizeof(uint64_t));
+
+			key_index += step;
+			if (key_index >= key_size) key_index -= key_size;
+		}
+
+		for (; i < size; i++) {
+			output[i] = input[i] ^ key_buffer[key_index];
+			if (++key_index == key_size) key_index = 0;
+		}
 	}
 
-	static std::string apply_xor(std::string data, std::string key) { 
-		return apply_xor(data, std::vector<uint32_t>(key.begin(), key.end()));
+#if CIPHERS_SIMD_X86
+	SIMD_TARGET("sse2")
+	static std::size_t xor_sse2(const uint8_t* input, uint8_t* output, std::size_t size, const uint8_t* key_buffer, std::size_t key_size, std::size_t& key_index) {
+		std::size_t i = 0;
+		const std::size_t step = 16 % key_size;
+
+		for (; i + 16 <= size; i += 16) {
+			__m128i data_vector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+			__m128i key_vector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key_buffer + key_index));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_xor_si128(data_vector, key_vector));
+
+			key_index += step;
+			if (key_index >= key_size) key_index -= key_size;
+		}
+
+		return i;
 	}
+
+	SIMD_TARGET("avx2")
+	static std::size_t xor_avx2(const uint8_t* input, uint8_t* output, std::size_t size, const uint8_t* key_buffer, std::size_t key_size, std::size_t& key_index) {
+		std::size_t i = 0;
+		const std::size_t step = 32 % key_size;
+
+		for (; i + 32 <= size; i += 32) {
+			__m256i data_vector = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+			__m256i key_vector = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(key_buffer + key_index));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_xor_si256(data_vector, key_vector));
+
+			key_index += step;
+			if (key_index >= key_size) key_index -= key_size;
+		}
+
+		return i;
+	}
+
+	SIMD_TARGET("avx512f")
+	static std::size_t xor_avx512(const uint8_t* input, uint8_t* output, std::size_t size, const uint8_t* key_buffer, std::size_t key_size, std::size_t& key_index) {
+		std::size_t i = 0;
+		const std::size_t step = 64 % key_size;
+
+		for (; i + 64 <= size; i += 64) {
+			__m512i data_vector = _mm512_loadu_si512(input + i);
+			__m512i key_vector = _mm512_loadu_si512(key_buffer + key_index);
+			_mm512_storeu_si512(output + i, _mm512_xor_si512(data_vector, key_vector));
+
+			key_index += step;
+			if (key_index >= key_size) key_index -= key_size;
+		}
+
+		return i;
+	}
+#endif
+};
+
+/* Stateful XOR that remembers its position in the key between calls, so a payload can be fed through
+in chunks of any size and still produce the same output as a single Xor::apply_xor over all of it. */
+class XorStream {
+public:
+	XorStream(const uint8_t* key, std::size_t key_size, std::size_t key_offset = 0)
+		: key_buffer(Xor::expand_key(key, key_size)), key_size(key_size), key_index(key_offset % key_size) {}
+
+	XorStream(const std::string& key, std::size_t key_offset = 0)
+		: XorStream(reinterpret_cast<const uint8_t*>(key.data()), key.size(), key_offset) {}
+
+	/* XORs a chunk in place and advances the key position */
+	void update(uint8_t* data, std::size_t size) {
+		CIPHERS_METRICS_SCOPE("xor", "stream", size);
+		Xor::apply_expanded(data, data, size, key_buffer.data(), key_size, key_index);
+	}
+
+	/* XORs a chunk from input into output and advances the key position. Input and output may alias. */
+	void update(const uint8_t* input, uint8_t* output, std::size_t size) {
+		CIPHERS_METRICS_SCOPE("xor", "stream", size);
+		Xor::apply_expanded(input, output, size, key_buffer.data(), key_size, key_index);
+	}
+
+	std::string update(std::string chunk) {
+		if (!chunk.empty()) update(reinterpret_cast<uint8_t*>(&chunk[0]), chunk.size());
+		return chunk;
+	}
+
+	/* Pipes everything left in input through the cipher into output using one fixed size buffer,
+	returns the number of bytes written. Both streams should be opened in binary mode. */
+	std::size_t process(std::istream& input, std::ostream& output, std::size_t buffer_size = 1 << 16) {
+		std::vector<char> buffer(buffer_size == 0 ? 1 : buffer_size);
+		std::size_t total = 0;
+
+		while (input) {
+			input.read(buffer.data(), buffer.size());
+			std::streamsize read = input.gcount();
+			if (read <= 0) break;
+
+			update(reinterpret_cast<uint8_t*>(buffer.data()), static_cast<std::size_t>(read));
+			output.write(buffer.data(), read);
+			if (!output) break;
+
+			total += static_cast<std::size_t>(read);
+		}
+
+		return total;
+	}
+
+	/* Position inside the key that the next byte will be XORed against */
+	std::size_t key_offset() const { return key_index; }
+
+	/* Moves to the key position of the given absolute offset in the stream */
+	void seek(uint64_t stream_offset) { key_index = static_cast<std::size_t>(stream_offset % key_size); }
+
+	void reset() { key_index = 0; }
+
+private:
+	std::vector<uint8_t> key_buffer;
+	std::size_t key_size;
+	std::size_t key_index;
+};
+
+/* XOR key expanded once and reused across messages, XOR is its own inverse so encode and decode match */
+class CompiledXor {
+public:
+	CompiledXor(const uint8_t* key, std::size_t key_size) : key_buffer(Xor::expand_key(key, key_size)), key_size(key_size) {}
+	explicit CompiledXor(const std::string& key) : CompiledXor(reinterpret_cast<const uint8_t*>(key.data()), key.size()) {}
+
+	/* Returns the key offset that follows the last processed byte. Input and output may alias. */
+	std::size_t apply(const uint8_t* input, uint8_t* output, std::size_t size, std::size_t key_offset = 0) const {
+		CIPHERS_METRICS_SCOPE("xor", "compiled", size);
+		std::size_t key_index = key_offset % key_size;
+		Xor::apply_expanded(input, output, size, key_buffer.data(), key_size, key_index);
+		return key_index;
+	}
+
+	/* Span form, output must be at least as large as input */
+	std::size_t apply(Span<const uint8_t> input, Span<uint8_t> output, std::size_t key_offset = 0) const {
+		require_output(output, input.size());
+		return apply(input.data(), output.data(), input.size(), key_offset);
+	}
+
+	std::string apply(std::string data) const {
+		if (!data.empty()) apply(reinterpret_cast<const uint8_t*>(data.data()), reinterpret_cast<uint8_t*>(&data[0]), data.size());
+		return data;
+	}
+
+	std::string encode(std::string data) const { return apply(std::move(data)); }
+	std::string decode(std::string data) const { return apply(std::move(data)); }
+
+private:
+	std::vector<uint8_t> key_buffer;
+	std::size_t key_size;
 };
@@ -0,0 +1,323 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "alphabet.h"
+#include "language_model.h"
+#include "metrics.h"
+#include "parallel.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "xor.h"
+
+/* Log probability of every byte value in plaintext, the yardstick a candidate key byte is measured by.
+The text model spreads a language's letter frequencies over both cases and adds the space, digits,
+punctuation and line breaks of ordinary text, leaving control and high bytes close to impossible. */
+class ByteModel {
+public:
+	double log_probabilities[256];
+
+	/* Weights for every byte value, normalized here. Unseen bytes get a small floor. */
+	explicit ByteModel(const std::vector<double>& weights) {
+		double total = 0;
+		for (std::size_t value = 0; value < 256; value++) total += value < weights.size() && weights[value] > 0 ? weights[value] : 0;
+
+		const double floor_probability = 1e-6;
+		for (std::size_t value = 0; value < 256; value++) {
+			double weight = value < weights.size() && weights[value] > 0 ? weights[value] : 0;
+			double probability = total > 0 ? weight / total : 0;
+			log_probabilities[value] = std::log(probability > floor_probability ? probability : floor_probability);
+		}
+	}
+
+	static ByteModel text(const LanguageModel& language = LanguageModel::english()) {
+		std::vector<double> weights(256, 0);
+		const Alphabets::Latin& latin = Alphabets::latin();
+
+		/* Roughly one byte in six of prose is a space, and about one letter in thirty is a capital */
+		for (std::size_t i = 0; i < LanguageModel::letter_count; i++) {
+			weights[latin.symbol_at(i, false)] = 0.78 * language.probability(i);
+			weights[latin.symbol_at(i, true)] = 0.025 * language.probability(i);
+		}
+
+		weights[' '] = 0.16;
+		weights['\n'] = 0.008;
+		weights['\r'] = 0.002;
+		weights['.'] = weights[','] = 0.008;
+		weights['\''] = weights['"'] = weights['-'] = 0.002;
+		for (uint8_t digit = '0'; digit <= '9'; digit++) weights[digit] = 0.0005;
+		for (uint8_t symbol : std::string("!?;:()")) weights[symbol] = 0.0005;
+		for (std::size_t value = 0x20; value < 0x7F; value++) weights[value] = std::max(weights[value], 0.00005);
+		weights['\t'] = 0.0005;
+
+		return ByteModel(weights);
+	}
+
+	/* Model learned from a sample of the kind of data that was encrypted */
+	static ByteModel from_sample(const uint8_t* sample, std::size_t size) {
+		std::vector<double> weights(256, 0);
+		for (std::size_t i = 0; i < size; i++) weights[sample[i]]++;
+		return ByteModel(weights);
+	}
+};
+
+struct XorAnalysisOptions {
+	/* Longest key that is tried */
+	std::size_t max_key_size = 64;
+
+	/* Bytes the Hamming distances are measured over, spread evenly across the input */
+	std::size_t sample_size = std::size_t(1) << 22;
+
+	/* Number of key sizes that are solved before the best key is picked */
+	std::size_t key_candidates = 3;
+
+	/* Bytes handed to a worker at a time while counting columns, and the pool they run on */
+	ParallelOptions parallel;
+};
+
+/* Recovers repeating XOR keys as produced by Xor::apply_xor. Key sizes are ranked by the Hamming
+distance between the ciphertext and itself one key length later, normalized per bit: at the right
+size both sides were XORed with the same key byte, which cancels out and leaves the much smaller
+distance between plaintext bytes. The ciphertext is then counted into one histogram per key byte in
+a single sequential pass, and each key byte is the one of its 256 candidates that turns its column
+histogram into the most likely plaintext under the byte model. */
+class XorAnalysis {
+public:
+	using Options = XorAnalysisOptions;
+
+	struct KeySize {
+		std::size_t key_size;
+
+		/* Differing bits per compared bit, about 0.5 for unrelated bytes and well below for the key size */
+		double distance;
+	};
+
+	struct Report {
+		/* Every key size, best first */
+		std::vector<KeySize> key_sizes;
+
+		/* Recovered key, reduced to its shortest repeating unit */
+		std::vector<uint8_t> key;
+
+		/* Mean log probability of a deciphered byte under the model, higher is better */
+		double score;
+	};
+
+	/* Number of differing bits between two buffers of the same size */
+	static uint64_t hamming_distance(const uint8_t* a, const uint8_t* b, std::size_t size) {
+		uint64_t distance = 0;
+		std::size_t processed = 0;
+
+#if CIPHERS_SIMD_X86
+		Simd::Level level = Simd::level();
+		if (level >= Simd::Level::AVX2) processed = hamming_avx2(a, b, size, distance);
+		else if (level >= Simd::Level::SSE2 && Simd::features().popcnt) processed = hamming_popcnt(a, b, size, distance);
+#endif
+
+		for (std::size_t i = processed; i < size; i++) distance += popcount(static_cast<uint64_t>(a[i] ^ b[i]));
+		return distance;
+	}
+
+	/* Every key size from 1 to max_key_size ranked by normalized Hamming distance, measured in parallel */
+	static std::vector<KeySize> rank_key_sizes(const uint8_t* data, std::size_t size, const Options& options = Options()) {
+		std::size_t max_key_size = std::min(options.max_key_size, size / 2);
+		std::vector<KeySize> key_sizes(max_key_size);
+
+		/* A handful of windows spread over the input, so one odd region cannot decide the ranking */
+		const std::size_t window_count = 16;
+		std::size_t compared = std::min(options.sample_size, size);
+		std::size_t window_size = std::max<std::size_t>(compared / window_count, 1);
+
+		ThreadPool& pool = options.parallel.pool != nullptr ? *options.parallel.pool : ThreadPool::shared();
+		pool.parallel_for(max_key_size, [&](std::size_t i) {
+			std::size_t key_size = i + 1;
+			std::size_t usable = size - key_size;
+			uint64_t bits = 0, differing = 0;
+
+			for (std::size_t window = 0; window < window_count; window++) {
+				std::size_t begin = usable > window_size ? (usable - window_size) / (window_count - 1) * window : 0;
+				std::size_t length = std::min(window_size, usable - begin);
+				differing += hamming_distance(data + begin, data + begin + key_size, length);
+				bits += 8 * static_cast<uint64_t>(length);
+				if (usable <= window_size) break;
+			}
+
+			key_sizes[i] = KeySize{ key_size, bits == 0 ? 0.5 : static_cast<double>(differing) / static_cast<double>(bits) };
+		});
+
+		/* Multiples of the key size score about as well as the key size itself, so the shortest size
+		that comes close to the best distance goes first */
+		std::vector<KeySize> ranked = key_sizes;
+		std::stable_sort(ranked.begin(), ranked.end(), [](const KeySize& a, const KeySize& b) { return a.distance < b.distance; });
+		if (ranked.empty()) return ranked;
+
+		double threshold = ranked.front().distance + 0.1 * (0.5 - ranked.front().distance);
+		auto shortest = std::find_if(key_sizes.begin(), key_sizes.end(), [threshold](const KeySize& key_size) { return key_size.distance <= threshold; });
+		KeySize chosen = *shortest;
+		ranked.erase(std::find_if(ranked.begin(), ranked.end(), [&chosen](const KeySize& key_size) { return key_size.key_size == chosen.key_size; }));
+		ranked.insert(ranked.begin(), chosen);
+
+		return ranked;
+	}
+
+	/* Byte histogram of every key position, column c occupies entries [c * 256, c * 256 + 256). The
+	pass is sequential and each worker counts its own chunk, chunks start at their own key offset. */
+	static std::vector<uint64_t> column_histograms(const uint8_t* data, std::size_t size, std::size_t key_size, const ParallelOptions& options = ParallelOptions()) {
+		std::size_t chunk_size = options.chunk_size == 0 ? size : options.chunk_size;
+		std::size_t chunk_count = chunk_size == 0 ? 0 : (size + chunk_size - 1) / chunk_size;
+		std::vector<std::vector<uint64_t>> partials(std::max<std::size_t>(chunk_count, 1), std::vector<uint64_t>(key_size * 256, 0));
+
+		Parallel::for_each_chunk(size, options, [&](std::size_t begin, std::size_t end) {
+			std::vector<uint64_t>& counts = partials[begin / chunk_size];
+			uint64_t* const first = counts.data();
+			uint64_t* const last = first + counts.size();
+			uint64_t* row = first + (begin % key_size) * 256;
+
+			for (std::size_t i = begin; i < end; i++) {
+				row[data[i]]++;
+				row += 256;
+				if (row == last) row = first;
+			}
+		});
+
+		for (std::size_t chunk = 1; chunk < partials.size(); chunk++)
+			for (std::size_t i = 0; i < partials[0].size(); i++) partials[0][i] += partials[chunk][i];
+		return partials[0];
+	}
+
+	/* Key byte that makes a column most likely plaintext, and the total log probability it reaches */
+	static uint8_t solve_column(const uint64_t* counts, const ByteModel& model, double& score) {
+		score = -INFINITY;
+		uint8_t best = 0;
+
+		for (uint32_t candidate = 0; candidate < 256; candidate++) {
+			double candidate_score = 0;
+			for (uint32_t value = 0; value < 256; value++) {
+				if (counts[value] != 0) candidate_score += static_cast<double>(counts[value]) * model.log_probabilities[value ^ candidate];
+			}
+
+			if (candidate_score > score) {
+				score = candidate_score;
+				best = static_cast<uint8_t>(candidate);
+			}
+		}
+
+		return best;
+	}
+
+	/* Key of the given size that fits the model best, score is the mean log probability per byte */
+	static std::vector<uint8_t> solve_key(const uint8_t* data, std::size_t size, std::size_t key_size, const ByteModel& model, double& score, const ParallelOptions& options = ParallelOptions()) {
+		std::vector<uint64_t> counts = column_histograms(data, size, key_size, options);
+		std::vector<uint8_t> key(key_size);
+		score = 0;
+
+		for (std::size_t column = 0; column < key_size; column++) {
+			double column_score;
+			key[column] = solve_column(counts.data() + column * 256, model, column_score);
+			score += column_score;
+		}
+
+		score = size == 0 ? 0 : score / static_cast<double>(size);
+		return key;
+	}
+
+	static Report analyze(const uint8_t* data, std::size_t size, const ByteModel& model = ByteModel::text(), const Options& options = Options()) {
+		CIPHERS_METRICS_SCOPE("analysis", "xor", size);
+		Report report{ rank_key_sizes(data, size, options), {}, -INFINITY };
+		std::size_t candidates = std::min(options.key_candidates, report.key_sizes.size());
+
+		for (std::size_t i = 0; i < candidates; i++) {
+			std::size_t key_size = report.key_sizes[i].key_size;
+			double score;
+			std::vector<uint8_t> key = solve_key(data, size, key_size, model, score, options.parallel);
+
+			/* A multiple of a size already solved fits short ciphertext a little better by overfitting
+			alone, it has to fix a real share of the bytes to win. Otherwise ties go to the earlier size. */
+			bool multiple = !report.key.empty() && key_size % report.key.size() == 0;
+			if (score > report.score + (multiple ? 0.1 : 1e-9)) {
+				report.score = score;
+				report.key = shortest_period(key);
+			}
+		}
+
+		return report;
+	}
+
+	static Report analyze(const std::string& data, const ByteModel& model = ByteModel::text(), const Options& options = Options()) {
+		return analyze(reinterpret_cast<const uint8_t*>(data.data()), data.size(), model, options);
+	}
+
+	/* Deciphers with the recovered key, the data comes back unchanged if no key was found */
+	static std::string decode(const Report& report, std::string data) {
+		if (report.key.empty() || data.empty()) return data;
+		uint8_t* bytes = reinterpret_cast<uint8_t*>(&data[0]);
+		Xor::apply_xor(bytes, data.size(), report.key.data(), report.key.size());
+		return data;
+	}
+
+	/* Shortest prefix the key is a repetition of, a key solved at a multiple of its size repeats itself */
+	static std::vector<uint8_t> shortest_period(const std::vector<uint8_t>& key) {
+		for (std::size_t period = 1; period < key.size(); period++) {
+			if (key.size() % period != 0) continue;
+
+			bool repeats = true;
+			for (std::size_t i = period; i < key.size() && repeats; i++) repeats = key[i] == key[i - period];
+			if (repeats) return std::vector<uint8_t>(key.begin(), key.begin() + period);
+		}
+
+		return key;
+	}
+
+private:
+	static uint64_t popcount(uint64_t value) {
+		value = value - ((value >> 1) & 0x5555555555555555ull);
+		value = (value & 0x3333333333333333ull) + ((value >> 2) & 0x3333333333333333ull);
+		value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+		return (value * 0x0101010101010101ull) >> 56;
+	}
+
+#if CIPHERS_SIMD_X86
+	SIMD_TARGET("popcnt")
+	static std::size_t hamming_popcnt(const uint8_t* a, const uint8_t* b, std::size_t size, uint64_t& distance) {
+		std::size_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			uint64_t word_a, word_b;
+			std::memcpy(&word_a, a + i, 8);
+			std::memcpy(&word_b, b + i, 8);
+			uint64_t difference = word_a ^ word_b;
+#if defined(_M_X64) || defined(__x86_64__)
+			distance += static_cast<uint64_t>(_mm_popcnt_u64(difference));
+#else
+			distance += static_cast<uint64_t>(_mm_popcnt_u32(static_cast<uint32_t>(difference)) + _mm_popcnt_u32(static_cast<uint32_t>(difference >> 32)));
+#endif
+		}
+		return i;
+	}
+
+	/* Bit counts of both nibbles of every byte through pshufb, summed per 64 bit lane by psadbw */
+	SIMD_TARGET("avx2")
+	static std::size_t hamming_avx2(const uint8_t* a, const uint8_t* b, std::size_t size, uint64_t& distance) {
+		const __m256i nibble_counts = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+		const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+		__m256i totals = _mm256_setzero_si256();
+		std::size_t i = 0;
+
+		for (; i + 32 <= size; i += 32) {
+			__m256i difference = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+			__m256i low = _mm256_shuffle_epi8(nibble_counts, _mm256_and_si256(difference, nibble_mask));
+			__m256i high = _mm256_shuffle_epi8(nibble_counts, _mm256_and_si256(_mm256_srli_epi16(difference, 4), nibble_mask));
+			totals = _mm256_add_epi64(totals, _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256()));
+		}
+
+		uint64_t lanes[4];
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), totals);
+		distance += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		return i;
+	}
+#endif
+};
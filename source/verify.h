@@ -0,0 +1,673 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ciphers.h"
+#include "headers/async_file.h"
+
+struct VerifyOptions {
+	/* Random inputs every check runs on, at every instruction set level */
+	std::size_t cases = 200;
+
+	/* Inputs are up to this many bytes, enough to cross every vector width, block and chunk size */
+	std::size_t max_size = std::size_t(1) << 14;
+
+	/* Inputs are the same for a given seed, so a failure can be replayed */
+	uint64_t seed = 1;
+
+	/* Only checks whose name contains this run */
+	std::string filter;
+};
+
+/* Differential checks of every fast path against a plain reference of what the cipher does. Each check
+takes one input, runs it through the vector kernels at every instruction set level the processor has
+(see Simd::limit), through the thread pool at several thread counts and chunk sizes, in pieces as a
+stream and in place, and through round trips, and compares every result with the reference written
+here byte by byte. Ciphers verify runs them over random inputs, and built with CIPHERS_FUZZER the same
+checks are the libFuzzer entry point, see main.cpp. */
+class Verify {
+public:
+	using Options = VerifyOptions;
+
+	class MismatchException : public std::runtime_error {
+	public: explicit MismatchException(const std::string& message) : std::runtime_error(message) {}
+	};
+
+	/* Everything a check needs, derived from a random generator or from fuzzer bytes */
+	struct Input {
+		std::vector<uint8_t> data;
+
+		/* Mostly letters, now and then a byte that stalls a Vigenere key, up to 300 bytes so that keys
+		longer than the stack compiled ones are covered too */
+		std::string key;
+
+		uint32_t shift = 0;
+		bool decode = false;
+		bool preserve_case = true;
+		std::size_t key_position = 0;
+
+		/* Piece size for streams and chunk size for the thread pool */
+		std::size_t split = 1;
+	};
+
+	using Check = std::function<void(const Input& input)>;
+
+	struct Case {
+		std::string name;
+		Check check;
+	};
+
+	struct Result {
+		std::string name;
+		uint64_t cases;
+		uint64_t failures;
+		std::string first_failure;
+	};
+
+	/* Every check, named after the cipher and the paths it compares */
+	static std::vector<Case> cases() {
+		std::vector<Case> suite;
+
+		suite.push_back({ "caesar", [](const Input& input) {
+			const std::vector<uint8_t> expected = reference_caesar(input.data, input.shift, input.decode);
+			compare("caesar_shift", expected, run_bytes(input.data, [&](const uint8_t* in, uint8_t* out, std::size_t size) { Caesar::caesar_shift(in, out, size, input.shift, input.decode); }));
+			compare("caesar_shift string", expected, bytes(Caesar::caesar_shift(text(input.data), input.shift, input.decode)));
+			compare("Pipeline caesar", expected, bytes(Pipeline().caesar(input.shift, input.decode).run(text(input.data))));
+			compare("Parallel::caesar_shift", expected, across_pools(input, [&](const uint8_t* in, uint8_t* out, std::size_t size, const ParallelOptions& options) {
+				Parallel::caesar_shift(in, out, size, input.shift, input.decode, options);
+			}));
+			compare("rot13", reference_caesar(input.data, 13, false), bytes(Caesar::rot13(text(input.data))));
+			compare("caesar round trip", input.data, bytes(Caesar::caesar_shift(Caesar::caesar_shift(text(input.data), input.shift, input.decode), input.shift, !input.decode)));
+		} });
+
+		suite.push_back({ "atbash", [](const Input& input) {
+			const std::vector<uint8_t> expected = reference_atbash(input.data);
+			compare("atbash_apply", expected, run_bytes(input.data, [](const uint8_t* in, uint8_t* out, std::size_t size) { Atbash::atbash_apply(in, out, size); }));
+			compare("atbash_apply string", expected, bytes(Atbash::atbash_apply(text(input.data))));
+			compare("Pipeline atbash", expected, bytes(Pipeline().atbash().run(text(input.data))));
+
+			const std::vector<uint8_t> uppercase(upper_letters().begin(), upper_letters().end());
+			std::vector<uint8_t> letters;
+			for (uint8_t byte : input.data) if (byte >= 'A' && byte <= 'Z') letters.push_back(byte);
+			compare("reverse_apply", reference_atbash(letters), Atbash::reverse_apply(letters, uppercase));
+		} });
+
+		suite.push_back({ "xor", [](const Input& input) {
+			const uint8_t* key = reinterpret_cast<const uint8_t*>(input.key.data());
+			const std::size_t key_size = input.key.size();
+			const std::vector<uint8_t> expected = reference_xor(input.data, input.key, input.key_position);
+
+			compare("apply_xor", expected, run_bytes(input.data, [&](const uint8_t* in, uint8_t* out, std::size_t size) { Xor::apply_xor(in, out, size, key, key_size, input.key_position); }));
+			compare("CompiledXor", expected, run_bytes(input.data, [&](const uint8_t* in, uint8_t* out, std::size_t size) { CompiledXor(input.key).apply(in, out, size, input.key_position); }));
+			compare("Parallel::apply_xor", expected, across_pools(input, [&](const uint8_t* in, uint8_t* out, std::size_t size, const ParallelOptions& options) {
+				Parallel::apply_xor(in, out, size, key, key_size, input.key_position, options);
+			}));
+
+			/* The stream has to end up where one call over everything would */
+			XorStream stream(key, key_size, input.key_position);
+			compare("XorStream", expected, in_pieces(input, [&](const uint8_t* in, uint8_t* out, std::size_t size) {
+				stream.update(in, out, size);
+				return size;
+			}));
+		} });
+
+		suite.push_back({ "vigenere", [](const Input& input) {
+			const std::vector<uint8_t> expected = reference_vigenere(input.data, input.key, input.decode, input.preserve_case, input.key_position);
+			const Span<const uint8_t> key = byte_span(input.key);
+			std::size_t position = 0;
+
+			compare("vigenere_lookup", expected, run_bytes(input.data, [&](const uint8_t* in, uint8_t* out, std::size_t size) {
+				position = Vigenere::vigenere_lookup(Span<const uint8_t>(in, size), Span<uint8_t>(out, size), key, input.decode, input.preserve_case, input.key_position);
+			}));
+			compare_position("vigenere_lookup", input, position);
+
+			const Vigenere::KeySchedule schedule = Vigenere::key_schedule(key.data(), key.size());
+			compare("vigenere_apply", expected, run_bytes(input.data, [&](const uint8_t* in, uint8_t* out, std::size_t size) {
+				Vigenere::vigenere_apply(in, out, size, schedule, input.key_position, input.decode, input.preserve_case);
+			}));
+
+			compare("Parallel::vigenere_lookup", expected, across_pools(input, [&](const uint8_t* in, uint8_t* out, std::size_t size, const ParallelOptions& options) {
+				Parallel::vigenere_lookup(in, out, size, key.data(), key.size(), input.decode, input.preserve_case, input.key_position, options);
+			}));
+
+			/* A stream carries the key position from one piece to the next */
+			const CompiledVigenere compiled(input.key, input.preserve_case);
+			position = input.key_position;
+			compare("CompiledVigenere", expected, in_pieces(input, [&](const uint8_t* in, uint8_t* out, std::size_t size) {
+				position = input.decode ? compiled.decode(in, out, size, position) : compiled.encode(in, out, size, position);
+				return size;
+			}));
+
+			if (input.preserve_case) {
+				std::vector<uint8_t> encoded = reference_vigenere(input.data, input.key, false, true, 0);
+				compare("vigenere round trip", input.data, bytes(Vigenere::vigenere_lookup(text(encoded), input.key, true)));
+			}
+		} });
+
+		suite.push_back({ "polybius", [](const Input& input) {
+			const int8_t sacrifice = input.shift % 2 == 0 ? '\0' : static_cast<int8_t>('A' + input.shift % 26);
+			const std::string key = polybius_key(input.key, sacrifice);
+			const Polybius::matrix<uint32_t> matrix = Polybius::keyed_matrix(key, sacrifice);
+			const Polybius::Square square(matrix);
+
+			/* single_encode over the matrix, the way encode_data worked before squares were flattened.
+			Letters are what decoding gives back, the sacrifice comes back as whatever sits at (0, 0). */
+			auto reference_packed = [&matrix](const std::vector<uint8_t>& data, std::vector<uint8_t>& packed, std::vector<uint8_t>& letters) {
+				for (uint8_t byte : data) {
+					if (!std::isalpha(byte)) continue;
+					uint8_t letter = static_cast<uint8_t>(std::toupper(byte));
+					std::pair<uint32_t, uint32_t> location = Polybius::single_encode(letter, matrix);
+					packed.push_back(static_cast<uint8_t>((location.first << 4) | location.second));
+					letters.push_back(static_cast<uint8_t>(matrix[location.first][location.second]));
+				}
+			};
+
+			std::vector<uint8_t> expected, letters;
+			reference_packed(input.data, expected, letters);
+
+			std::vector<uint8_t> packed(input.data.size());
+			packed.resize(Polybius::encode_packed(square, input.data.data(), input.data.size(), packed.data()));
+			compare("encode_packed", expected, packed);
+
+			std::vector<uint8_t> packed_in_place(input.data);
+			packed_in_place.resize(Polybius::encode_packed(square, packed_in_place.data(), packed_in_place.size(), packed_in_place.data()));
+			compare("encode_packed in place", expected, packed_in_place);
+			compare("encode_data", expected, bytes(Polybius::pack(Polybius::encode_data(text(input.data), key, sacrifice))));
+			compare("CompiledPolybius", expected, bytes(Polybius::pack(CompiledPolybius(key, sacrifice).encode(text(input.data)))));
+			compare("Pipeline polybius", expected, bytes(Pipeline().polybius(square).run(text(input.data))));
+
+			compare("decode_packed round trip", letters, run_bytes(packed, [&](const uint8_t* in, uint8_t* out, std::size_t size) { Polybius::decode_packed(square, in, size, out); }));
+			compare("decode_packed keyed", letters, bytes(Polybius::decode_packed(text(packed), key, sacrifice)));
+			compare("decode_data keyed", letters, bytes(Polybius::decode_data(Polybius::encode_data(text(input.data), key, sacrifice), key, sacrifice)));
+
+			const std::string digits = Polybius::format_digits(Polybius::unpack(text(packed)), " ");
+			std::vector<uint8_t> from_digits(packed.size());
+			from_digits.resize(Polybius::decode_digits(square, digits.data(), digits.size(), from_digits.data()));
+			compare("decode_digits round trip", letters, from_digits);
+
+			/* Stages after the first run in place on the block, so a Polybius stage in the middle decodes in place */
+			const std::string xor_key = input.key.substr(0, 16);
+			const Pipeline layered = Pipeline().vigenere(input.key).polybius(square).repeating_xor(xor_key);
+			std::vector<uint8_t> layered_packed, layered_letters;
+			reference_packed(reference_vigenere(input.data, input.key, false, true, 0), layered_packed, layered_letters);
+
+			const std::string layered_encoded = layered.run(text(input.data));
+			compare("Pipeline polybius in the middle", reference_xor(layered_packed, xor_key, 0), bytes(layered_encoded));
+			compare("Pipeline polybius in the middle round trip", reference_vigenere(layered_letters, input.key, true, true, 0), bytes(layered.inverse().run(layered_encoded)));
+		} });
+
+		suite.push_back({ "utf8", [](const Input& input) {
+			const bool valid = reference_utf8_valid(input.data);
+			if (Utf8::validate(input.data.data(), input.data.size()) != valid) throw MismatchException("Utf8::validate says " + std::string(valid ? "invalid" : "valid") + " for " + std::to_string(input.data.size()) + " bytes");
+			if (!valid) return;
+
+			const std::string original = text(input.data);
+			compare("decode and encode", input.data, bytes(Utf8::encode(Utf8::decode(original))));
+
+			/* Characters split across pieces have to come out whole */
+			Utf8Transcoder transcoder(input.split);
+			std::string output;
+			for (std::size_t offset = 0; offset < input.data.size(); offset += input.split) {
+				std::size_t size = input.data.size() - offset < input.split ? input.data.size() - offset : input.split;
+				transcoder.update(input.data.data() + offset, size, output, [](uint32_t*, std::size_t) {});
+			}
+			transcoder.finish();
+			compare("Utf8Transcoder", input.data, bytes(output));
+		} });
+
+		suite.push_back({ "pipeline", [](const Input& input) {
+			const std::string xor_key = input.key.substr(0, 16);
+			Pipeline pipeline;
+			pipeline.vigenere(input.key, false, input.preserve_case).caesar(input.shift).atbash().repeating_xor(xor_key);
+
+			const std::vector<uint8_t> expected = reference_xor(reference_atbash(reference_caesar(reference_vigenere(input.data, input.key, false, input.preserve_case, 0), input.shift, false)), xor_key, 0);
+			compare("Pipeline run", expected, bytes(pipeline.run(text(input.data))));
+
+			Pipeline::State state = pipeline.start();
+			compare("Pipeline in pieces", expected, in_pieces(input, [&](const uint8_t* in, uint8_t* out, std::size_t size) { return pipeline.run(in, out, size, state); }));
+			if (input.preserve_case) compare("Pipeline inverse", input.data, bytes(pipeline.inverse().run(text(expected))));
+
+			/* Polybius between two stages, undone by the inverse down to the letters its square folds them to */
+			const Polybius::matrix<uint32_t> matrix = Polybius::keyed_matrix(polybius_key(input.key, 'J'), 'J');
+			const Pipeline chained = Pipeline().caesar(input.shift).polybius(Polybius::Square(matrix)).repeating_xor(xor_key);
+			std::vector<uint8_t> folded;
+			for (uint8_t byte : reference_caesar(input.data, input.shift, false)) {
+				if (!std::isalpha(byte)) continue;
+				std::pair<uint32_t, uint32_t> location = Polybius::single_encode(static_cast<uint32_t>(std::toupper(byte)), matrix);
+				folded.push_back(static_cast<uint8_t>(matrix[location.first][location.second]));
+			}
+			compare("Pipeline polybius round trip", reference_caesar(folded, input.shift, true), bytes(chained.inverse().run(chained.run(text(input.data)))));
+		} });
+
+		suite.push_back({ "async", [](const Input& input) {
+			/* Packed Polybius shrinks its output and decodes in the block it was read into, through the
+			reader and writer threads both into another file and back into the same one */
+			const Polybius::Square square(Polybius::keyed_matrix(polybius_key(input.key, 'J'), 'J'));
+			std::vector<uint8_t> packed(input.data.size());
+			packed.resize(Polybius::encode_packed(square, input.data.data(), input.data.size(), packed.data()));
+			std::vector<uint8_t> letters(packed.size());
+			Polybius::decode_packed(square, packed.data(), packed.size(), letters.data());
+
+			AsyncFile::Options options;
+			options.buffer_size = AsyncFile::alignment;
+			const AsyncFile::Transform encode = [&square](const uint8_t* in, uint8_t* out, std::size_t size) { return Polybius::encode_packed(square, in, size, out); };
+			const AsyncFile::Transform decode = [&square](const uint8_t* in, uint8_t* out, std::size_t size) { return Polybius::decode_packed(square, in, size, out); };
+
+			const TemporaryFile plain("plain"), encoded("encoded"), decoded("decoded");
+			write_file(plain.path, input.data);
+			AsyncFile::transform(plain.path, encoded.path, encode, options);
+			compare("AsyncFile encode_packed", packed, read_file(encoded.path));
+
+			AsyncFile::transform(encoded.path, decoded.path, decode, options);
+			compare("AsyncFile decode_packed", letters, read_file(decoded.path));
+
+			AsyncFile::transform(encoded.path, encoded.path, decode, options);
+			compare("AsyncFile decode_packed in place", letters, read_file(encoded.path));
+		} });
+
+		suite.push_back({ "batch", [](const Input& input) {
+			/* Records of random length with gaps between them, every one with a key of its own */
+			std::mt19937_64 generator(input.data.size() * 31 + input.split);
+			std::vector<uint64_t> offsets;
+			std::vector<uint32_t> lengths, key_ids, shifts;
+			std::vector<uint64_t> key_offsets;
+			std::vector<uint32_t> key_lengths;
+
+			for (std::size_t offset = 0; offset < input.data.size();) {
+				offset += generator() % 4;
+				uint32_t length = static_cast<uint32_t>(std::min<std::size_t>(generator() % (input.split + 64), input.data.size() - std::min(offset, input.data.size())));
+				if (offset + length > input.data.size()) break;
+
+				offsets.push_back(offset);
+				lengths.push_back(length);
+				key_ids.push_back(static_cast<uint32_t>(key_ids.size()));
+				shifts.push_back(static_cast<uint32_t>(generator() % 52));
+				std::size_t key_start = generator() % input.key.size();
+				key_offsets.push_back(key_start);
+				key_lengths.push_back(static_cast<uint32_t>(1 + generator() % (input.key.size() - key_start)));
+				offset += length;
+			}
+
+			const BatchRecords records{ Span<const uint8_t>(input.data), offsets, lengths, key_ids };
+			const BatchKeys keys{ byte_span(input.key), key_offsets, key_lengths };
+			std::vector<uint8_t> caesar(input.data), xored(input.data), vigenere(input.data);
+
+			for (std::size_t r = 0; r < offsets.size(); r++) {
+				std::vector<uint8_t> record(input.data.begin() + offsets[r], input.data.begin() + offsets[r] + lengths[r]);
+				std::string key = input.key.substr(key_offsets[r], key_lengths[r]);
+				std::vector<uint8_t> shifted = reference_caesar(record, shifts[r], input.decode);
+				std::vector<uint8_t> mixed = reference_xor(record, key, 0);
+				std::vector<uint8_t> looked_up = reference_vigenere(record, key, input.decode, input.preserve_case, 0);
+				std::copy(shifted.begin(), shifted.end(), caesar.begin() + offsets[r]);
+				std::copy(mixed.begin(), mixed.end(), xored.begin() + offsets[r]);
+				std::copy(looked_up.begin(), looked_up.end(), vigenere.begin() + offsets[r]);
+			}
+
+			compare("Batch::caesar_shift", caesar, across_pools(input, [&](const uint8_t*, uint8_t* out, std::size_t size, const ParallelOptions& options) {
+				Batch::caesar_shift(records, shifts, Span<uint8_t>(out, size), input.decode, options);
+			}));
+			compare("Batch::apply_xor", xored, across_pools(input, [&](const uint8_t*, uint8_t* out, std::size_t size, const ParallelOptions& options) {
+				Batch::apply_xor(records, keys, Span<uint8_t>(out, size), options);
+			}));
+			compare("Batch::vigenere_lookup", vigenere, across_pools(input, [&](const uint8_t*, uint8_t* out, std::size_t size, const ParallelOptions& options) {
+				Batch::vigenere_lookup(records, keys, Span<uint8_t>(out, size), input.decode, input.preserve_case, options);
+			}));
+		} });
+
+		return suite;
+	}
+
+	/* Input drawn from the generator, data is mostly text, then UTF-8 with now and then a broken byte,
+	then bytes of any value */
+	static Input random_input(std::mt19937_64& generator, std::size_t max_size) {
+		static const char text_bytes[] = "etaoin shrdlu ETAOIN SHRDLU cmfwyp vbgkqjxz, CMFWYP VBGKQJXZ.\n";
+		Input input;
+
+		/* Short inputs are the ones that hit the edges of the kernels, so they come up often */
+		std::size_t size = generator() % 4 == 0 ? generator() % 128 : generator() % (max_size + 1);
+		input.data.resize(size);
+		std::size_t kind = generator() % 4;
+		if (kind == 0) {
+			for (uint8_t& byte : input.data) byte = static_cast<uint8_t>(generator());
+		} else if (kind == 1) {
+			/* Code points of every encoded length, surrogates skipped */
+			static const uint32_t limits[4] = { 0x80, 0x800, 0x10000, 0x110000 };
+			std::size_t written = 0;
+			while (written + 4 <= size) {
+				uint32_t code_point = static_cast<uint32_t>(generator() % limits[generator() % 4]);
+				if (code_point >= 0xD800 && code_point <= 0xDFFF) continue;
+				written += Utf8::encode_one(code_point, input.data.data() + written);
+			}
+			input.data.resize(written);
+			if (written != 0 && generator() % 2 == 0) input.data[generator() % written] = static_cast<uint8_t>(generator());
+		} else {
+			for (uint8_t& byte : input.data) byte = static_cast<uint8_t>(text_bytes[generator() % (sizeof(text_bytes) - 1)]);
+		}
+
+		std::size_t key_size = 1 + (generator() % 8 == 0 ? generator() % 300 : generator() % 24);
+		for (std::size_t i = 0; i < key_size; i++) input.key.push_back(generator() % 64 == 0 ? static_cast<char>(' ' + generator() % 32) : static_cast<char>((generator() % 2 ? 'a' : 'A') + generator() % 26));
+
+		input.shift = static_cast<uint32_t>(generator() % 64);
+		input.decode = generator() % 2 == 0;
+		input.preserve_case = generator() % 4 != 0;
+		input.key_position = generator() % 512;
+		input.split = 1 + (generator() % 2 == 0 ? generator() % 64 : generator() % 8192);
+		return input;
+	}
+
+	/* Input decoded from fuzzer bytes: a header of six bytes, then a key up to the first zero byte, then the data */
+	static Input fuzz_input(const uint8_t* data, std::size_t size) {
+		Input input;
+		uint8_t header[6] = {};
+		std::size_t used = size < sizeof(header) ? size : sizeof(header);
+		if (used != 0) std::memcpy(header, data, used);
+
+		input.shift = header[0];
+		input.decode = (header[1] & 1) != 0;
+		input.preserve_case = (header[1] & 2) == 0;
+		input.key_position = header[2];
+		input.split = 1 + ((static_cast<std::size_t>(header[3]) << 8) | header[4]);
+
+		const uint8_t* key = data + used;
+		const uint8_t* end = data + size;
+		std::size_t key_size = 0;
+		while (key + key_size < end && key[key_size] != 0 && key_size < 300) key_size++;
+
+		input.key.assign(reinterpret_cast<const char*>(key), key_size);
+		if (input.key.empty()) input.key = header[5] % 2 == 0 ? "Key" : "lemon";
+
+		const uint8_t* rest = key + key_size + (key + key_size < end ? 1 : 0);
+		input.data.assign(rest, end);
+		return input;
+	}
+
+	/* Runs the check at every instruction set level, the level is restored even when it throws */
+	static void check_levels(const Check& check, const Input& input) {
+		struct Restore {
+			~Restore() { Simd::limit(Simd::Level::AVX512); }
+		} restore;
+
+		for (Simd::Level level : levels()) {
+			Simd::limit(level);
+			try {
+				check(input);
+			} catch (const MismatchException& error) {
+				throw MismatchException(std::string(error.what()) + " at " + level_name(level));
+			}
+		}
+	}
+
+	/* Every check over options.cases random inputs, each result printed as soon as it is known */
+	static std::vector<Result> run(const Options& options, std::ostream& log) {
+		std::vector<Result> results;
+
+		for (const Case& entry : cases()) {
+			if (!options.filter.empty() && entry.name.find(options.filter) == std::string::npos) continue;
+
+			Result result{ entry.name, 0, 0, "" };
+			std::mt19937_64 generator(options.seed);
+
+			for (std::size_t i = 0; i < options.cases; i++) {
+				Input input = random_input(generator, options.max_size);
+				result.cases++;
+
+				try {
+					check_levels(entry.check, input);
+				} catch (const std::exception& error) {
+					if (result.failures++ == 0) result.first_failure = "case " + std::to_string(i) + ": " + error.what();
+				}
+			}
+
+			log << (result.failures == 0 ? "ok      " : "FAILED  ") << entry.name << " (" << result.cases << " cases)";
+			if (result.failures != 0) log << ", " << result.failures << " failed, first " << result.first_failure;
+			log << std::endl;
+			results.push_back(result);
+		}
+
+		return results;
+	}
+
+	/* Fuzzer entry, every check over one input. fuzz_input always makes a non-empty key and
+	polybius_key always a valid square, so no check has an input to reject: a mismatch and any other
+	exception alike abort, so the fuzzer keeps the input. */
+	static void fuzz(const uint8_t* data, std::size_t size) {
+		const Input input = fuzz_input(data, size);
+
+		for (const Case& entry : cases()) {
+			try {
+				check_levels(entry.check, input);
+			} catch (const MismatchException& error) {
+				std::fprintf(stderr, "%s: %s\n", entry.name.c_str(), error.what());
+				std::abort();
+			} catch (const std::exception& error) {
+				std::fprintf(stderr, "%s: unexpected exception: %s\n", entry.name.c_str(), error.what());
+				std::abort();
+			}
+		}
+	}
+
+	/* Scalar up to the highest level the processor supports */
+	static std::vector<Simd::Level> levels() {
+		Simd::limit(Simd::Level::AVX512);
+		std::vector<Simd::Level> supported;
+		for (uint32_t level = 0; level <= static_cast<uint32_t>(Simd::level()); level++) supported.push_back(static_cast<Simd::Level>(level));
+		return supported;
+	}
+
+	static const char* level_name(Simd::Level level) {
+		switch (level) {
+		case Simd::Level::Scalar: return "scalar";
+		case Simd::Level::SSE2: return "sse2";
+		case Simd::Level::SSSE3: return "ssse3";
+		case Simd::Level::AVX2: return "avx2";
+		case Simd::Level::AVX512: return "avx512";
+		}
+		return "unknown";
+	}
+
+	/* The references, one byte at a time and written straight from the rules of each cipher */
+
+	static std::vector<uint8_t> reference_caesar(std::vector<uint8_t> data, uint32_t amount, bool backwards) {
+		uint32_t shift = backwards ? (26 - amount % 26) % 26 : amount % 26;
+		for (uint8_t& byte : data) {
+			if (byte >= 'a' && byte <= 'z') byte = static_cast<uint8_t>('a' + (byte - 'a' + shift) % 26);
+			else if (byte >= 'A' && byte <= 'Z') byte = static_cast<uint8_t>('A' + (byte - 'A' + shift) % 26);
+		}
+		return data;
+	}
+
+	static std::vector<uint8_t> reference_atbash(std::vector<uint8_t> data) {
+		for (uint8_t& byte : data) {
+			if (byte >= 'a' && byte <= 'z') byte = static_cast<uint8_t>('z' - (byte - 'a'));
+			else if (byte >= 'A' && byte <= 'Z') byte = static_cast<uint8_t>('Z' - (byte - 'A'));
+		}
+		return data;
+	}
+
+	static std::vector<uint8_t> reference_xor(std::vector<uint8_t> data, const std::string& key, std::size_t key_position) {
+		for (std::size_t i = 0; i < data.size(); i++) data[i] ^= static_cast<uint8_t>(key[(key_position + i) % key.size()]);
+		return data;
+	}
+
+	/* Only letters are enciphered and move the key, a key byte that is not a letter stalls it there.
+	Without preserve_case every letter comes out lowercase. */
+	static std::vector<uint8_t> reference_vigenere(std::vector<uint8_t> data, const std::string& key, bool decode, bool preserve_case, std::size_t key_position) {
+		key_position %= key.size();
+		for (uint8_t& byte : data) {
+			bool upper = byte >= 'A' && byte <= 'Z';
+			if (!upper && !(byte >= 'a' && byte <= 'z')) continue;
+
+			uint32_t index = static_cast<uint32_t>(byte - (upper ? 'A' : 'a'));
+			uint8_t key_byte = static_cast<uint8_t>(key[key_position]);
+			bool key_letter = (key_byte >= 'A' && key_byte <= 'Z') || (key_byte >= 'a' && key_byte <= 'z');
+
+			if (key_letter) {
+				uint32_t shift = static_cast<uint32_t>((key_byte | 0x20) - 'a');
+				index = (index + (decode ? 26 - shift : shift)) % 26;
+				key_position = (key_position + 1) % key.size();
+			}
+
+			byte = static_cast<uint8_t>((upper && preserve_case ? 'A' : 'a') + index);
+		}
+		return data;
+	}
+
+	/* RFC 3629: no overlong forms, no surrogates, nothing past U+10FFFF */
+	static bool reference_utf8_valid(const std::vector<uint8_t>& data) {
+		for (std::size_t i = 0; i < data.size();) {
+			uint8_t lead = data[i];
+			std::size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+			if (length == 0 || i + length > data.size()) return false;
+
+			uint32_t code_point = length == 1 ? lead : lead & (0xFF >> (length + 1));
+			for (std::size_t k = 1; k < length; k++) {
+				if ((data[i + k] & 0xC0) != 0x80) return false;
+				code_point = (code_point << 6) | (data[i + k] & 0x3F);
+			}
+
+			static const uint32_t minimum[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+			if (code_point < minimum[length] || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF)) return false;
+			i += length;
+		}
+		return true;
+	}
+
+	/* File in the temporary directory, removed again when it goes out of scope */
+	struct TemporaryFile {
+		std::string path;
+
+		explicit TemporaryFile(const std::string& name) {
+			static std::atomic<uint64_t> counter{ std::random_device{}() };
+			const char* directory = std::getenv("TMPDIR");
+			if (directory == nullptr) directory = std::getenv("TEMP");
+			if (directory == nullptr) directory = ".";
+			path = std::string(directory) + "/ciphers-verify-" + std::to_string(counter++) + "-" + name;
+		}
+
+		~TemporaryFile() { std::remove(path.c_str()); }
+
+		TemporaryFile(const TemporaryFile&) = delete;
+		TemporaryFile& operator=(const TemporaryFile&) = delete;
+	};
+
+	static void write_file(const std::string& path, const std::vector<uint8_t>& data) {
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+		if (!file) throw std::runtime_error("Could not write " + path + ".");
+	}
+
+	static std::vector<uint8_t> read_file(const std::string& path) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) throw std::runtime_error("Could not read " + path + ".");
+		return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	/* Throws a MismatchException naming the first byte where actual and expected part */
+	static void compare(const char* path, const std::vector<uint8_t>& expected, const std::vector<uint8_t>& actual) {
+		if (expected == actual) return;
+
+		std::size_t at = 0;
+		while (at < expected.size() && at < actual.size() && expected[at] == actual[at]) at++;
+
+		std::ostringstream message;
+		message << path << " differs from the reference over " << expected.size() << " bytes, ";
+		if (at < expected.size() && at < actual.size()) message << "first at byte " << at << " (" << int(actual[at]) << " instead of " << int(expected[at]) << ")";
+		else message << actual.size() << " bytes written instead of " << expected.size();
+		throw MismatchException(message.str());
+	}
+
+private:
+	static std::vector<uint8_t> bytes(const std::string& data) { return std::vector<uint8_t>(data.begin(), data.end()); }
+	static std::vector<uint8_t> bytes(const std::vector<uint32_t>& data) { return std::vector<uint8_t>(data.begin(), data.end()); }
+	static std::string text(const std::vector<uint8_t>& data) { return std::string(data.begin(), data.end()); }
+
+	static const std::string& upper_letters() {
+		static const std::string letters = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+		return letters;
+	}
+
+	/* Distinct letters of the input key without the sacrifice, so that every input makes a valid square */
+	static std::string polybius_key(const std::string& key, int8_t sacrifice) {
+		std::string distinct;
+		for (char character : key) {
+			if (!std::isalpha(static_cast<uint8_t>(character))) continue;
+			char letter = static_cast<char>(std::toupper(static_cast<uint8_t>(character)));
+			if (letter != sacrifice && distinct.find(letter) == std::string::npos) distinct.push_back(letter);
+		}
+		return distinct;
+	}
+
+	static void compare_position(const char* path, const Input& input, std::size_t position) {
+		std::size_t expected = input.key_position % input.key.size();
+		for (uint8_t byte : input.data) {
+			uint8_t key_byte = static_cast<uint8_t>(input.key[expected]);
+			bool letter = std::isalpha(byte) && byte < 0x80;
+			if (letter && std::isalpha(key_byte) && key_byte < 0x80) expected = (expected + 1) % input.key.size();
+		}
+		if (position != expected) throw MismatchException(std::string(path) + " returned key position " + std::to_string(position) + " instead of " + std::to_string(expected));
+	}
+
+	/* Runs a kernel from one buffer into another and again in place, both have to agree */
+	template <typename kernel_function>
+	static std::vector<uint8_t> run_bytes(const std::vector<uint8_t>& data, kernel_function kernel) {
+		std::vector<uint8_t> output(data.size()), in_place(data);
+		kernel(data.data(), output.data(), data.size());
+		kernel(in_place.data(), in_place.data(), in_place.size());
+
+		compare("in place", output, in_place);
+		return output;
+	}
+
+	/* Runs a resumable kernel over consecutive pieces of input.split bytes */
+	template <typename piece_function>
+	static std::vector<uint8_t> in_pieces(const Input& input, piece_function piece) {
+		std::vector<uint8_t> output(input.data.size());
+		std::size_t written = 0;
+
+		for (std::size_t offset = 0; offset < input.data.size(); offset += input.split) {
+			std::size_t size = input.data.size() - offset < input.split ? input.data.size() - offset : input.split;
+			written += piece(input.data.data() + offset, output.data() + written, size);
+		}
+
+		output.resize(written);
+		return output;
+	}
+
+	/* Runs a parallel kernel on pools of one, two and three threads with input.split byte chunks,
+	every pool has to give the same output */
+	template <typename parallel_function>
+	static std::vector<uint8_t> across_pools(const Input& input, parallel_function kernel) {
+		static ThreadPool one(1), two(2), three(3);
+		ThreadPool* pools[] = { &one, &two, &three };
+		std::vector<uint8_t> first;
+
+		for (ThreadPool* pool : pools) {
+			ParallelOptions options;
+			options.pool = pool;
+			options.chunk_size = input.split;
+
+			std::vector<uint8_t> output(input.data);
+			kernel(input.data.data(), output.data(), output.size(), options);
+
+			if (pool == pools[0]) first = std::move(output);
+			else compare("thread count", first, output);
+		}
+
+		return first;
+	}
+};